@@ -14,6 +14,7 @@ import algomodule.nist5
 import algomodule.quark
 import algomodule.qubit
 import algomodule.scrypt
+import algomodule.sha256
 import algomodule.shavite3
 import algomodule.skein
 import algomodule.threes
@@ -4,9 +4,46 @@ from libc.string cimport memcpy
 
 cdef extern from "blake/blake.h":
 	extern void blake_hash(const char* input, char* output, uint32_t input_len);
+	ctypedef struct blake_context:
+		pass
+	extern void blake_init(blake_context* ctx);
+	extern void blake_update(blake_context* ctx, const void* input, size_t len);
+	extern void blake_digest(const blake_context* ctx, char* output);
 
 def _blake_hash(hash):
 	cdef char output[32];
 	cdef uint32_t input_len = len(hash);
 	blake_hash(hash, output, input_len);
-	return output[:32];
\ No newline at end of file
+	return output[:32];
+
+cdef class BlakeHash:
+	cdef blake_context ctx
+
+	name = 'blake'
+	digest_size = 32
+
+	def __cinit__(self):
+		blake_init(&self.ctx);
+
+	def update(self, const unsigned char[::1] data):
+		if data.shape[0] > 0:
+			blake_update(&self.ctx, &data[0], data.shape[0]);
+
+	def copy(self):
+		cdef BlakeHash other = BlakeHash.__new__(BlakeHash);
+		other.ctx = self.ctx;
+		return other;
+
+	def digest(self):
+		cdef char output[32];
+		blake_digest(&self.ctx, output);
+		return output[:32];
+
+	def hexdigest(self):
+		return self.digest().hex();
+
+def new(data=None):
+	h = BlakeHash();
+	if data is not None:
+		h.update(data);
+	return h;
@@ -15,3 +15,19 @@ void blake_hash(const char* input, char* output, uint32_t len)
     sph_blake256_close(&ctx_blake, output);
 }
 
+void blake_init(blake_context* ctx)
+{
+    sph_blake256_init(ctx);
+}
+
+void blake_update(blake_context* ctx, const void* input, size_t len)
+{
+    sph_blake256(ctx, input, len);
+}
+
+/* Finalises a copy of the context, so ctx may keep absorbing data. */
+void blake_digest(const blake_context* ctx, char* output)
+{
+    blake_context ctx_blake = *ctx;
+    sph_blake256_close(&ctx_blake, output);
+}
@@ -5,10 +5,21 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include "../sha3/sph_blake.h"
+
 void blake_hash(const char* input, char* output, uint32_t len);
 
+/* Incremental interface.  The context is a plain sph struct, so it can be
+   copied by assignment to fork a partially absorbed message. */
+typedef sph_blake256_context blake_context;
+
+void blake_init(blake_context* ctx);
+void blake_update(blake_context* ctx, const void* input, size_t len);
+void blake_digest(const blake_context* ctx, char* output);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,105 @@
+#include "cpu.h"
+
+#ifdef CORE_CPU_X86
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+static void
+cpuid(unsigned int leaf, unsigned int subleaf, unsigned int r[4])
+{
+#ifdef _MSC_VER
+	__cpuidex((int *)r, (int)leaf, (int)subleaf);
+#else
+	__cpuid_count(leaf, subleaf, r[0], r[1], r[2], r[3]);
+#endif
+}
+
+static unsigned long long
+xgetbv0(void)
+{
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	unsigned int eax, edx;
+
+	__asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return ((unsigned long long)edx << 32) | eax;
+#endif
+}
+
+static unsigned int
+cpu_detect(void)
+{
+	unsigned int r[4], max_leaf, features = 0;
+	unsigned long long xcr0 = 0;
+	int ymm = 0, zmm = 0;
+
+	cpuid(0, 0, r);
+	max_leaf = r[0];
+	if (max_leaf < 1)
+		return 0;
+
+	cpuid(1, 0, r);
+	if (r[3] & (1u << 26))
+		features |= CPU_FEATURE_SSE2;
+	if (r[2] & (1u << 9))
+		features |= CPU_FEATURE_SSSE3;
+	if (r[2] & (1u << 19))
+		features |= CPU_FEATURE_SSE41;
+
+	/* OSXSAVE: the OS manages extended register state via XSAVE. */
+	if (r[2] & (1u << 27)) {
+		xcr0 = xgetbv0();
+		ymm = (xcr0 & 0x06) == 0x06;
+		zmm = (xcr0 & 0xe6) == 0xe6;
+	}
+	if ((r[2] & (1u << 28)) && ymm)
+		features |= CPU_FEATURE_AVX;
+
+	if (max_leaf < 7)
+		return features;
+
+	cpuid(7, 0, r);
+	if ((r[1] & (1u << 5)) && (features & CPU_FEATURE_AVX))
+		features |= CPU_FEATURE_AVX2;
+	if ((r[1] & (1u << 8)))
+		features |= CPU_FEATURE_BMI2;
+	if ((r[1] & (1u << 29)))
+		features |= CPU_FEATURE_SHA;
+	if ((r[1] & (1u << 16)) && zmm) {
+		features |= CPU_FEATURE_AVX512F;
+		if (r[1] & (1u << 30))
+			features |= CPU_FEATURE_AVX512BW;
+		if (r[1] & (1u << 31))
+			features |= CPU_FEATURE_AVX512VL;
+	}
+
+	return features;
+}
+
+#endif /* CORE_CPU_X86 */
+
+/* High bit marks the cache as filled, so a CPU with no features isn't re-probed. */
+#define CPU_FEATURES_DETECTED	(1u << 31)
+
+unsigned int
+core_cpu_features(void)
+{
+	static volatile unsigned int features = 0;
+	unsigned int f = features;
+
+	if (!f) {
+#ifdef CORE_CPU_X86
+		f = cpu_detect() | CPU_FEATURES_DETECTED;
+#else
+		f = CPU_FEATURES_DETECTED;
+#endif
+		/* Racing threads compute the same value, so a plain store is fine. */
+		features = f;
+	}
+	return f & ~CPU_FEATURES_DETECTED;
+}
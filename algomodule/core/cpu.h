@@ -0,0 +1,34 @@
+#ifndef CORE_CPU_H
+#define CORE_CPU_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CORE_CPU_X86 1
+#endif
+
+/*
+ * Instruction set extensions usable by this process.  The AVX and AVX-512
+ * bits are only reported when the OS saves the corresponding register state.
+ */
+#define CPU_FEATURE_SSE2	(1u << 0)
+#define CPU_FEATURE_SSSE3	(1u << 1)
+#define CPU_FEATURE_SSE41	(1u << 2)
+#define CPU_FEATURE_AVX		(1u << 3)
+#define CPU_FEATURE_AVX2	(1u << 4)
+#define CPU_FEATURE_AVX512F	(1u << 5)
+#define CPU_FEATURE_AVX512BW	(1u << 6)
+#define CPU_FEATURE_AVX512VL	(1u << 7)
+#define CPU_FEATURE_SHA		(1u << 8)
+#define CPU_FEATURE_BMI2	(1u << 9)
+
+/* Detected once on first use and cached; always 0 on non-x86 targets. */
+unsigned int core_cpu_features(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,152 @@
+#include <stdlib.h>
+
+#include "scratch.h"
+
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <pthread.h>
+#include <sys/mman.h>
+#endif
+
+#define SCRATCH_ALIGN		64
+#define SCRATCH_HUGE_PAGE	(2 * 1024 * 1024)
+
+void
+core_scratch_init(core_scratch *s, int flags)
+{
+
+	s->base = NULL;
+	s->size = 0;
+	s->mapped = 0;
+	s->flags = flags;
+	s->backing = CORE_SCRATCH_HEAP;
+}
+
+void
+core_scratch_free(core_scratch *s)
+{
+
+	if (s->base) {
+#ifdef _WIN32
+		_aligned_free(s->base);
+#else
+		if (s->mapped)
+			munmap(s->base, s->mapped);
+		else
+			free(s->base);
+#endif
+	}
+	core_scratch_init(s, s->flags);
+}
+
+#if defined(__linux__) && defined(MAP_ANONYMOUS)
+/* Explicit huge pages if any are reserved, else a THP-advised mapping. */
+static void *
+scratch_map_huge(core_scratch *s, size_t size)
+{
+	size_t len = (size + SCRATCH_HUGE_PAGE - 1) & ~(size_t)(SCRATCH_HUGE_PAGE - 1);
+	void *p = MAP_FAILED;
+	int backing = CORE_SCRATCH_HUGETLB;
+
+#ifdef MAP_HUGETLB
+	p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+	if (p == MAP_FAILED) {
+		p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			return NULL;
+#ifdef MADV_HUGEPAGE
+		madvise(p, len, MADV_HUGEPAGE);
+#endif
+		backing = CORE_SCRATCH_THP;
+	}
+	s->base = p;
+	s->size = len;
+	s->mapped = len;
+	s->backing = backing;
+	return p;
+}
+#endif
+
+void *
+core_scratch_get(core_scratch *s, size_t size)
+{
+	void *p;
+
+	if (s->base && size <= s->size)
+		return s->base;
+	core_scratch_free(s);
+
+#if defined(__linux__) && defined(MAP_ANONYMOUS)
+	if ((s->flags & CORE_SCRATCH_HUGE) && (p = scratch_map_huge(s, size)))
+		return p;
+#endif
+
+	size = (size + SCRATCH_ALIGN - 1) & ~(size_t)(SCRATCH_ALIGN - 1);
+#ifdef _WIN32
+	if (!(p = _aligned_malloc(size, SCRATCH_ALIGN)))
+		return NULL;
+#else
+	if (posix_memalign(&p, SCRATCH_ALIGN, size))
+		return NULL;
+#endif
+	s->base = p;
+	s->size = size;
+	return p;
+}
+
+#ifdef _WIN32
+
+core_scratch *
+core_scratch_thread(void)
+{
+	static __declspec(thread) core_scratch tls;
+
+	return &tls;
+}
+
+#else
+
+static pthread_key_t scratch_key;
+static pthread_once_t scratch_once = PTHREAD_ONCE_INIT;
+static int scratch_key_ok;
+
+static void
+scratch_thread_exit(void *p)
+{
+
+	core_scratch_free(p);
+	free(p);
+}
+
+static void
+scratch_key_create(void)
+{
+
+	scratch_key_ok = pthread_key_create(&scratch_key, scratch_thread_exit) == 0;
+}
+
+core_scratch *
+core_scratch_thread(void)
+{
+	core_scratch *s;
+
+	pthread_once(&scratch_once, scratch_key_create);
+	if (!scratch_key_ok)
+		return NULL;
+	if ((s = pthread_getspecific(scratch_key)))
+		return s;
+	if (!(s = malloc(sizeof(*s))))
+		return NULL;
+	core_scratch_init(s, 0);
+	if (pthread_setspecific(scratch_key, s)) {
+		free(s);
+		return NULL;
+	}
+	return s;
+}
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef CORE_SCRATCH_H
+#define CORE_SCRATCH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+/*
+ * Reusable scratch memory for memory-hard hashes.  A scratch area grows to
+ * the largest size requested and is kept between calls, so repeated hashes
+ * run over warm, already-faulted pages instead of a fresh stack or heap
+ * block each time.  Not safe for concurrent use; give each thread its own.
+ */
+
+/* Back the area with huge pages when the platform allows it. */
+#define CORE_SCRATCH_HUGE	1
+
+/* How the current area is backed. */
+#define CORE_SCRATCH_HEAP	0	/* aligned heap block */
+#define CORE_SCRATCH_THP	1	/* anonymous mapping, transparent huge pages advised */
+#define CORE_SCRATCH_HUGETLB	2	/* explicit huge pages */
+
+typedef struct core_scratch {
+	void *base;
+	size_t size;
+	size_t mapped;
+	int flags;
+	int backing;
+} core_scratch;
+
+/* Empty scratch area; flags is 0 or CORE_SCRATCH_HUGE. */
+void core_scratch_init(core_scratch *s, int flags);
+
+/*
+ * At least size bytes, aligned to 64, or NULL if allocation fails.  The
+ * contents are not preserved when the area has to grow.
+ */
+void *core_scratch_get(core_scratch *s, size_t size);
+
+/* Release the memory; s can be reused afterwards. */
+void core_scratch_free(core_scratch *s);
+
+/*
+ * The calling thread's default scratch area, released when the thread
+ * exits (on Windows it lives until the process exits).  NULL if it cannot
+ * be set up.
+ */
+core_scratch *core_scratch_thread(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
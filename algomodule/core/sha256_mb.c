@@ -0,0 +1,226 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "sha256_mb.h"
+#include "sha256_transform.h"
+
+static const uint32_t sha256_iv[8] = {
+	0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+	0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+static void
+be32enc(unsigned char *p, uint32_t x)
+{
+
+	p[3] = x & 0xff;
+	p[2] = (x >> 8) & 0xff;
+	p[1] = (x >> 16) & 0xff;
+	p[0] = (x >> 24) & 0xff;
+}
+
+static void
+sha256_mb_init(uint32_t (*state)[8], size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		memcpy(state[i], sha256_iv, 32);
+}
+
+/* At most SHA256_MB_LANES lanes. */
+static void
+sha256_mb_final_lanes(uint32_t (*state)[8], uint64_t done,
+    const unsigned char *const *msg, size_t len, unsigned char *const *out,
+    size_t n)
+{
+	unsigned char tail[SHA256_MB_LANES][128];
+	const unsigned char *block[SHA256_MB_LANES];
+	size_t full = len / 64, rest = len % 64;
+	size_t tail_blocks = (rest < 56) ? 1 : 2;
+	uint64_t bits = (done + len) * 8;
+	size_t i, j;
+
+	/* Whole blocks straight from the messages. */
+	for (j = 0; j < full; j++) {
+		for (i = 0; i < n; i++)
+			block[i] = msg[i] + j * 64;
+		sha256_transform_mb(state, block, n);
+	}
+
+	/* Padding and the 64-bit bit count. */
+	for (i = 0; i < n; i++) {
+		memset(tail[i], 0, tail_blocks * 64);
+		memcpy(tail[i], msg[i] + full * 64, rest);
+		tail[i][rest] = 0x80;
+		be32enc(&tail[i][tail_blocks * 64 - 8], (uint32_t)(bits >> 32));
+		be32enc(&tail[i][tail_blocks * 64 - 4], (uint32_t)bits);
+	}
+	for (j = 0; j < tail_blocks; j++) {
+		for (i = 0; i < n; i++)
+			block[i] = tail[i] + j * 64;
+		sha256_transform_mb(state, block, n);
+	}
+
+	for (i = 0; i < n; i++)
+		for (j = 0; j < 8; j++)
+			be32enc(out[i] + j * 4, state[i][j]);
+}
+
+void
+sha256_mb_final(uint32_t (*state)[8], uint64_t done,
+    const unsigned char *const *msg, size_t len, unsigned char *const *out,
+    size_t n)
+{
+	size_t m;
+
+	for (; n; n -= m, state += m, msg += m, out += m) {
+		m = (n < SHA256_MB_LANES) ? n : SHA256_MB_LANES;
+		sha256_mb_final_lanes(state, done, msg, len, out, m);
+	}
+}
+
+void
+sha256_many(const unsigned char *in, size_t len, size_t count,
+    unsigned char *out)
+{
+	uint32_t state[SHA256_MB_LANES][8];
+	const unsigned char *msg[SHA256_MB_LANES];
+	unsigned char *dst[SHA256_MB_LANES];
+	size_t i, m;
+
+	for (; count; count -= m, in += m * len, out += m * 32) {
+		m = (count < SHA256_MB_LANES) ? count : SHA256_MB_LANES;
+		for (i = 0; i < m; i++) {
+			msg[i] = in + i * len;
+			dst[i] = out + i * 32;
+		}
+		sha256_mb_init(state, m);
+		sha256_mb_final_lanes(state, 0, msg, len, dst, m);
+	}
+}
+
+void
+sha256d_many(const unsigned char *in, size_t len, size_t count,
+    unsigned char *out)
+{
+	uint32_t state[SHA256_MB_LANES][8];
+	const unsigned char *msg[SHA256_MB_LANES];
+	unsigned char *dst[SHA256_MB_LANES];
+	size_t i, m;
+
+	for (; count; count -= m, in += m * len, out += m * 32) {
+		m = (count < SHA256_MB_LANES) ? count : SHA256_MB_LANES;
+		for (i = 0; i < m; i++) {
+			msg[i] = in + i * len;
+			dst[i] = out + i * 32;
+		}
+		sha256_mb_init(state, m);
+		sha256_mb_final_lanes(state, 0, msg, len, dst, m);
+
+		/* Second pass hashes the first digests in place. */
+		sha256_mb_init(state, m);
+		sha256_mb_final_lanes(state, 0,
+		    (const unsigned char *const *)dst, 32, dst, m);
+	}
+}
+
+/* At most SHA256_MB_LANES lanes; saltbuf holds n * (saltlen + 4) bytes. */
+static void
+pbkdf2_sha256_mb_lanes(const unsigned char *const *passwd, size_t passwdlen,
+    const unsigned char *const *salt, size_t saltlen,
+    unsigned char *const *buf, size_t dkLen, size_t n, unsigned char *saltbuf)
+{
+	uint32_t istate[SHA256_MB_LANES][8], ostate[SHA256_MB_LANES][8];
+	uint32_t state[SHA256_MB_LANES][8];
+	unsigned char khash[SHA256_MB_LANES][32];
+	unsigned char pad[SHA256_MB_LANES][64];
+	unsigned char U[SHA256_MB_LANES][32];
+	const unsigned char *msg[SHA256_MB_LANES];
+	const unsigned char *khash_ptr[SHA256_MB_LANES];
+	unsigned char *dst[SHA256_MB_LANES] = { 0 };
+	const unsigned char *const *K = passwd;
+	size_t Klen = passwdlen;
+	size_t i, j, k, clen;
+
+	/* If Klen > 64, the key is really SHA256(K). */
+	if (Klen > 64) {
+		for (i = 0; i < n; i++)
+			dst[i] = khash[i];
+		sha256_mb_init(state, n);
+		sha256_mb_final_lanes(state, 0, passwd, passwdlen, dst, n);
+		for (i = 0; i < n; i++)
+			khash_ptr[i] = khash[i];
+		K = khash_ptr;
+		Klen = 32;
+	}
+
+	/* Inner and outer states after the keyed pad blocks. */
+	for (i = 0; i < n; i++) {
+		memset(pad[i], 0x36, 64);
+		for (k = 0; k < Klen; k++)
+			pad[i][k] ^= K[i][k];
+	}
+	for (i = 0; i < n; i++)
+		msg[i] = pad[i];
+	sha256_mb_init(istate, n);
+	sha256_transform_mb(istate, msg, n);
+	for (i = 0; i < n; i++)
+		for (k = 0; k < 64; k++)
+			pad[i][k] ^= 0x36 ^ 0x5c;
+	sha256_mb_init(ostate, n);
+	sha256_transform_mb(ostate, msg, n);
+
+	for (i = 0; i < n; i++)
+		memcpy(saltbuf + i * (saltlen + 4), salt[i], saltlen);
+
+	/* Iterate through the blocks. */
+	for (j = 0; j * 32 < dkLen; j++) {
+		/* U_1 = PRF(P, S || INT(j + 1)); with c = 1, T_j = U_1. */
+		for (i = 0; i < n; i++) {
+			be32enc(saltbuf + i * (saltlen + 4) + saltlen,
+			    (uint32_t)(j + 1));
+			msg[i] = saltbuf + i * (saltlen + 4);
+			dst[i] = U[i];
+		}
+		memcpy(state, istate, n * 32);
+		sha256_mb_final_lanes(state, 64, msg, saltlen + 4, dst, n);
+
+		memcpy(state, ostate, n * 32);
+		sha256_mb_final_lanes(state, 64,
+		    (const unsigned char *const *)dst, 32, dst, n);
+
+		/* Copy as many bytes as necessary into buf. */
+		clen = dkLen - j * 32;
+		if (clen > 32)
+			clen = 32;
+		for (i = 0; i < n; i++)
+			memcpy(buf[i] + j * 32, U[i], clen);
+	}
+}
+
+void
+pbkdf2_sha256_mb(const unsigned char *const *passwd, size_t passwdlen,
+    const unsigned char *const *salt, size_t saltlen,
+    unsigned char *const *buf, size_t dkLen, size_t n)
+{
+	unsigned char stackbuf[SHA256_MB_LANES * 132];
+	unsigned char *saltbuf = stackbuf;
+	size_t m;
+
+	/* Salts up to 128 bytes (scrypt's r = 1 block) avoid the heap. */
+	if (saltlen > 128) {
+		saltbuf = malloc(SHA256_MB_LANES * (saltlen + 4));
+		if (!saltbuf)
+			abort();
+	}
+
+	for (; n; n -= m, passwd += m, salt += m, buf += m) {
+		m = (n < SHA256_MB_LANES) ? n : SHA256_MB_LANES;
+		pbkdf2_sha256_mb_lanes(passwd, passwdlen, salt, saltlen, buf,
+		    dkLen, m, saltbuf);
+	}
+
+	if (saltbuf != stackbuf)
+		free(saltbuf);
+}
@@ -0,0 +1,49 @@
+#ifndef SHA256_MB_H
+#define SHA256_MB_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Batched SHA-256 on top of sha256_transform_mb().  Every message in a
+ * batch has the same length, so all lanes compress the same number of
+ * blocks and stay in lockstep.
+ */
+
+/* Lanes handed to the multi-buffer transform per call. */
+#define SHA256_MB_LANES 16
+
+/*
+ * Finish n hashes: state[i] has already absorbed done bytes (a multiple of
+ * 64) and msg[i] supplies the remaining len bytes.  The digest of lane i is
+ * written to out[i]; out[i] may alias msg[i].
+ */
+void sha256_mb_final(uint32_t (*state)[8], uint64_t done,
+    const unsigned char *const *msg, size_t len, unsigned char *const *out,
+    size_t n);
+
+/* out + 32 * i = SHA256(in + len * i) for i < count. */
+void sha256_many(const unsigned char *in, size_t len, size_t count,
+    unsigned char *out);
+
+/* out + 32 * i = SHA256(SHA256(in + len * i)) for i < count. */
+void sha256d_many(const unsigned char *in, size_t len, size_t count,
+    unsigned char *out);
+
+/*
+ * PBKDF2-HMAC-SHA256 with a single iteration (c = 1, as scrypt uses it) for
+ * n lanes: buf[i] = PBKDF2(passwd[i], salt[i], 1, dkLen).
+ */
+void pbkdf2_sha256_mb(const unsigned char *const *passwd, size_t passwdlen,
+    const unsigned char *const *salt, size_t saltlen,
+    unsigned char *const *buf, size_t dkLen, size_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,584 @@
+#include <string.h>
+
+#include "cpu.h"
+#include "sha256_transform.h"
+
+#ifdef CORE_CPU_X86
+#include <immintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#define SHA256_TARGET_SHANI	__attribute__((target("sha,sse4.1,ssse3")))
+#define SHA256_TARGET_AVX2	__attribute__((target("avx2")))
+#define SHA256_TARGET_AVX512	__attribute__((target("avx512f,avx512bw")))
+#else
+#define SHA256_TARGET_SHANI
+#define SHA256_TARGET_AVX2
+#define SHA256_TARGET_AVX512
+#endif
+#endif
+
+typedef void (*sha256_transform_fn)(uint32_t [8], const unsigned char *,
+    size_t);
+typedef void (*sha256_transform_mb_fn)(uint32_t (*)[8],
+    const unsigned char *const *, size_t);
+
+static sha256_transform_fn transform_impl;
+static sha256_transform_mb_fn transform_mb_impl;
+static const char *transform_name;
+static const char *transform_mb_name;
+
+/* Lanes left over after the widest multi-buffer kernel. */
+static sha256_transform_mb_fn transform_mb_tail;
+
+/* Scalar */
+
+static uint32_t
+be32dec(const unsigned char *p)
+{
+
+	return ((uint32_t)(p[3]) + ((uint32_t)(p[2]) << 8) +
+	    ((uint32_t)(p[1]) << 16) + ((uint32_t)(p[0]) << 24));
+}
+
+/* Elementary functions used by SHA256 */
+#define Ch(x, y, z)	((x & (y ^ z)) ^ z)
+#define Maj(x, y, z)	((x & (y | z)) | (y & z))
+#define SHR(x, n)	(x >> n)
+#define ROTR(x, n)	((x >> n) | (x << (32 - n)))
+#define S0(x)		(ROTR(x, 2) ^ ROTR(x, 13) ^ ROTR(x, 22))
+#define S1(x)		(ROTR(x, 6) ^ ROTR(x, 11) ^ ROTR(x, 25))
+#define s0(x)		(ROTR(x, 7) ^ ROTR(x, 18) ^ SHR(x, 3))
+#define s1(x)		(ROTR(x, 17) ^ ROTR(x, 19) ^ SHR(x, 10))
+
+/* SHA256 round function */
+#define RND(a, b, c, d, e, f, g, h, k)			\
+	t0 = h + S1(e) + Ch(e, f, g) + k;		\
+	t1 = S0(a) + Maj(a, b, c);			\
+	d += t0;					\
+	h  = t0 + t1;
+
+/* Adjusted round function for rotating state */
+#define RNDr(S, W, i, k)			\
+	RND(S[(64 - i) % 8], S[(65 - i) % 8],	\
+	    S[(66 - i) % 8], S[(67 - i) % 8],	\
+	    S[(68 - i) % 8], S[(69 - i) % 8],	\
+	    S[(70 - i) % 8], S[(71 - i) % 8],	\
+	    W[i] + k)
+
+static void
+sha256_transform_scalar(uint32_t state[8], const unsigned char *blocks,
+    size_t nblocks)
+{
+	uint32_t W[64];
+	uint32_t S[8];
+	uint32_t t0, t1;
+	int i;
+
+	for (; nblocks; nblocks--, blocks += 64) {
+		/* 1. Prepare message schedule W. */
+		for (i = 0; i < 16; i++)
+			W[i] = be32dec(blocks + i * 4);
+		for (i = 16; i < 64; i++)
+			W[i] = s1(W[i - 2]) + W[i - 7] + s0(W[i - 15]) + W[i - 16];
+
+		/* 2. Initialize working variables. */
+		memcpy(S, state, 32);
+
+		/* 3. Mix. */
+		RNDr(S, W, 0, 0x428a2f98);
+		RNDr(S, W, 1, 0x71374491);
+		RNDr(S, W, 2, 0xb5c0fbcf);
+		RNDr(S, W, 3, 0xe9b5dba5);
+		RNDr(S, W, 4, 0x3956c25b);
+		RNDr(S, W, 5, 0x59f111f1);
+		RNDr(S, W, 6, 0x923f82a4);
+		RNDr(S, W, 7, 0xab1c5ed5);
+		RNDr(S, W, 8, 0xd807aa98);
+		RNDr(S, W, 9, 0x12835b01);
+		RNDr(S, W, 10, 0x243185be);
+		RNDr(S, W, 11, 0x550c7dc3);
+		RNDr(S, W, 12, 0x72be5d74);
+		RNDr(S, W, 13, 0x80deb1fe);
+		RNDr(S, W, 14, 0x9bdc06a7);
+		RNDr(S, W, 15, 0xc19bf174);
+		RNDr(S, W, 16, 0xe49b69c1);
+		RNDr(S, W, 17, 0xefbe4786);
+		RNDr(S, W, 18, 0x0fc19dc6);
+		RNDr(S, W, 19, 0x240ca1cc);
+		RNDr(S, W, 20, 0x2de92c6f);
+		RNDr(S, W, 21, 0x4a7484aa);
+		RNDr(S, W, 22, 0x5cb0a9dc);
+		RNDr(S, W, 23, 0x76f988da);
+		RNDr(S, W, 24, 0x983e5152);
+		RNDr(S, W, 25, 0xa831c66d);
+		RNDr(S, W, 26, 0xb00327c8);
+		RNDr(S, W, 27, 0xbf597fc7);
+		RNDr(S, W, 28, 0xc6e00bf3);
+		RNDr(S, W, 29, 0xd5a79147);
+		RNDr(S, W, 30, 0x06ca6351);
+		RNDr(S, W, 31, 0x14292967);
+		RNDr(S, W, 32, 0x27b70a85);
+		RNDr(S, W, 33, 0x2e1b2138);
+		RNDr(S, W, 34, 0x4d2c6dfc);
+		RNDr(S, W, 35, 0x53380d13);
+		RNDr(S, W, 36, 0x650a7354);
+		RNDr(S, W, 37, 0x766a0abb);
+		RNDr(S, W, 38, 0x81c2c92e);
+		RNDr(S, W, 39, 0x92722c85);
+		RNDr(S, W, 40, 0xa2bfe8a1);
+		RNDr(S, W, 41, 0xa81a664b);
+		RNDr(S, W, 42, 0xc24b8b70);
+		RNDr(S, W, 43, 0xc76c51a3);
+		RNDr(S, W, 44, 0xd192e819);
+		RNDr(S, W, 45, 0xd6990624);
+		RNDr(S, W, 46, 0xf40e3585);
+		RNDr(S, W, 47, 0x106aa070);
+		RNDr(S, W, 48, 0x19a4c116);
+		RNDr(S, W, 49, 0x1e376c08);
+		RNDr(S, W, 50, 0x2748774c);
+		RNDr(S, W, 51, 0x34b0bcb5);
+		RNDr(S, W, 52, 0x391c0cb3);
+		RNDr(S, W, 53, 0x4ed8aa4a);
+		RNDr(S, W, 54, 0x5b9cca4f);
+		RNDr(S, W, 55, 0x682e6ff3);
+		RNDr(S, W, 56, 0x748f82ee);
+		RNDr(S, W, 57, 0x78a5636f);
+		RNDr(S, W, 58, 0x84c87814);
+		RNDr(S, W, 59, 0x8cc70208);
+		RNDr(S, W, 60, 0x90befffa);
+		RNDr(S, W, 61, 0xa4506ceb);
+		RNDr(S, W, 62, 0xbef9a3f7);
+		RNDr(S, W, 63, 0xc67178f2);
+
+		/* 4. Mix local working variables into global state */
+		for (i = 0; i < 8; i++)
+			state[i] += S[i];
+	}
+}
+
+static void
+sha256_transform_mb_serial(uint32_t (*state)[8],
+    const unsigned char *const *block, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		sha256_transform(state[i], block[i], 1);
+}
+
+#ifdef CORE_CPU_X86
+
+static const uint32_t K256[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+/*
+ * SHA-NI.  The state is kept as ABEF/CDGH halves, the layout
+ * sha256rnds2 works on; each quad-round also advances the message
+ * schedule held in four registers.
+ */
+
+#define SHANI_ROUNDS(M, i)						\
+	MSG = _mm_add_epi32(M,						\
+	    _mm_loadu_si128((const __m128i *)&K256[(i) * 4]));		\
+	STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);		\
+	MSG = _mm_shuffle_epi32(MSG, 0x0e);				\
+	STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);
+
+/* W[i+4..i+7] from W[i-12..i+3]: Mnext held sigma0 terms from msg1. */
+#define SHANI_MSG2(Mnext, M, Mprev)					\
+	Mnext = _mm_sha256msg2_epu32(					\
+	    _mm_add_epi32(Mnext, _mm_alignr_epi8(M, Mprev, 4)), M);
+
+#define SHANI_MSG1(Mprev, M)						\
+	Mprev = _mm_sha256msg1_epu32(Mprev, M);
+
+SHA256_TARGET_SHANI
+static void
+sha256_transform_shani(uint32_t state[8], const unsigned char *blocks,
+    size_t nblocks)
+{
+	const __m128i BSWAP = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+	    0x0405060700010203ULL);
+	__m128i STATE0, STATE1, MSG, TMP, M0, M1, M2, M3, ABEF, CDGH;
+
+	TMP = _mm_loadu_si128((const __m128i *)&state[0]);
+	STATE1 = _mm_loadu_si128((const __m128i *)&state[4]);
+	TMP = _mm_shuffle_epi32(TMP, 0xb1);		/* CDAB */
+	STATE1 = _mm_shuffle_epi32(STATE1, 0x1b);	/* EFGH */
+	STATE0 = _mm_alignr_epi8(TMP, STATE1, 8);	/* ABEF */
+	STATE1 = _mm_blend_epi16(STATE1, TMP, 0xf0);	/* CDGH */
+
+	for (; nblocks; nblocks--, blocks += 64) {
+		ABEF = STATE0;
+		CDGH = STATE1;
+
+		M0 = _mm_shuffle_epi8(_mm_loadu_si128(
+		    (const __m128i *)(blocks + 0)), BSWAP);
+		M1 = _mm_shuffle_epi8(_mm_loadu_si128(
+		    (const __m128i *)(blocks + 16)), BSWAP);
+		M2 = _mm_shuffle_epi8(_mm_loadu_si128(
+		    (const __m128i *)(blocks + 32)), BSWAP);
+		M3 = _mm_shuffle_epi8(_mm_loadu_si128(
+		    (const __m128i *)(blocks + 48)), BSWAP);
+
+		SHANI_ROUNDS(M0, 0);
+		SHANI_ROUNDS(M1, 1);
+		SHANI_MSG1(M0, M1);
+		SHANI_ROUNDS(M2, 2);
+		SHANI_MSG1(M1, M2);
+		SHANI_ROUNDS(M3, 3);
+		SHANI_MSG2(M0, M3, M2);
+		SHANI_MSG1(M2, M3);
+		SHANI_ROUNDS(M0, 4);
+		SHANI_MSG2(M1, M0, M3);
+		SHANI_MSG1(M3, M0);
+		SHANI_ROUNDS(M1, 5);
+		SHANI_MSG2(M2, M1, M0);
+		SHANI_MSG1(M0, M1);
+		SHANI_ROUNDS(M2, 6);
+		SHANI_MSG2(M3, M2, M1);
+		SHANI_MSG1(M1, M2);
+		SHANI_ROUNDS(M3, 7);
+		SHANI_MSG2(M0, M3, M2);
+		SHANI_MSG1(M2, M3);
+		SHANI_ROUNDS(M0, 8);
+		SHANI_MSG2(M1, M0, M3);
+		SHANI_MSG1(M3, M0);
+		SHANI_ROUNDS(M1, 9);
+		SHANI_MSG2(M2, M1, M0);
+		SHANI_MSG1(M0, M1);
+		SHANI_ROUNDS(M2, 10);
+		SHANI_MSG2(M3, M2, M1);
+		SHANI_MSG1(M1, M2);
+		SHANI_ROUNDS(M3, 11);
+		SHANI_MSG2(M0, M3, M2);
+		SHANI_MSG1(M2, M3);
+		SHANI_ROUNDS(M0, 12);
+		SHANI_MSG2(M1, M0, M3);
+		SHANI_MSG1(M3, M0);
+		SHANI_ROUNDS(M1, 13);
+		SHANI_MSG2(M2, M1, M0);
+		SHANI_ROUNDS(M2, 14);
+		SHANI_MSG2(M3, M2, M1);
+		SHANI_ROUNDS(M3, 15);
+
+		STATE0 = _mm_add_epi32(STATE0, ABEF);
+		STATE1 = _mm_add_epi32(STATE1, CDGH);
+	}
+
+	TMP = _mm_shuffle_epi32(STATE0, 0x1b);		/* FEBA */
+	STATE1 = _mm_shuffle_epi32(STATE1, 0xb1);	/* DCHG */
+	STATE0 = _mm_blend_epi16(TMP, STATE1, 0xf0);	/* DCBA */
+	STATE1 = _mm_alignr_epi8(STATE1, TMP, 8);	/* HGFE */
+	_mm_storeu_si128((__m128i *)&state[0], STATE0);
+	_mm_storeu_si128((__m128i *)&state[4], STATE1);
+}
+
+/*
+ * AVX2 multi-buffer: eight independent messages, one per 32-bit lane.
+ * Blocks and states are transposed in and out of lane order.
+ */
+
+#define ROTR8(x, n)							\
+	_mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
+#define XOR3_8(x, y, z)							\
+	_mm256_xor_si256(_mm256_xor_si256(x, y), z)
+#define S0_8(x)		XOR3_8(ROTR8(x, 2), ROTR8(x, 13), ROTR8(x, 22))
+#define S1_8(x)		XOR3_8(ROTR8(x, 6), ROTR8(x, 11), ROTR8(x, 25))
+#define s0_8(x)		XOR3_8(ROTR8(x, 7), ROTR8(x, 18), _mm256_srli_epi32(x, 3))
+#define s1_8(x)		XOR3_8(ROTR8(x, 17), ROTR8(x, 19), _mm256_srli_epi32(x, 10))
+#define Ch8(x, y, z)							\
+	_mm256_xor_si256(_mm256_and_si256(x, _mm256_xor_si256(y, z)), z)
+#define Maj8(x, y, z)							\
+	_mm256_or_si256(_mm256_and_si256(x, _mm256_or_si256(y, z)),	\
+	    _mm256_and_si256(y, z))
+
+/* 8x8 transpose of 32-bit words; r[i] word j <-> r[j] word i. */
+SHA256_TARGET_AVX2
+static void
+transpose8(__m256i r[8])
+{
+	__m256i t0, t1, t2, t3, t4, t5, t6, t7;
+	__m256i u0, u1, u2, u3, u4, u5, u6, u7;
+
+	t0 = _mm256_unpacklo_epi32(r[0], r[1]);
+	t1 = _mm256_unpackhi_epi32(r[0], r[1]);
+	t2 = _mm256_unpacklo_epi32(r[2], r[3]);
+	t3 = _mm256_unpackhi_epi32(r[2], r[3]);
+	t4 = _mm256_unpacklo_epi32(r[4], r[5]);
+	t5 = _mm256_unpackhi_epi32(r[4], r[5]);
+	t6 = _mm256_unpacklo_epi32(r[6], r[7]);
+	t7 = _mm256_unpackhi_epi32(r[6], r[7]);
+
+	u0 = _mm256_unpacklo_epi64(t0, t2);
+	u1 = _mm256_unpackhi_epi64(t0, t2);
+	u2 = _mm256_unpacklo_epi64(t1, t3);
+	u3 = _mm256_unpackhi_epi64(t1, t3);
+	u4 = _mm256_unpacklo_epi64(t4, t6);
+	u5 = _mm256_unpackhi_epi64(t4, t6);
+	u6 = _mm256_unpacklo_epi64(t5, t7);
+	u7 = _mm256_unpackhi_epi64(t5, t7);
+
+	r[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+	r[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+	r[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+	r[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+	r[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+	r[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+	r[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+	r[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+}
+
+SHA256_TARGET_AVX2
+static void
+sha256_transform_8way_avx2(uint32_t (*state)[8],
+    const unsigned char *const *block)
+{
+	const __m256i BSWAP = _mm256_set_epi64x(
+	    0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL,
+	    0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	__m256i W[16], S[8];
+	__m256i a, b, c, d, e, f, g, h, t0, t1;
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		S[i] = _mm256_loadu_si256((const __m256i *)state[i]);
+		W[i] = _mm256_loadu_si256((const __m256i *)block[i]);
+		W[i + 8] = _mm256_loadu_si256((const __m256i *)(block[i] + 32));
+	}
+	transpose8(S);
+	transpose8(W);
+	transpose8(W + 8);
+	for (i = 0; i < 16; i++)
+		W[i] = _mm256_shuffle_epi8(W[i], BSWAP);
+
+	a = S[0]; b = S[1]; c = S[2]; d = S[3];
+	e = S[4]; f = S[5]; g = S[6]; h = S[7];
+
+	for (i = 0; i < 64; i++) {
+		if (i >= 16)
+			W[i & 15] = _mm256_add_epi32(
+			    _mm256_add_epi32(s1_8(W[(i - 2) & 15]), W[(i - 7) & 15]),
+			    _mm256_add_epi32(s0_8(W[(i - 15) & 15]), W[i & 15]));
+		t0 = _mm256_add_epi32(
+		    _mm256_add_epi32(h, S1_8(e)),
+		    _mm256_add_epi32(Ch8(e, f, g),
+		    _mm256_add_epi32(_mm256_set1_epi32((int)K256[i]), W[i & 15])));
+		t1 = _mm256_add_epi32(S0_8(a), Maj8(a, b, c));
+		h = g; g = f; f = e;
+		e = _mm256_add_epi32(d, t0);
+		d = c; c = b; b = a;
+		a = _mm256_add_epi32(t0, t1);
+	}
+
+	S[0] = _mm256_add_epi32(S[0], a);
+	S[1] = _mm256_add_epi32(S[1], b);
+	S[2] = _mm256_add_epi32(S[2], c);
+	S[3] = _mm256_add_epi32(S[3], d);
+	S[4] = _mm256_add_epi32(S[4], e);
+	S[5] = _mm256_add_epi32(S[5], f);
+	S[6] = _mm256_add_epi32(S[6], g);
+	S[7] = _mm256_add_epi32(S[7], h);
+	transpose8(S);
+	for (i = 0; i < 8; i++)
+		_mm256_storeu_si256((__m256i *)state[i], S[i]);
+}
+
+static void
+sha256_transform_mb_avx2(uint32_t (*state)[8],
+    const unsigned char *const *block, size_t n)
+{
+
+	for (; n >= 8; n -= 8, state += 8, block += 8)
+		sha256_transform_8way_avx2(state, block);
+	sha256_transform_mb_serial(state, block, n);
+}
+
+/*
+ * AVX-512 multi-buffer: sixteen lanes.  Blocks and states are staged
+ * contiguously and gathered into lane order; rotates and the three-input
+ * boolean functions map to single vprord/vpternlogd instructions.
+ */
+
+#define XOR3_16(x, y, z)	_mm512_ternarylogic_epi32(x, y, z, 0x96)
+#define S0_16(x)							\
+	XOR3_16(_mm512_ror_epi32(x, 2), _mm512_ror_epi32(x, 13),	\
+	    _mm512_ror_epi32(x, 22))
+#define S1_16(x)							\
+	XOR3_16(_mm512_ror_epi32(x, 6), _mm512_ror_epi32(x, 11),	\
+	    _mm512_ror_epi32(x, 25))
+#define s0_16(x)							\
+	XOR3_16(_mm512_ror_epi32(x, 7), _mm512_ror_epi32(x, 18),	\
+	    _mm512_srli_epi32(x, 3))
+#define s1_16(x)							\
+	XOR3_16(_mm512_ror_epi32(x, 17), _mm512_ror_epi32(x, 19),	\
+	    _mm512_srli_epi32(x, 10))
+#define Ch16(x, y, z)		_mm512_ternarylogic_epi32(x, y, z, 0xca)
+#define Maj16(x, y, z)		_mm512_ternarylogic_epi32(x, y, z, 0xe8)
+
+SHA256_TARGET_AVX512
+static void
+sha256_transform_16way_avx512(uint32_t (*state)[8],
+    const unsigned char *const *block)
+{
+	uint32_t stage[16 * 16];
+	const __m512i BSWAP = _mm512_set4_epi32(0x0c0d0e0f, 0x08090a0b,
+	    0x04050607, 0x00010203);
+	const __m512i lane16 = _mm512_mullo_epi32(
+	    _mm512_set_epi32(15, 14, 13, 12, 11, 10, 9, 8,
+	    7, 6, 5, 4, 3, 2, 1, 0), _mm512_set1_epi32(16));
+	const __m512i lane8 = _mm512_srli_epi32(lane16, 1);
+	__m512i W[16], S[8];
+	__m512i a, b, c, d, e, f, g, h, t0, t1;
+	int i;
+
+	for (i = 0; i < 16; i++)
+		_mm512_storeu_si512(&stage[i * 16], _mm512_shuffle_epi8(
+		    _mm512_loadu_si512(block[i]), BSWAP));
+	for (i = 0; i < 16; i++)
+		W[i] = _mm512_i32gather_epi32(_mm512_add_epi32(lane16,
+		    _mm512_set1_epi32(i)), stage, 4);
+
+	for (i = 0; i < 16; i++)
+		memcpy(&stage[i * 8], state[i], 32);
+	for (i = 0; i < 8; i++)
+		S[i] = _mm512_i32gather_epi32(_mm512_add_epi32(lane8,
+		    _mm512_set1_epi32(i)), stage, 4);
+
+	a = S[0]; b = S[1]; c = S[2]; d = S[3];
+	e = S[4]; f = S[5]; g = S[6]; h = S[7];
+
+	for (i = 0; i < 64; i++) {
+		if (i >= 16)
+			W[i & 15] = _mm512_add_epi32(
+			    _mm512_add_epi32(s1_16(W[(i - 2) & 15]), W[(i - 7) & 15]),
+			    _mm512_add_epi32(s0_16(W[(i - 15) & 15]), W[i & 15]));
+		t0 = _mm512_add_epi32(
+		    _mm512_add_epi32(h, S1_16(e)),
+		    _mm512_add_epi32(Ch16(e, f, g),
+		    _mm512_add_epi32(_mm512_set1_epi32((int)K256[i]), W[i & 15])));
+		t1 = _mm512_add_epi32(S0_16(a), Maj16(a, b, c));
+		h = g; g = f; f = e;
+		e = _mm512_add_epi32(d, t0);
+		d = c; c = b; b = a;
+		a = _mm512_add_epi32(t0, t1);
+	}
+
+	S[0] = _mm512_add_epi32(S[0], a);
+	S[1] = _mm512_add_epi32(S[1], b);
+	S[2] = _mm512_add_epi32(S[2], c);
+	S[3] = _mm512_add_epi32(S[3], d);
+	S[4] = _mm512_add_epi32(S[4], e);
+	S[5] = _mm512_add_epi32(S[5], f);
+	S[6] = _mm512_add_epi32(S[6], g);
+	S[7] = _mm512_add_epi32(S[7], h);
+	for (i = 0; i < 8; i++)
+		_mm512_i32scatter_epi32(stage, _mm512_add_epi32(lane8,
+		    _mm512_set1_epi32(i)), S[i], 4);
+	for (i = 0; i < 16; i++)
+		memcpy(state[i], &stage[i * 8], 32);
+}
+
+static void
+sha256_transform_mb_avx512(uint32_t (*state)[8],
+    const unsigned char *const *block, size_t n)
+{
+
+	for (; n >= 16; n -= 16, state += 16, block += 16)
+		sha256_transform_16way_avx512(state, block);
+	transform_mb_tail(state, block, n);
+}
+
+#endif /* CORE_CPU_X86 */
+
+/* Runtime dispatch */
+
+static void
+sha256_select(void)
+{
+	sha256_transform_fn impl = sha256_transform_scalar;
+	sha256_transform_mb_fn mb_impl = sha256_transform_mb_serial;
+	sha256_transform_mb_fn mb_tail = sha256_transform_mb_serial;
+	const char *name = "scalar", *mb_name = "scalar";
+#ifdef CORE_CPU_X86
+	unsigned int cpu = core_cpu_features();
+	const unsigned int shani = CPU_FEATURE_SHA | CPU_FEATURE_SSE41 |
+	    CPU_FEATURE_SSSE3;
+	const unsigned int avx512 = CPU_FEATURE_AVX512F | CPU_FEATURE_AVX512BW;
+
+	/*
+	 * One SHA-NI stream per lane outruns the 8-way AVX2 kernel, so AVX2
+	 * only takes the multi-buffer path (or its tail) without SHA-NI.
+	 */
+	if ((cpu & shani) == shani) {
+		impl = sha256_transform_shani;
+		name = mb_name = "shani";
+	} else if (cpu & CPU_FEATURE_AVX2) {
+		mb_impl = mb_tail = sha256_transform_mb_avx2;
+		mb_name = "avx2";
+	}
+	if ((cpu & avx512) == avx512) {
+		mb_impl = sha256_transform_mb_avx512;
+		mb_name = "avx512";
+	}
+#endif
+	/* Every thread resolves the same pointers, so the race is benign. */
+	transform_name = name;
+	transform_mb_name = mb_name;
+	transform_mb_tail = mb_tail;
+	transform_mb_impl = mb_impl;
+	transform_impl = impl;
+}
+
+void
+sha256_transform(uint32_t state[8], const unsigned char *blocks,
+    size_t nblocks)
+{
+
+	if (!transform_impl)
+		sha256_select();
+	transform_impl(state, blocks, nblocks);
+}
+
+void
+sha256_transform_mb(uint32_t (*state)[8], const unsigned char *const *block,
+    size_t n)
+{
+
+	if (!transform_mb_impl)
+		sha256_select();
+	transform_mb_impl(state, block, n);
+}
+
+const char *
+sha256_transform_backend(void)
+{
+
+	if (!transform_name)
+		sha256_select();
+	return transform_name;
+}
+
+const char *
+sha256_transform_mb_backend(void)
+{
+
+	if (!transform_mb_name)
+		sha256_select();
+	return transform_mb_name;
+}
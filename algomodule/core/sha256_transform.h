@@ -0,0 +1,39 @@
+#ifndef SHA256_TRANSFORM_H
+#define SHA256_TRANSFORM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Shared SHA-256 compression backend.  The implementation (SHA-NI, AVX2 or
+ * AVX-512 multi-buffer, scalar) is picked from core_cpu_features() on first
+ * call.
+ */
+
+/* Compress nblocks consecutive 64-byte blocks into state. */
+void sha256_transform(uint32_t state[8], const unsigned char *blocks,
+    size_t nblocks);
+
+/*
+ * Compress one 64-byte block into each of n independent states: state[i]
+ * absorbs block[i].  Intended for hashing many equal-length messages at once.
+ */
+void sha256_transform_mb(uint32_t (*state)[8],
+    const unsigned char *const *block, size_t n);
+
+/*
+ * Name of the selected backend: "shani" or "scalar", plus "avx2" and
+ * "avx512" for the multi-buffer path.
+ */
+const char *sha256_transform_backend(void);
+const char *sha256_transform_mb_backend(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
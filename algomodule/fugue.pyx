@@ -4,9 +4,46 @@ from libc.string cimport memcpy
 
 cdef extern from "fugue/fugue.h":
 	extern void fugue_hash(const char* input, char* output, uint32_t input_len);
+	ctypedef struct fugue_context:
+		pass
+	extern void fugue_init(fugue_context* ctx);
+	extern void fugue_update(fugue_context* ctx, const void* input, size_t len);
+	extern void fugue_digest(const fugue_context* ctx, char* output);
 
 def _fugue_hash(hash):
 	cdef char output[32];
 	cdef uint32_t input_len = len(hash);
 	fugue_hash(hash, output, input_len);
-	return output[:32];
\ No newline at end of file
+	return output[:32];
+
+cdef class FugueHash:
+	cdef fugue_context ctx
+
+	name = 'fugue'
+	digest_size = 32
+
+	def __cinit__(self):
+		fugue_init(&self.ctx);
+
+	def update(self, const unsigned char[::1] data):
+		if data.shape[0] > 0:
+			fugue_update(&self.ctx, &data[0], data.shape[0]);
+
+	def copy(self):
+		cdef FugueHash other = FugueHash.__new__(FugueHash);
+		other.ctx = self.ctx;
+		return other;
+
+	def digest(self):
+		cdef char output[32];
+		fugue_digest(&self.ctx, output);
+		return output[:32];
+
+	def hexdigest(self):
+		return self.digest().hex();
+
+def new(data=None):
+	h = FugueHash();
+	if data is not None:
+		h.update(data);
+	return h;
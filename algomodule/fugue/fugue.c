@@ -10,3 +10,19 @@ void fugue_hash(const char* input, char* output, uint32_t len)
     sph_fugue256_close(&ctx_fugue, output);
 }
 
+void fugue_init(fugue_context* ctx)
+{
+    sph_fugue256_init(ctx);
+}
+
+void fugue_update(fugue_context* ctx, const void* input, size_t len)
+{
+    sph_fugue256(ctx, input, len);
+}
+
+/* Finalises a copy of the context, so ctx may keep absorbing data. */
+void fugue_digest(const fugue_context* ctx, char* output)
+{
+    fugue_context ctx_fugue = *ctx;
+    sph_fugue256_close(&ctx_fugue, output);
+}
@@ -5,10 +5,21 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include "../sha3/sph_fugue.h"
+
 void fugue_hash(const char* input, char* output, uint32_t len);
 
+/* Incremental interface.  The context is a plain sph struct, so it can be
+   copied by assignment to fork a partially absorbed message. */
+typedef sph_fugue256_context fugue_context;
+
+void fugue_init(fugue_context* ctx);
+void fugue_update(fugue_context* ctx, const void* input, size_t len);
+void fugue_digest(const fugue_context* ctx, char* output);
+
 #ifdef __cplusplus
 }
 #endif
@@ -5,6 +5,11 @@ from libc.string cimport memcpy
 cdef extern from "groestl/groestl.h":
 	extern void groestl_hash(const char* input, char* output, uint32_t input_len);
 	extern void groestlmyriad_hash(const char* input, char* output, uint32_t input_len);
+	ctypedef struct groestl_context:
+		pass
+	extern void groestl_init(groestl_context* ctx);
+	extern void groestl_update(groestl_context* ctx, const void* input, size_t len);
+	extern void groestl_digest(const groestl_context* ctx, char* output);
 
 def _groestl_hash(hash):
 	cdef char output[32];
@@ -16,4 +21,36 @@ def _mgroestl_hash(hash):
 	cdef char output[32];
 	cdef uint32_t input_len = len(hash);
 	groestlmyriad_hash(hash, output, input_len);
-	return output[:32];
\ No newline at end of file
+	return output[:32];
+
+cdef class GroestlHash:
+	cdef groestl_context ctx
+
+	name = 'groestl'
+	digest_size = 32
+
+	def __cinit__(self):
+		groestl_init(&self.ctx);
+
+	def update(self, const unsigned char[::1] data):
+		if data.shape[0] > 0:
+			groestl_update(&self.ctx, &data[0], data.shape[0]);
+
+	def copy(self):
+		cdef GroestlHash other = GroestlHash.__new__(GroestlHash);
+		other.ctx = self.ctx;
+		return other;
+
+	def digest(self):
+		cdef char output[32];
+		groestl_digest(&self.ctx, output);
+		return output[:32];
+
+	def hexdigest(self):
+		return self.digest().hex();
+
+def new(data=None):
+	h = GroestlHash();
+	if data is not None:
+		h.update(data);
+	return h;
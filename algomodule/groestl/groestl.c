@@ -38,3 +38,27 @@ void groestlmyriad_hash(const char* input, char* output, uint32_t len)
     SHA256_Final((unsigned char*) output, &ctx_sha256);
 }
 
+void groestl_init(groestl_context* ctx)
+{
+    sph_groestl512_init(ctx);
+}
+
+void groestl_update(groestl_context* ctx, const void* input, size_t len)
+{
+    sph_groestl512(ctx, input, len);
+}
+
+/* Finalises a copy of the context, so ctx may keep absorbing data. */
+void groestl_digest(const groestl_context* ctx, char* output)
+{
+    char hash1[64];
+    char hash2[64];
+
+    groestl_context ctx_groestl = *ctx;
+    sph_groestl512_close(&ctx_groestl, &hash1);
+
+    sph_groestl512(&ctx_groestl, hash1, 64);
+    sph_groestl512_close(&ctx_groestl, &hash2);
+
+    memcpy(output, &hash2, 32);
+}
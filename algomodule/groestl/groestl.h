@@ -5,11 +5,22 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include "../sha3/sph_groestl.h"
+
 void groestl_hash(const char* input, char* output, uint32_t len);
 void groestlmyriad_hash(const char* input, char* output, uint32_t len);
 
+/* Incremental interface.  The context is a plain sph struct, so it can be
+   copied by assignment to fork a partially absorbed message. */
+typedef sph_groestl512_context groestl_context;
+
+void groestl_init(groestl_context* ctx);
+void groestl_update(groestl_context* ctx, const void* input, size_t len);
+void groestl_digest(const groestl_context* ctx, char* output);
+
 #ifdef __cplusplus
 }
 #endif
@@ -4,9 +4,46 @@ from libc.string cimport memcpy
 
 cdef extern from "keccak/keccak.h":
 	extern void keccak_hash(const char* input, char* output, uint32_t input_len);
+	ctypedef struct keccak_context:
+		pass
+	extern void keccak_init(keccak_context* ctx);
+	extern void keccak_update(keccak_context* ctx, const void* input, size_t len);
+	extern void keccak_digest(const keccak_context* ctx, char* output);
 
 def _keccak_hash(hash):
 	cdef char output[32];
 	cdef uint32_t input_len = len(hash);
 	keccak_hash(hash, output, input_len);
-	return output[:32];
\ No newline at end of file
+	return output[:32];
+
+cdef class KeccakHash:
+	cdef keccak_context ctx
+
+	name = 'keccak'
+	digest_size = 32
+
+	def __cinit__(self):
+		keccak_init(&self.ctx);
+
+	def update(self, const unsigned char[::1] data):
+		if data.shape[0] > 0:
+			keccak_update(&self.ctx, &data[0], data.shape[0]);
+
+	def copy(self):
+		cdef KeccakHash other = KeccakHash.__new__(KeccakHash);
+		other.ctx = self.ctx;
+		return other;
+
+	def digest(self):
+		cdef char output[32];
+		keccak_digest(&self.ctx, output);
+		return output[:32];
+
+	def hexdigest(self):
+		return self.digest().hex();
+
+def new(data=None):
+	h = KeccakHash();
+	if data is not None:
+		h.update(data);
+	return h;
@@ -12,3 +12,19 @@ void keccak_hash(const char* input, char* output, uint32_t size)
     sph_keccak256_close(&ctx_keccak, output);
 }
 
+void keccak_init(keccak_context* ctx)
+{
+    sph_keccak256_init(ctx);
+}
+
+void keccak_update(keccak_context* ctx, const void* input, size_t len)
+{
+    sph_keccak256(ctx, input, len);
+}
+
+/* Finalises a copy of the context, so ctx may keep absorbing data. */
+void keccak_digest(const keccak_context* ctx, char* output)
+{
+    keccak_context ctx_keccak = *ctx;
+    sph_keccak256_close(&ctx_keccak, output);
+}
@@ -5,10 +5,21 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include "../sha3/sph_keccak.h"
+
 void keccak_hash(const char* input, char* output, uint32_t size);
 
+/* Incremental interface.  The context is a plain sph struct, so it can be
+   copied by assignment to fork a partially absorbed message. */
+typedef sph_keccak256_context keccak_context;
+
+void keccak_init(keccak_context* ctx);
+void keccak_update(keccak_context* ctx, const void* input, size_t len);
+void keccak_digest(const keccak_context* ctx, char* output);
+
 #ifdef __cplusplus
 }
 #endif
@@ -2,6 +2,8 @@
 from libc.stdint cimport uint32_t, int64_t, uint8_t, uint64_t
 from libc.stdlib cimport malloc, free
 from libc.string cimport memcpy
+from cython.operator cimport dereference
+import os
 
 cdef extern from "meraki/meraki/meraki.h":
 	cdef union meraki_hash256:
@@ -16,6 +18,314 @@ cdef extern from "meraki/meraki/meraki.h":
 		uint64_t nonce
 	)
 
+	void meraki_light_verify_many "light_verify_many"(
+		const meraki_hash256* header_hashes,
+		const meraki_hash256* mix_hashes,
+		const uint64_t* nonces,
+		size_t count,
+		meraki_hash256* final_hashes
+	) nogil
+
+	cdef int MERAKI_EPOCH_LENGTH
+
+	cdef struct meraki_epoch_context:
+		int epoch_number
+		int light_cache_num_items
+		int full_dataset_num_items
+
+	cdef struct meraki_result:
+		meraki_hash256 final_hash
+		meraki_hash256 mix_hash
+
+	void meraki_set_global_epoch_cache_dir(const char* dir)
+	enum:
+		MERAKI_MEMORY_HUGE_PAGES
+		MERAKI_MEMORY_INTERLEAVE
+	void meraki_set_epoch_context_memory(int policy)
+	int meraki_get_epoch_context_backing(const meraki_epoch_context* context) nogil
+	void meraki_set_global_epoch_prebuild_lead(int lead_blocks)
+	void meraki_prebuild_global_epoch_context(int block_number) nogil
+	int meraki_get_global_prebuilt_epoch()
+
+	cdef struct meraki_global_context_stats:
+		uint64_t hits
+		uint64_t misses
+		uint64_t builds
+		uint64_t build_time_ns
+		uint64_t evictions
+		int num_contexts
+		uint64_t num_bytes
+
+	void meraki_set_global_context_limits(bint full, int max_contexts, uint64_t max_bytes) nogil
+	void meraki_get_global_context_stats(bint full, meraki_global_context_stats* stats) nogil
+	const meraki_epoch_context* meraki_get_global_epoch_context(int epoch_number) nogil
+
+	cdef struct meraki_epoch_context_full
+
+	const meraki_epoch_context_full* meraki_get_global_epoch_context_full(int epoch_number) nogil
+
+	ctypedef int (*meraki_progress_callback)(void* user_data, int items_done, int items_total) noexcept
+
+	bint meraki_prepare_dataset(
+		const meraki_epoch_context_full* context,
+		int num_threads,
+		meraki_progress_callback progress,
+		void* user_data
+	) nogil
+
+cdef extern from "meraki/support/progpow.hpp":
+	meraki_result progpow_hash "progpow::hash"(
+		const meraki_epoch_context& context,
+		int block_number,
+		const meraki_hash256& header_hash,
+		uint64_t nonce
+	) nogil
+
+	meraki_result progpow_hash_full "progpow::hash"(
+		const meraki_epoch_context_full& context,
+		int block_number,
+		const meraki_hash256& header_hash,
+		uint64_t nonce
+	) nogil
+
+	bint progpow_verify "progpow::verify"(
+		const meraki_epoch_context& context,
+		int block_number,
+		const meraki_hash256& header_hash,
+		const meraki_hash256& mix_hash,
+		uint64_t nonce,
+		const meraki_hash256& boundary
+	) nogil
+
+	cdef cppclass progpow_search_result "meraki::search_result":
+		bint solution_found
+		uint64_t nonce
+		meraki_hash256 final_hash
+		meraki_hash256 mix_hash
+
+	progpow_search_result progpow_search_light "progpow::search_light"(
+		const meraki_epoch_context& context,
+		int block_number,
+		const meraki_hash256& header_hash,
+		const meraki_hash256& boundary,
+		uint64_t start_nonce,
+		size_t iterations,
+		int num_threads
+	) nogil
+
+	progpow_search_result progpow_search_full "progpow::search"(
+		const meraki_epoch_context_full& context,
+		int block_number,
+		const meraki_hash256& header_hash,
+		const meraki_hash256& boundary,
+		uint64_t start_nonce,
+		size_t iterations,
+		int num_threads
+	) nogil
+
+	const char* progpow_mix_backend "progpow::mix_backend"()
+	bint progpow_set_mix_backend "progpow::set_mix_backend"(const char* name)
+
+def mix_backend():
+	"""The ProgPoW mix implementation hash() and verify() use: 'avx512',
+	'avx2' or 'generic'."""
+	return progpow_mix_backend().decode()
+
+def set_mix_backend(name):
+	"""Force a mix implementation by name, or go back to 'auto', the fastest
+	one this CPU supports.  All of them compute the same hashes."""
+	if not progpow_set_mix_backend(name.encode()):
+		raise ValueError("unknown or unsupported mix backend %r" % (name,))
+
+def set_cache_dir(path):
+	"""Keep epoch light caches as files in the directory path, or in memory
+	only if path is None.
+
+	The first process to need an epoch builds it and writes the file; later
+	ones map the file read-only instead of spending seconds rebuilding it.
+	Takes effect from the next epoch the shared context loads.
+	"""
+	if path is None:
+		meraki_set_global_epoch_cache_dir(NULL)
+	else:
+		path = os.fsencode(path)
+		meraki_set_global_epoch_cache_dir(path)
+
+def set_memory_policy(bint huge_pages=False, bint interleave=False):
+	"""Back the epoch contexts built from now on with huge pages (explicit
+	ones if reserved, else transparent huge pages) and/or spread their pages
+	over all NUMA nodes.  Contexts fall back to the heap if the mapping fails;
+	memory_backing() tells which one an epoch got.
+	"""
+	meraki_set_epoch_context_memory((MERAKI_MEMORY_HUGE_PAGES if huge_pages else 0)
+		| (MERAKI_MEMORY_INTERLEAVE if interleave else 0))
+
+_backings = ('heap', 'map', 'thp', 'hugetlb', 'file')
+
+def memory_backing(int block_number, bint full=False):
+	"""How the context hash(block_number, ..., full=full) uses is backed:
+	'heap', 'map' (normal pages), 'thp', 'hugetlb' or 'file' (see
+	set_cache_dir())."""
+	cdef const meraki_epoch_context* context
+	if full:
+		context = <const meraki_epoch_context*>_epoch_context_full(block_number)
+	else:
+		context = _epoch_context(block_number)
+	return _backings[meraki_get_epoch_context_backing(context)]
+
+def set_prebuild_lead(int blocks):
+	"""Start building the next epoch's context in the background once hash()
+	or verify() sees a block within blocks of the epoch boundary, so that the
+	first shares of the new epoch do not wait for it.  0 turns this off.
+	"""
+	if blocks < 0:
+		raise ValueError("blocks must not be negative")
+	meraki_set_global_epoch_prebuild_lead(blocks)
+
+def prebuilt_epoch():
+	"""The epoch whose context has been built ahead, or -1."""
+	return meraki_get_global_prebuilt_epoch()
+
+def set_cache_limits(int max_contexts, uint64_t max_bytes=0, bint full=False):
+	"""Keep at most max_contexts epoch contexts (1 to 16) and, unless max_bytes
+	is 0, about max_bytes of them, evicting the least recently used first.
+
+	full=True sets the limits of the full-dataset contexts used by
+	hash(..., full=True) instead.  Defaults: 4 light contexts, 1 full context.
+
+	A context evicted while a thread is hashing with it stays alive until
+	that thread's next hash(), verify() or search() call, which lets it go.
+	"""
+	if max_contexts < 1 or max_contexts > 16:
+		raise ValueError("max_contexts must be between 1 and 16")
+	with nogil:
+		meraki_set_global_context_limits(full, max_contexts, max_bytes)
+
+def cache_stats(bint full=False):
+	"""Counters of the shared epoch context cache: hits and misses of lookups
+	made when a thread does not already hold the epoch, builds (prebuilds
+	included) and the seconds spent in them, evictions, and the contexts
+	and bytes cached now.
+	"""
+	cdef meraki_global_context_stats stats
+	with nogil:
+		meraki_get_global_context_stats(full, &stats)
+	return {
+		'hits': stats.hits,
+		'misses': stats.misses,
+		'builds': stats.builds,
+		'build_time': stats.build_time_ns / 1e9,
+		'evictions': stats.evictions,
+		'contexts': stats.num_contexts,
+		'bytes': stats.num_bytes,
+	}
+
+# The calling thread's reference to the epoch context of block_number, built
+# on first use and shared with every other thread on the same epoch.  The
+# pointer stays valid until this thread asks for two other epochs.
+cdef const meraki_epoch_context* _epoch_context(int block_number) except NULL:
+	cdef const meraki_epoch_context* context
+	if block_number < 0:
+		raise ValueError("block_number must not be negative")
+	with nogil:
+		meraki_prebuild_global_epoch_context(block_number)
+		context = meraki_get_global_epoch_context(block_number // MERAKI_EPOCH_LENGTH)
+	if context == NULL:
+		raise MemoryError("Could not build the epoch context")
+	return context
+
+cdef const meraki_epoch_context_full* _epoch_context_full(int block_number) except NULL:
+	cdef const meraki_epoch_context_full* context
+	if block_number < 0:
+		raise ValueError("block_number must not be negative")
+	with nogil:
+		context = meraki_get_global_epoch_context_full(block_number // MERAKI_EPOCH_LENGTH)
+	if context == NULL:
+		raise MemoryError("Could not allocate the full dataset")
+	return context
+
+cdef _hash256(meraki_hash256* out, bytes value, name):
+	if len(value) != 32:
+		raise ValueError("%s must be 32 bytes" % name)
+	memcpy(out.str, <const char*>value, 32)
+
+def hash(int block_number, bytes header_hash, uint64_t nonce, bint full=False):
+	"""Run ProgPoW over header_hash and nonce at block_number.
+
+	With full=True the dataset items are read from the epoch's full dataset,
+	generated on first use or by prepare_dataset(), instead of being derived
+	from the light cache on every access.
+
+	Returns (final_hash, mix_hash).
+	"""
+	cdef meraki_hash256 c_header_hash
+	cdef meraki_result result
+	cdef const meraki_epoch_context* context
+	cdef const meraki_epoch_context_full* context_full
+	_hash256(&c_header_hash, header_hash, "header_hash")
+
+	if full:
+		context_full = _epoch_context_full(block_number)
+		with nogil:
+			result = progpow_hash_full(dereference(context_full), block_number, c_header_hash, nonce)
+	else:
+		context = _epoch_context(block_number)
+		with nogil:
+			result = progpow_hash(context[0], block_number, c_header_hash, nonce)
+
+	return bytes(result.final_hash.str[:32]), bytes(result.mix_hash.str[:32])
+
+def verify(int block_number, bytes header_hash, bytes mix_hash, uint64_t nonce, bytes boundary):
+	"""Check a share: the final hash must not exceed boundary, both read as
+	big-endian 256-bit numbers, and mix_hash must be the ProgPoW mix of
+	header_hash and nonce.  A final hash above boundary is rejected before
+	the mix is recomputed.
+	"""
+	cdef meraki_hash256 c_header_hash
+	cdef meraki_hash256 c_mix_hash
+	cdef meraki_hash256 c_boundary
+	cdef bint ok
+	_hash256(&c_header_hash, header_hash, "header_hash")
+	_hash256(&c_mix_hash, mix_hash, "mix_hash")
+	_hash256(&c_boundary, boundary, "boundary")
+	cdef const meraki_epoch_context* context = _epoch_context(block_number)
+
+	with nogil:
+		ok = progpow_verify(context[0], block_number, c_header_hash, c_mix_hash, nonce, c_boundary)
+
+	return ok
+
+def search(int block_number, bytes header_hash, bytes boundary, uint64_t start_nonce,
+		size_t count, int threads=0, bint full=False):
+	"""Look for a nonce in [start_nonce, start_nonce + count) whose final hash
+	does not exceed boundary, on threads threads (one per CPU if 0).
+
+	Returns (nonce, final_hash, mix_hash) for the lowest such nonce, or None.
+	With full=True the dataset is read as in hash(..., full=True).
+	"""
+	cdef meraki_hash256 c_header_hash
+	cdef meraki_hash256 c_boundary
+	cdef progpow_search_result result
+	cdef const meraki_epoch_context* context
+	cdef const meraki_epoch_context_full* context_full
+	_hash256(&c_header_hash, header_hash, "header_hash")
+	_hash256(&c_boundary, boundary, "boundary")
+
+	if full:
+		context_full = _epoch_context_full(block_number)
+		with nogil:
+			result = progpow_search_full(dereference(context_full), block_number, c_header_hash,
+				c_boundary, start_nonce, count, threads)
+	else:
+		context = _epoch_context(block_number)
+		with nogil:
+			result = progpow_search_light(context[0], block_number, c_header_hash,
+				c_boundary, start_nonce, count, threads)
+
+	if not result.solution_found:
+		return None
+	return result.nonce, bytes(result.final_hash.str[:32]), bytes(result.mix_hash.str[:32])
+
 # The Python wrapper function for light_verify
 def _meraki_hash(bytes header_hash, bytes mix_hash, uint64_t nonce):
 	if len(header_hash) != 32 or len(mix_hash) != 32:
@@ -48,4 +358,70 @@ def _meraki_hash(bytes header_hash, bytes mix_hash, uint64_t nonce):
 
 	finally:
 		free(c_header_hash)
-		free(c_mix_hash)
\ No newline at end of file
+		free(c_mix_hash)
+
+def light_verify_many(header_hashes, mix_hashes, nonces):
+	"""_meraki_hash() of many shares: the final hash of each header hash, mix
+	hash and nonce, in order, computed 16 shares at a time."""
+	header_hashes = list(header_hashes)
+	mix_hashes = list(mix_hashes)
+	nonces = list(nonces)
+	cdef Py_ssize_t count = len(header_hashes)
+	cdef Py_ssize_t i
+	if len(mix_hashes) != count or len(nonces) != count:
+		raise ValueError("header_hashes, mix_hashes and nonces must have the same length")
+	if count == 0:
+		return []
+	for h, m in zip(header_hashes, mix_hashes):
+		if len(h) != 32 or len(m) != 32:
+			raise ValueError("header_hash and mix_hash must be 32 bytes")
+
+	cdef bytes headers = b''.join(header_hashes)
+	cdef bytes mixes = b''.join(mix_hashes)
+	cdef const meraki_hash256* c_headers = <const meraki_hash256*><const char*>headers
+	cdef const meraki_hash256* c_mixes = <const meraki_hash256*><const char*>mixes
+	cdef uint64_t* c_nonces = <uint64_t*>malloc(count * sizeof(uint64_t))
+	cdef meraki_hash256* finals = <meraki_hash256*>malloc(count * sizeof(meraki_hash256))
+	try:
+		if not c_nonces or not finals:
+			raise MemoryError()
+		for i in range(count):
+			c_nonces[i] = nonces[i]
+		with nogil:
+			meraki_light_verify_many(c_headers, c_mixes, c_nonces, count, finals)
+		return [bytes(finals[i].str[:32]) for i in range(count)]
+	finally:
+		free(c_nonces)
+		free(finals)
+
+cdef int _dataset_progress(void* user_data, int items_done, int items_total) noexcept with gil:
+	state = <list>user_data
+	try:
+		if state[0](items_done, items_total) is False:
+			return 1
+	except BaseException as e:
+		state[1] = e
+		return 1
+	return 0
+
+def prepare_dataset(int block_number, int num_threads=0, progress=None):
+	"""Generate the whole full dataset of block_number's epoch on num_threads
+	threads (0: one per CPU) so that hash(..., full=True) never stalls on it.
+
+	progress(items_done, items_total) is called on this thread as the work
+	advances; returning False stops early.  Returns True once the dataset is
+	complete.  Other threads may keep hashing with full=True meanwhile.
+	"""
+	cdef const meraki_epoch_context_full* context = _epoch_context_full(block_number)
+	cdef list state = [progress, None]
+	cdef meraki_progress_callback callback = NULL
+	cdef bint complete
+	if progress is not None:
+		callback = _dataset_progress
+
+	with nogil:
+		complete = meraki_prepare_dataset(context, num_threads, callback, <void*>state)
+
+	if state[1] is not None:
+		raise state[1]
+	return complete
@@ -33,6 +33,20 @@ void meraki_keccakf1600(uint64_t state[25]) ;
  */
 void meraki_keccakf800(uint32_t state[25]) ;
 
+/**
+ * The Keccak-f[800] function on 16 states at once.
+ *
+ * The states are word-sliced: states[i][j] is word i of state j, so that the
+ * permutation runs on vectors of 16 words (one AVX-512 register, two AVX2
+ * ones) where the CPU has them.
+ *
+ * @param states  The 16 states of 25 32-bit words to permute.
+ */
+void meraki_keccakf800_x16(uint32_t states[25][16]);
+
+/** The implementation meraki_keccakf800_x16() uses: "avx512", "avx2" or "generic". */
+const char* meraki_keccakf800_x16_backend(void);
+
 union meraki_hash256 meraki_keccak256(const uint8_t* data, size_t size) ;
 union meraki_hash256 meraki_keccak256_32(const uint8_t data[32]) ;
 union meraki_hash512 meraki_keccak512(const uint8_t* data, size_t size) ;
@@ -0,0 +1,53 @@
+/* meraki: C/C++ implementation of Meraki, the Telestai Proof of Work algorithm.
+ * Copyright 2018-2019 Pawel Bylica.
+ * Licensed under the Apache License, Version 2.0.
+ */
+
+/* Keccak-f[800] on vectors of lanes::width states.
+ *
+ * Included by keccakf800_x16.cpp once per instruction set, each time inside a
+ * namespace of its own that defines `lanes`: the vector type vec and load,
+ * store, set1, xor_, rotl and chi(a, b, c) = a ^ (~b & c). Being compiled
+ * there, the lane operations inline into the permutation.
+ *
+ * There is no include guard on purpose. */
+
+inline void permute(uint32_t states[25][num_states], size_t offset)
+{
+    lanes::vec a[25];
+    lanes::vec b[25];
+    lanes::vec c[5];
+
+    for (int i = 0; i < 25; ++i)
+        a[i] = lanes::load(&states[i][offset]);
+
+    for (int round = 0; round < 22; ++round)
+    {
+        /* Theta. */
+        for (int x = 0; x < 5; ++x)
+            c[x] = lanes::xor_(lanes::xor_(lanes::xor_(a[x], a[x + 5]),
+                                   lanes::xor_(a[x + 10], a[x + 15])),
+                a[x + 20]);
+        for (int x = 0; x < 5; ++x)
+        {
+            const lanes::vec d = lanes::xor_(c[(x + 4) % 5], lanes::rotl(c[(x + 1) % 5], 1));
+            for (int y = 0; y < 25; y += 5)
+                a[x + y] = lanes::xor_(a[x + y], d);
+        }
+
+        /* Rho and pi. */
+        for (int i = 0; i < 25; ++i)
+            b[pi[i]] = lanes::rotl(a[i], rho[i]);
+
+        /* Chi and iota. */
+        for (int y = 0; y < 25; y += 5)
+        {
+            for (int x = 0; x < 5; ++x)
+                a[x + y] = lanes::chi(b[x + y], b[(x + 1) % 5 + y], b[(x + 2) % 5 + y]);
+        }
+        a[0] = lanes::xor_(a[0], lanes::set1(round_constants[round]));
+    }
+
+    for (int i = 0; i < 25; ++i)
+        lanes::store(&states[i][offset], a[i]);
+}
@@ -0,0 +1,152 @@
+/* meraki: C/C++ implementation of Meraki, the Telestai Proof of Work algorithm.
+ * Copyright 2018-2019 Pawel Bylica.
+ * Licensed under the Apache License, Version 2.0.
+ */
+
+/* Keccak-f[800] of 16 states at once, word-sliced so that word i of all the
+ * states is one vector: a single AVX-512 register, two AVX2 ones, or 16
+ * scalar permutations on other CPUs. */
+
+#include "algomodule/meraki/keccak/keccak.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define KECCAKF800_X86 1
+#include <immintrin.h>
+#else
+#define KECCAKF800_X86 0
+#endif
+
+namespace
+{
+constexpr size_t num_states = 16;
+
+const uint32_t round_constants[22] = {
+    0x00000001, 0x00008082, 0x0000808A, 0x80008000, 0x0000808B, 0x80000001,
+    0x80008081, 0x00008009, 0x0000008A, 0x00000088, 0x80008009, 0x8000000A,
+    0x8000808B, 0x0000008B, 0x00008089, 0x00008003, 0x00008002, 0x00000080,
+    0x0000800A, 0x8000000A, 0x80008081, 0x00008080,
+};
+
+/* rho rotation of word x + 5y, and the word pi moves it to. */
+const int rho[25] = {
+    0, 1, 30, 28, 27, 4, 12, 6, 23, 20, 3, 10, 11, 25, 7, 9, 13, 15, 21, 8, 18, 2, 29, 24, 14,
+};
+const int pi[25] = {
+    0, 10, 20, 5, 15, 16, 1, 11, 21, 6, 7, 17, 2, 12, 22, 23, 8, 18, 3, 13, 14, 24, 9, 19, 4,
+};
+
+#if KECCAKF800_X86
+#pragma GCC push_options
+#pragma GCC target("avx2")
+namespace avx2_kernel
+{
+struct lanes
+{
+    using vec = __m256i;
+    static constexpr size_t width = 8;
+
+    static vec load(const uint32_t* p) { return _mm256_loadu_si256(reinterpret_cast<const vec*>(p)); }
+    static void store(uint32_t* p, vec v) { _mm256_storeu_si256(reinterpret_cast<vec*>(p), v); }
+    static vec set1(uint32_t x) { return _mm256_set1_epi32(static_cast<int>(x)); }
+    static vec xor_(vec a, vec b) { return _mm256_xor_si256(a, b); }
+    static vec rotl(vec a, int n)
+    {
+        return n == 0 ? a : _mm256_or_si256(_mm256_slli_epi32(a, n), _mm256_srli_epi32(a, 32 - n));
+    }
+    static vec chi(vec a, vec b, vec c) { return _mm256_xor_si256(a, _mm256_andnot_si256(b, c)); }
+};
+
+#include "algomodule/meraki/keccak/keccakf800_lanes.hpp"
+}  // namespace avx2_kernel
+
+void keccakf800_x16_avx2(uint32_t states[25][num_states])
+{
+    avx2_kernel::permute(states, 0);
+    avx2_kernel::permute(states, 8);
+}
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+#pragma GCC diagnostic push
+/* GCC 12 takes the _mm512_undefined_epi32() inside the intrinsics for an
+ * uninitialized use. */
+#pragma GCC diagnostic ignored "-Wuninitialized"
+namespace avx512_kernel
+{
+struct lanes
+{
+    using vec = __m512i;
+    static constexpr size_t width = 16;
+
+    static vec load(const uint32_t* p) { return _mm512_loadu_si512(p); }
+    static void store(uint32_t* p, vec v) { _mm512_storeu_si512(p, v); }
+    static vec set1(uint32_t x) { return _mm512_set1_epi32(static_cast<int>(x)); }
+    static vec xor_(vec a, vec b) { return _mm512_xor_si512(a, b); }
+    static vec rotl(vec a, int n) { return _mm512_rolv_epi32(a, _mm512_set1_epi32(n)); }
+    static vec chi(vec a, vec b, vec c) { return _mm512_ternarylogic_epi32(a, b, c, 0xd2); }
+};
+
+#include "algomodule/meraki/keccak/keccakf800_lanes.hpp"
+}  // namespace avx512_kernel
+
+void keccakf800_x16_avx512(uint32_t states[25][num_states])
+{
+    avx512_kernel::permute(states, 0);
+}
+#pragma GCC diagnostic pop
+#pragma GCC pop_options
+#endif
+
+void keccakf800_x16_generic(uint32_t states[25][num_states])
+{
+    for (size_t j = 0; j < num_states; ++j)
+    {
+        uint32_t state[25];
+        for (int i = 0; i < 25; ++i)
+            state[i] = states[i][j];
+        meraki_keccakf800(state);
+        for (int i = 0; i < 25; ++i)
+            states[i][j] = state[i];
+    }
+}
+
+using keccakf800_x16_fn = void (*)(uint32_t[25][num_states]);
+
+struct keccakf800_x16_impl
+{
+    keccakf800_x16_fn fn;
+    const char* name;
+};
+
+keccakf800_x16_impl select_impl()
+{
+#if KECCAKF800_X86
+    __builtin_cpu_init();  // Runs from a static initializer.
+    if (__builtin_cpu_supports("avx512f"))
+        return {keccakf800_x16_avx512, "avx512"};
+    if (__builtin_cpu_supports("avx2"))
+        return {keccakf800_x16_avx2, "avx2"};
+#endif
+    return {keccakf800_x16_generic, "generic"};
+}
+
+const keccakf800_x16_impl impl = select_impl();
+}  // namespace
+
+extern "C" {
+
+void meraki_keccakf800_x16(uint32_t states[25][16])
+{
+    impl.fn(states);
+}
+
+const char* meraki_keccakf800_x16_backend(void)
+{
+    return impl.name;
+}
+
+}  // extern "C"
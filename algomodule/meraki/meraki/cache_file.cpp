@@ -0,0 +1,278 @@
+// meraki: C/C++ implementation of Meraki, the Telestai Proof of Work algorithm.
+// Copyright 2018-2019 Pawel Bylica.
+// Licensed under the Apache License, Version 2.0.
+
+/// @file
+/// Light cache files: the light cache and L1 cache of an epoch stored on disk
+/// once and mapped read-only by every later process.
+///
+/// File layout, in native byte order:
+///
+///     light_cache_file_header, zero-padded to payload_offset (one page)
+///     light cache (light_cache_num_items * 64 bytes)
+///     L1 cache (progpow::l1_cache_size bytes)
+///
+/// The checksum covers the light cache and the L1 cache. A file whose magic,
+/// version, epoch parameters, size or checksum do not match is ignored and
+/// rewritten.
+
+#include "algomodule/meraki/meraki/meraki-internal.hpp"
+
+#include "algomodule/meraki/support/progpow.hpp"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace meraki;
+
+namespace
+{
+constexpr uint64_t light_cache_file_magic = 0x434c494b4152454dull;  // "MERAKILC"
+constexpr uint32_t light_cache_file_version = 1;
+constexpr size_t payload_offset = 4096;
+
+struct light_cache_file_header
+{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t payload_offset;
+    int32_t epoch_number;
+    int32_t light_cache_num_items;
+    int32_t full_dataset_num_items;
+    uint32_t l1_cache_size;
+    hash256 seed;
+    uint64_t checksum;
+};
+
+static_assert(sizeof(light_cache_file_header) <= payload_offset, "header too big");
+
+/// An epoch context whose caches live in a mapping of a light cache file.
+///
+/// Allocated on the heap on its own: unlike in a built context, the light
+/// cache does not follow it in memory, which is how
+/// meraki_destroy_epoch_context() tells the two apart.
+struct mapped_epoch_context : epoch_context_full
+{
+    void* const map;
+    const size_t map_size;
+
+    mapped_epoch_context(int epoch, int light_num_items, const hash512* light,
+        const uint32_t* l1, int dataset_num_items, void* m, size_t size)
+      : epoch_context_full{epoch, light_num_items, light, l1, dataset_num_items, nullptr},
+        map{m},
+        map_size{size}
+    {}
+};
+
+#ifndef _WIN32
+inline uint64_t rotl64(uint64_t x, int n)
+{
+    return (x << n) | (x >> (64 - n));
+}
+
+/// Four-lane multiply-rotate checksum (the xxHash64 round), fed in 32-byte
+/// multiples. Catches torn and truncated writes and bit rot at memory speed;
+/// it is not a MAC.
+class checksum
+{
+public:
+    void update(const void* data, size_t size)
+    {
+        const auto* words = static_cast<const uint64_t*>(data);
+        for (size_t i = 0; i < size / sizeof(uint64_t); i += 4)
+        {
+            for (size_t j = 0; j < 4; ++j)
+                acc[j] = rotl64(acc[j] + words[i + j] * p2, 31) * p1;
+        }
+        num_bytes += size;
+    }
+
+    uint64_t digest() const
+    {
+        uint64_t h = num_bytes;
+        for (size_t j = 0; j < 4; ++j)
+            h = rotl64(h ^ acc[j], 27) * p1 + p2;
+        return h;
+    }
+
+private:
+    static constexpr uint64_t p1 = 0x9e3779b185ebca87ull;
+    static constexpr uint64_t p2 = 0xc2b2ae3d27d4eb4full;
+
+    uint64_t acc[4] = {p1 + p2, p2, 0, 0 - p1};
+    uint64_t num_bytes = 0;
+};
+
+uint64_t payload_checksum(const void* light_cache, size_t light_cache_size, const void* l1_cache)
+{
+    checksum c;
+    c.update(light_cache, light_cache_size);
+    c.update(l1_cache, progpow::l1_cache_size);
+    return c.digest();
+}
+
+light_cache_file_header make_header(int epoch_number)
+{
+    light_cache_file_header header;
+    std::memset(&header, 0, sizeof(header));
+    header.magic = light_cache_file_magic;
+    header.version = light_cache_file_version;
+    header.payload_offset = payload_offset;
+    header.epoch_number = epoch_number;
+    header.light_cache_num_items = calculate_light_cache_num_items(epoch_number);
+    header.full_dataset_num_items = calculate_full_dataset_num_items(epoch_number);
+    header.l1_cache_size = progpow::l1_cache_size;
+    header.seed = calculate_epoch_seed(epoch_number);
+    return header;
+}
+
+bool make_path(char* path, size_t size, const char* dir, int epoch_number)
+{
+    const int n = std::snprintf(path, size, "%s/meraki-epoch-%d.cache", dir, epoch_number);
+    return n > 0 && static_cast<size_t>(n) < size;
+}
+
+bool write_all(int fd, const void* data, size_t size)
+{
+    const char* p = static_cast<const char*>(data);
+    while (size > 0)
+    {
+        const ssize_t n = ::write(fd, p, size);
+        if (n < 0 && errno != EINTR)
+            return false;
+        if (n < 0)
+            continue;
+        p += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+/// Maps the file at path and checks it against expected (whose checksum is
+/// ignored). Returns null if the file is missing, stale or corrupt.
+epoch_context* map_file(const char* path, const light_cache_file_header& expected)
+{
+    const int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+
+    const size_t light_cache_size = get_light_cache_size(expected.light_cache_num_items);
+    const size_t file_size = payload_offset + light_cache_size + progpow::l1_cache_size;
+
+    struct stat st;
+    void* map = MAP_FAILED;
+    if (::fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) == file_size)
+        map = ::mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+        return nullptr;
+
+    const char* const data = static_cast<const char*>(map);
+    const auto& header = *reinterpret_cast<const light_cache_file_header*>(data);
+    const char* const payload = data + payload_offset;
+
+    void* block = nullptr;
+    if (std::memcmp(&header, &expected, offsetof(light_cache_file_header, checksum)) == 0 &&
+        header.checksum ==
+            payload_checksum(payload, light_cache_size, payload + light_cache_size))
+        block = std::calloc(1, sizeof(mapped_epoch_context));
+
+    if (!block)
+    {
+        ::munmap(map, file_size);
+        return nullptr;
+    }
+
+    return new (block) mapped_epoch_context{
+        expected.epoch_number,
+        expected.light_cache_num_items,
+        reinterpret_cast<const hash512*>(payload),
+        reinterpret_cast<const uint32_t*>(payload + light_cache_size),
+        expected.full_dataset_num_items,
+        map,
+        file_size,
+    };
+}
+
+/// Writes context to a temporary file next to path and renames it into place,
+/// so readers only ever see a complete file. Failures are not fatal: the
+/// caller keeps the context it built.
+void write_file(const char* path, const epoch_context& context, light_cache_file_header header)
+{
+    char tmp_path[4096];
+    const int n = std::snprintf(tmp_path, sizeof(tmp_path), "%s.%ld.tmp", path,
+        static_cast<long>(::getpid()));
+    if (n <= 0 || static_cast<size_t>(n) >= sizeof(tmp_path))
+        return;
+
+    const int fd = ::open(tmp_path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0)
+        return;
+
+    const size_t light_cache_size = get_light_cache_size(context.light_cache_num_items);
+    header.checksum = payload_checksum(context.light_cache, light_cache_size, context.l1_cache);
+
+    char page[payload_offset] = {};
+    std::memcpy(page, &header, sizeof(header));
+    bool ok = write_all(fd, page, sizeof(page)) &&
+              write_all(fd, context.light_cache, light_cache_size) &&
+              write_all(fd, context.l1_cache, progpow::l1_cache_size) && ::fsync(fd) == 0;
+
+    if (::close(fd) != 0)
+        ok = false;
+    if (!ok || ::rename(tmp_path, path) != 0)
+        ::unlink(tmp_path);
+}
+#endif
+}  // namespace
+
+namespace meraki
+{
+bool release_mapped_epoch_context(epoch_context* context)
+{
+    if (!is_mapped_epoch_context(*context))
+        return false;
+
+#ifndef _WIN32
+    auto* mapped = static_cast<mapped_epoch_context*>(context);
+    ::munmap(mapped->map, mapped->map_size);
+    mapped->~mapped_epoch_context();
+    std::free(mapped);
+#endif
+    return true;
+}
+}  // namespace meraki
+
+extern "C" {
+
+epoch_context* meraki_load_epoch_context(const char* dir, int epoch_number)
+{
+#ifndef _WIN32
+    char path[4000];
+    if (dir && make_path(path, sizeof(path), dir, epoch_number))
+    {
+        const light_cache_file_header header = make_header(epoch_number);
+        if (epoch_context* context = map_file(path, header))
+            return context;
+
+        epoch_context* context = meraki_create_epoch_context(epoch_number);
+        if (context)
+            write_file(path, *context, header);
+        return context;
+    }
+#endif
+    return meraki_create_epoch_context(epoch_number);
+}
+
+}  // extern "C"
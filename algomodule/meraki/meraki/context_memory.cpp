@@ -0,0 +1,239 @@
+// meraki: C/C++ implementation of Meraki, the Telestai Proof of Work algorithm.
+// Copyright 2018-2019 Pawel Bylica.
+// Licensed under the Apache License, Version 2.0.
+
+/// @file
+/// Memory of built epoch contexts: heap blocks by default, or anonymous
+/// mappings on huge pages and/or interleaved over the NUMA nodes as set by
+/// meraki_set_epoch_context_memory().
+///
+/// Every block starts with a context_memory_header that records how it was
+/// obtained, so that it is freed the same way whatever the policy is by then.
+
+#include "algomodule/meraki/meraki/meraki-internal.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+struct context_memory_header
+{
+    size_t map_size;  // 0 for a heap block.
+    int backing;
+};
+
+/// Blocks are 64-byte aligned, and so is the memory after the header, as the
+/// context expects.
+constexpr size_t block_alignment = 64;
+constexpr size_t header_size = 64;
+static_assert(sizeof(context_memory_header) <= header_size, "header too big");
+static_assert(header_size % block_alignment == 0, "header breaks alignment");
+
+std::atomic<int> memory_policy{MERAKI_MEMORY_DEFAULT};
+
+/// Allocates a zeroed, block_alignment-aligned heap block.
+void* allocate_heap_block(size_t size)
+{
+    void* block = nullptr;
+#ifdef _WIN32
+    block = ::_aligned_malloc(size, block_alignment);
+#else
+    if (::posix_memalign(&block, block_alignment, size) != 0)
+        block = nullptr;
+#endif
+    if (block)
+        std::memset(block, 0, size);
+    return block;
+}
+
+void free_heap_block(void* block)
+{
+#ifdef _WIN32
+    ::_aligned_free(block);
+#else
+    std::free(block);
+#endif
+}
+
+#if defined(__linux__) && defined(MAP_ANONYMOUS)
+constexpr size_t page_size = 4096;
+constexpr size_t huge_page_size = size_t{2} << 20;
+constexpr size_t gigantic_page_size = size_t{1} << 30;
+
+inline size_t round_up(size_t size, size_t alignment)
+{
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+void* map_anonymous(size_t size, int flags)
+{
+    void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+    return p == MAP_FAILED ? nullptr : p;
+}
+
+/// Sets the NUMA policy of [p, p + size) to interleave its pages over the
+/// online nodes. Must be called before the pages are first touched. Does
+/// nothing on a single node.
+void interleave_nodes(void* p, size_t size)
+{
+#ifdef SYS_mbind
+    static constexpr int mpol_interleave = 3;
+    static constexpr int max_nodes = 1024;
+    static constexpr int bits_per_word = 8 * sizeof(unsigned long);
+
+    FILE* f = std::fopen("/sys/devices/system/node/online", "r");
+    if (!f)
+        return;
+
+    // A list of ranges such as "0-3,8".
+    unsigned long mask[max_nodes / bits_per_word] = {};
+    int num_nodes = 0;
+    int first = 0;
+    int last = 0;
+    while (std::fscanf(f, "%d", &first) == 1)
+    {
+        last = first;
+        int c = std::fgetc(f);
+        if (c == '-')
+        {
+            if (std::fscanf(f, "%d", &last) != 1)
+                break;
+            c = std::fgetc(f);
+        }
+        for (int node = first; node <= last && node >= 0 && node < max_nodes; ++node, ++num_nodes)
+            mask[node / bits_per_word] |= 1ul << (node % bits_per_word);
+        if (c != ',')
+            break;
+    }
+    std::fclose(f);
+
+    if (num_nodes > 1)
+        ::syscall(SYS_mbind, p, size, mpol_interleave, mask, max_nodes + 1, 0);
+#else
+    (void)p;
+    (void)size;
+#endif
+}
+
+/// Maps size bytes under policy, or returns null to fall back to the heap.
+void* map_context_memory(size_t size, int policy, size_t& map_size, int& backing)
+{
+    void* p = nullptr;
+    if (policy & MERAKI_MEMORY_HUGE_PAGES)
+    {
+        // Explicit huge pages exist only if the administrator reserved them.
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+        if (size >= gigantic_page_size)
+        {
+            map_size = round_up(size, gigantic_page_size);
+            p = map_anonymous(map_size, MAP_HUGETLB | (30 << MAP_HUGE_SHIFT));
+        }
+#endif
+#ifdef MAP_HUGETLB
+        if (!p)
+        {
+            map_size = round_up(size, huge_page_size);
+            p = map_anonymous(map_size, MAP_HUGETLB);
+        }
+#endif
+        backing = MERAKI_BACKING_HUGETLB;
+        if (!p)
+        {
+            map_size = round_up(size, huge_page_size);
+            p = map_anonymous(map_size, 0);
+#ifdef MADV_HUGEPAGE
+            if (p)
+                ::madvise(p, map_size, MADV_HUGEPAGE);
+#endif
+            backing = MERAKI_BACKING_THP;
+        }
+    }
+    else if (policy & MERAKI_MEMORY_INTERLEAVE)
+    {
+        map_size = round_up(size, page_size);
+        p = map_anonymous(map_size, 0);
+        backing = MERAKI_BACKING_MAP;
+    }
+
+    if (p && (policy & MERAKI_MEMORY_INTERLEAVE))
+        interleave_nodes(p, map_size);
+    return p;
+}
+#endif
+
+inline context_memory_header& get_header(const void* memory)
+{
+    return *reinterpret_cast<context_memory_header*>(
+        static_cast<char*>(const_cast<void*>(memory)) - header_size);
+}
+}  // namespace
+
+namespace meraki
+{
+void* allocate_context_memory(size_t size)
+{
+    size += header_size;
+    size_t map_size = 0;
+    int backing = MERAKI_BACKING_HEAP;
+    void* block = nullptr;
+
+#if defined(__linux__) && defined(MAP_ANONYMOUS)
+    const int policy = memory_policy.load(std::memory_order_relaxed);
+    if (policy != MERAKI_MEMORY_DEFAULT)
+        block = map_context_memory(size, policy, map_size, backing);
+#endif
+    if (!block)
+    {
+        map_size = 0;
+        backing = MERAKI_BACKING_HEAP;
+        block = allocate_heap_block(size);  // Mappings come zeroed already.
+        if (!block)
+            return nullptr;
+    }
+
+    void* const memory = static_cast<char*>(block) + header_size;
+    get_header(memory) = {map_size, backing};
+    return memory;
+}
+
+void free_context_memory(void* memory)
+{
+    const context_memory_header header = get_header(memory);
+    void* const block = static_cast<char*>(memory) - header_size;
+#if defined(__linux__) && defined(MAP_ANONYMOUS)
+    if (header.map_size != 0)
+    {
+        ::munmap(block, header.map_size);
+        return;
+    }
+#endif
+    free_heap_block(block);
+}
+
+int get_context_memory_backing(const void* memory)
+{
+    return get_header(memory).backing;
+}
+}  // namespace meraki
+
+extern "C" {
+
+void meraki_set_epoch_context_memory(int policy)
+{
+    memory_policy.store(policy, std::memory_order_relaxed);
+}
+
+}  // extern "C"
@@ -4,96 +4,467 @@
 
 #include "algomodule/meraki/meraki/meraki-internal.hpp"
 
+#include "algomodule/meraki/support/attributes.h"
+#include "algomodule/meraki/support/progpow.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <memory>
 #include <mutex>
-
-#if !defined(__has_cpp_attribute)
-#define __has_cpp_attribute(x) 0
-#endif
-
-#if __has_cpp_attribute(gnu::noinline)
-#define ATTRIBUTE_NOINLINE [[gnu::noinline]]
-#elif _MSC_VER
-#define ATTRIBUTE_NOINLINE __declspec(noinline)
-#else
-#define ATTRIBUTE_NOINLINE
-#endif
+#include <string>
+#include <system_error>
+#include <thread>
 
 using namespace meraki;
 
 namespace
 {
-std::mutex shared_context_mutex;
-std::shared_ptr<epoch_context> shared_context;
-thread_local std::shared_ptr<epoch_context> thread_local_context;
+/// A bounded least-recently-used cache of shared epoch contexts.
+///
+/// Lookups scan the slots with std::atomic_load() and never take the build
+/// mutex; only a miss does, to build the context once however many threads
+/// ask for it. A prebuild builds without holding it, so misses on other
+/// epochs do not wait for it. Evicting a context drops the cache's reference
+/// and bumps the cache's generation; a thread holding the context drops its
+/// own reference on its next lookup, which sees the new generation.
+template <typename Context>
+class context_cache
+{
+public:
+    using context_ptr = std::shared_ptr<Context>;
+    using build_fn = context_ptr (*)(int epoch_number);
+    using size_fn = uint64_t (*)(int epoch_number);
+
+    static constexpr int max_slots = 16;
+
+    context_cache(build_fn build, size_fn size, int contexts)
+      : build_context{build}, context_size{size}, max_contexts{contexts}
+    {}
+
+    /// The cached context of epoch_number, or null. Never blocks.
+    context_ptr find(int epoch_number)
+    {
+        for (auto& slot : slots)
+        {
+            auto context = std::atomic_load(&slot.context);
+            if (context && context->epoch_number == epoch_number)
+            {
+                slot.last_used.store(
+                    clock.fetch_add(1, std::memory_order_relaxed), std::memory_order_relaxed);
+                return context;
+            }
+        }
+        return {};
+    }
+
+    /// Changes whenever a context is evicted.
+    uint64_t generation() const { return evictions_generation.load(std::memory_order_acquire); }
+
+    /// Whether context is still one of the cached contexts.
+    bool holds(const Context* context) const
+    {
+        for (auto& slot : slots)
+        {
+            if (std::atomic_load(&slot.context).get() == context)
+                return true;
+        }
+        return false;
+    }
+
+    /// The context of epoch_number, built on a miss. Null on out-of-memory.
+    context_ptr get(int epoch_number)
+    {
+        if (auto context = find(epoch_number))
+        {
+            hits.fetch_add(1, std::memory_order_relaxed);
+            return context;
+        }
+
+        misses.fetch_add(1, std::memory_order_relaxed);
+        std::unique_lock<std::mutex> lock{build_mutex};
+        // Rather than build it a second time, wait for a prebuild of it.
+        prebuilt.wait(lock, [&] { return prebuilding != epoch_number; });
+        if (auto context = find(epoch_number))  // Built while we waited.
+            return context;
+        return build_locked(epoch_number);
+    }
+
+    /// Builds epoch_number into the cache unless it is there already.
+    /// Only get() of the same epoch waits for it.
+    void prebuild(int epoch_number)
+    {
+        std::unique_lock<std::mutex> lock{build_mutex};
+        if (prebuilding >= 0 || find(epoch_number))
+            return;
+        prebuilding = epoch_number;
+        lock.unlock();
 
-std::mutex shared_context_full_mutex;
-std::shared_ptr<epoch_context_full> shared_context_full;
-thread_local std::shared_ptr<epoch_context_full> thread_local_context_full;
+        const auto start = std::chrono::steady_clock::now();
+        context_ptr context = build_context(epoch_number);
+        const auto elapsed = std::chrono::steady_clock::now() - start;
 
-/// Update thread local epoch context.
+        lock.lock();
+        add_built_locked(epoch_number, std::move(context), elapsed);
+        prebuilding = -1;
+        lock.unlock();
+        prebuilt.notify_all();
+    }
+
+    void set_limits(int contexts, uint64_t bytes)
+    {
+        std::lock_guard<std::mutex> lock{build_mutex};
+        max_contexts = std::max(1, std::min(contexts, int{max_slots}));
+        max_bytes = bytes;
+        make_room(0);
+    }
+
+    void get_stats(meraki_global_context_stats* stats)
+    {
+        std::lock_guard<std::mutex> lock{build_mutex};
+        stats->hits = hits.load(std::memory_order_relaxed);
+        stats->misses = misses.load(std::memory_order_relaxed);
+        stats->builds = builds;
+        stats->build_time_ns = build_time_ns;
+        stats->evictions = evictions;
+        stats->num_contexts = 0;
+        stats->num_bytes = 0;
+        for (auto& slot : slots)
+        {
+            if (std::atomic_load(&slot.context))
+            {
+                ++stats->num_contexts;
+                stats->num_bytes += slot.size;
+            }
+        }
+    }
+
+private:
+    /// Held while a miss builds, and around the bookkeeping of a prebuild.
+    std::mutex build_mutex;
+
+    struct slot_type
+    {
+        context_ptr context;
+        uint64_t size = 0;
+        std::atomic<uint64_t> last_used{0};
+    };
+
+    context_ptr build_locked(int epoch_number)
+    {
+        make_room(context_size(epoch_number));
+
+        const auto start = std::chrono::steady_clock::now();
+        context_ptr context = build_context(epoch_number);
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        return add_built_locked(epoch_number, std::move(context), elapsed);
+    }
+
+    /// Records a build and stores its context in a free slot.
+    context_ptr add_built_locked(
+        int epoch_number, context_ptr context, std::chrono::steady_clock::duration elapsed)
+    {
+        build_time_ns += static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+        ++builds;
+        if (!context)
+            return context;
+
+        const uint64_t size = context_size(epoch_number);
+        make_room(size);
+
+        for (auto& slot : slots)
+        {
+            if (!std::atomic_load(&slot.context))
+            {
+                slot.size = size;
+                slot.last_used.store(
+                    clock.fetch_add(1, std::memory_order_relaxed), std::memory_order_relaxed);
+                std::atomic_store(&slot.context, context);
+                break;
+            }
+        }
+        return context;
+    }
+
+    /// Evicts least recently used contexts until one of extra_size bytes fits
+    /// the limits (extra_size 0: until the cache itself does).
+    void make_room(uint64_t extra_size)
+    {
+        const int extra = extra_size != 0 ? 1 : 0;
+        for (;;)
+        {
+            int count = 0;
+            uint64_t bytes = extra_size;
+            slot_type* oldest = nullptr;
+            for (auto& slot : slots)
+            {
+                if (!std::atomic_load(&slot.context))
+                    continue;
+                ++count;
+                bytes += slot.size;
+                if (!oldest || slot.last_used.load(std::memory_order_relaxed) <
+                                   oldest->last_used.load(std::memory_order_relaxed))
+                    oldest = &slot;
+            }
+
+            const bool over_bytes = max_bytes != 0 && bytes > max_bytes;
+            if (!oldest || (count + extra <= max_contexts && !over_bytes))
+                return;
+
+            std::atomic_store(&oldest->context, context_ptr{});
+            evictions_generation.fetch_add(1, std::memory_order_release);
+            ++evictions;
+        }
+    }
+
+    const build_fn build_context;
+    const size_fn context_size;
+    slot_type slots[max_slots];
+    std::atomic<uint64_t> clock{1};
+
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> evictions_generation{0};
+
+    // Guarded by build_mutex.
+    std::condition_variable prebuilt;  // Notified when a prebuild ends.
+    int prebuilding = -1;              // The epoch being prebuilt, if any.
+    int max_contexts;
+    uint64_t max_bytes = 0;
+    uint64_t builds = 0;
+    uint64_t build_time_ns = 0;
+    uint64_t evictions = 0;
+};
+
+std::mutex shared_context_cache_dir_mutex;
+std::string shared_context_cache_dir;  // Guarded by shared_context_cache_dir_mutex.
+
+/// Builds a context, or loads it from the light cache file.
+std::shared_ptr<epoch_context> make_context(int epoch_number)
+{
+    std::string dir;
+    {
+        std::lock_guard<std::mutex> lock{shared_context_cache_dir_mutex};
+        dir = shared_context_cache_dir;
+    }
+    if (dir.empty())
+        return create_epoch_context(epoch_number);
+    epoch_context* context = meraki_load_epoch_context(dir.c_str(), epoch_number);
+    if (!context)
+        return {};
+    return {context, meraki_destroy_epoch_context};
+}
+
+std::shared_ptr<epoch_context_full> make_context_full(int epoch_number)
+{
+    return create_epoch_context_full(epoch_number);
+}
+
+uint64_t light_context_size(int epoch_number)
+{
+    return sizeof(hash512) +
+           get_light_cache_size(calculate_light_cache_num_items(epoch_number)) +
+           progpow::l1_cache_size;
+}
+
+uint64_t full_context_size(int epoch_number)
+{
+    return sizeof(hash512) +
+           get_light_cache_size(calculate_light_cache_num_items(epoch_number)) +
+           get_full_dataset_size(calculate_full_dataset_num_items(epoch_number));
+}
+
+context_cache<epoch_context> shared_cache{make_context, light_context_size, 4};
+context_cache<epoch_context_full> shared_cache_full{make_context_full, full_context_size, 1};
+
+/// Each thread keeps its two most recently used contexts, so that a thread
+/// alternating between two epochs never leaves its fast path, as long as the
+/// cache holds them: generation is the cache's when they were last checked.
+template <typename Context>
+struct local_contexts
+{
+    std::shared_ptr<Context> contexts[2];
+    uint64_t generation = 0;
+};
+
+thread_local local_contexts<epoch_context> thread_local_contexts;
+thread_local local_contexts<epoch_context_full> thread_local_contexts_full;
+
+std::atomic<int> prebuild_lead{0};
+std::atomic<int> prebuild_epoch{-1};  // The last epoch handed to the prebuild thread.
+
+/// The background thread prebuilding epochs into shared_cache, started on
+/// the first request. A request only records the epoch to build, so the
+/// hashing thread making it never waits; a newer request replaces one not
+/// started yet. Stopped and joined at exit so that it never outlives the cache.
+class prebuild_thread
+{
+public:
+    void request(int epoch_number)
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        pending = epoch_number;
+        if (!thread.joinable())
+        {
+            try
+            {
+                thread = std::thread{[this] { run(); }};
+            }
+            catch (const std::system_error&)
+            {
+                // No thread: the epoch is built on first use as before.
+                pending = -1;
+                return;
+            }
+        }
+        wake.notify_one();
+    }
+
+    ~prebuild_thread()
+    {
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            stop = true;
+        }
+        wake.notify_one();
+        if (thread.joinable())
+            thread.join();
+    }
+
+private:
+    void run()
+    {
+        std::unique_lock<std::mutex> lock{mutex};
+        for (;;)
+        {
+            wake.wait(lock, [this] { return stop || pending >= 0; });
+            if (stop)
+                return;
+            const int epoch_number = pending;
+            pending = -1;
+            lock.unlock();
+            shared_cache.prebuild(epoch_number);
+            lock.lock();
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::thread thread;
+
+    // Guarded by mutex.
+    int pending = -1;
+    bool stop = false;
+} prebuilder;
+
+/// Drops the thread's contexts the cache has evicted, then moves the context
+/// of epoch_number to the front of its pair, fetching it from the shared
+/// cache if the thread has neither.
 ///
 /// This function is on the slow path. It's separated to allow inlining the fast
 /// path.
-///
-/// @todo: Redesign to guarantee deallocation before new allocation.
-ATTRIBUTE_NOINLINE
-void update_local_context(int epoch_number)
+template <typename Context>
+ATTRIBUTE_NOINLINE void update_local_context(
+    local_contexts<Context>& local_pair, context_cache<Context>& cache, int epoch_number)
 {
-    // Release the shared pointer of the obsoleted context.
-    thread_local_context.reset();
+    auto& local = local_pair.contexts;
+    const uint64_t generation = cache.generation();
+    if (local_pair.generation != generation)
+    {
+        local_pair.generation = generation;
+        for (auto& context : local)
+        {
+            if (context && !cache.holds(context.get()))
+                context.reset();
+        }
+    }
 
-    // Local context invalid, check the shared context.
-    std::lock_guard<std::mutex> lock{shared_context_mutex};
+    if (local[0] && local[0]->epoch_number == epoch_number)
+        return;
 
-    if (!shared_context || shared_context->epoch_number != epoch_number)
+    if (local[1] && local[1]->epoch_number == epoch_number)
     {
-        // Release the shared pointer of the obsoleted context.
-        shared_context.reset();
-
-        // Build new context.
-        shared_context = create_epoch_context(epoch_number);
+        std::swap(local[0], local[1]);
+        return;
     }
 
-    thread_local_context = shared_context;
+    // Release the shared pointer of the least recently used context.
+    local[1] = std::move(local[0]);
+    local[0] = cache.get(epoch_number);
 }
 
-ATTRIBUTE_NOINLINE
-void update_local_context_full(int epoch_number)
+}  // namespace
+
+void meraki_set_global_epoch_prebuild_lead(int lead_blocks)
 {
-    // Release the shared pointer of the obsoleted context.
-    thread_local_context_full.reset();
+    prebuild_lead.store(lead_blocks, std::memory_order_relaxed);
+}
 
-    // Local context invalid, check the shared context.
-    std::lock_guard<std::mutex> lock{shared_context_full_mutex};
+void meraki_prebuild_global_epoch_context(int block_number)
+{
+    const int lead = prebuild_lead.load(std::memory_order_relaxed);
+    if (lead <= 0 || block_number < 0 || epoch_length - block_number % epoch_length > lead)
+        return;
 
-    if (!shared_context_full || shared_context_full->epoch_number != epoch_number)
+    const int next_epoch = get_epoch_number(block_number) + 1;
+    int scheduled = prebuild_epoch.load(std::memory_order_relaxed);
+    do
     {
-        // Release the shared pointer of the obsoleted context.
-        shared_context_full.reset();
+        if (scheduled == next_epoch)
+            return;
+    } while (!prebuild_epoch.compare_exchange_weak(scheduled, next_epoch));
 
-        // Build new context.
-        shared_context_full = create_epoch_context_full(epoch_number);
-    }
+    prebuilder.request(next_epoch);
+}
 
-    thread_local_context_full = shared_context_full;
+int meraki_get_global_prebuilt_epoch(void)
+{
+    const int epoch_number = prebuild_epoch.load(std::memory_order_relaxed);
+    return epoch_number >= 0 && shared_cache.find(epoch_number) ? epoch_number : -1;
+}
+
+void meraki_set_global_epoch_cache_dir(const char* dir)
+{
+    std::lock_guard<std::mutex> lock{shared_context_cache_dir_mutex};
+    shared_context_cache_dir = dir ? dir : "";
+}
+
+void meraki_set_global_context_limits(bool full, int max_contexts, uint64_t max_bytes)
+{
+    if (full)
+        shared_cache_full.set_limits(max_contexts, max_bytes);
+    else
+        shared_cache.set_limits(max_contexts, max_bytes);
+}
+
+void meraki_get_global_context_stats(bool full, struct meraki_global_context_stats* stats)
+{
+    if (full)
+        shared_cache_full.get_stats(stats);
+    else
+        shared_cache.get_stats(stats);
 }
-}  // namespace
 
 const meraki_epoch_context* meraki_get_global_epoch_context(int epoch_number) 
 {
     // Check if local context matches epoch number.
-    if (!thread_local_context || thread_local_context->epoch_number != epoch_number)
-        update_local_context(epoch_number);
+    auto& local = thread_local_contexts;
+    if (!local.contexts[0] || local.contexts[0]->epoch_number != epoch_number ||
+        local.generation != shared_cache.generation())
+        update_local_context(local, shared_cache, epoch_number);
 
-    return thread_local_context.get();
+    return local.contexts[0].get();
 }
 
 const meraki_epoch_context_full* meraki_get_global_epoch_context_full(int epoch_number) 
 {
     // Check if local context matches epoch number.
-    if (!thread_local_context_full || thread_local_context_full->epoch_number != epoch_number)
-        update_local_context_full(epoch_number);
+    auto& local = thread_local_contexts_full;
+    if (!local.contexts[0] || local.contexts[0]->epoch_number != epoch_number ||
+        local.generation != shared_cache_full.generation())
+        update_local_context(local, shared_cache_full, epoch_number);
 
-    return thread_local_context_full.get();
+    return local.contexts[0].get();
 }
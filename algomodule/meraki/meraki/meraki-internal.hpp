@@ -12,6 +12,7 @@
 
 #include "endianness.hpp"
 
+#include <atomic>
 #include <memory>
 #include <vector>
 
@@ -19,11 +20,20 @@ extern "C" struct meraki_epoch_context_full : meraki_epoch_context
 {
     meraki_hash1024* full_dataset;
 
+    /// Bitmaps with one bit per pair of full dataset items (a 2048-bit item).
+    /// A pair is stored only by the thread that sets its claimed bit, and
+    /// read only after its ready bit is seen with acquire ordering.
+    std::atomic<uint32_t>* pair_ready;
+    std::atomic<uint32_t>* pair_claimed;
+
     constexpr meraki_epoch_context_full(int epoch, int light_num_items,
         const meraki_hash512* light, const uint32_t* l1, int dataset_num_items,
-        meraki_hash1024* dataset) 
+        meraki_hash1024* dataset, std::atomic<uint32_t>* ready = nullptr,
+        std::atomic<uint32_t>* claimed = nullptr) 
       : meraki_epoch_context{epoch, light_num_items, light, l1, dataset_num_items},
-        full_dataset{dataset}
+        full_dataset{dataset},
+        pair_ready{ready},
+        pair_claimed{claimed}
     {}
 };
 
@@ -52,6 +62,42 @@ hash512 calculate_dataset_item_512(const epoch_context& context, int64_t index)
 hash1024 calculate_dataset_item_1024(const epoch_context& context, uint32_t index) ;
 hash2048 calculate_dataset_item_2048(const epoch_context& context, uint32_t index) ;
 
+/// Returns the pair of full dataset items at index if it has been stored, or
+/// null. This is the fast path of the lazy full dataset lookups.
+inline const hash2048* find_dataset_pair(const epoch_context_full& context, uint32_t index) 
+{
+    const uint32_t bit = uint32_t{1} << (index % 32);
+    if ((context.pair_ready[index / 32].load(std::memory_order_acquire) & bit) == 0)
+        return nullptr;
+    return reinterpret_cast<const hash2048*>(context.full_dataset) + index;
+}
+
+/// Computes the pair of full dataset items at index and stores it, unless
+/// another thread has already claimed it. Never waits for other threads.
+hash2048 fill_dataset_pair(const epoch_context_full& context, uint32_t index) ;
+
+/// Whether context was loaded by meraki_load_epoch_context() from a light
+/// cache file: built contexts keep the light cache right after their header
+/// block.
+inline bool is_mapped_epoch_context(const epoch_context& context) 
+{
+    return context.light_cache != reinterpret_cast<const hash512*>(&context) + 1;
+}
+
+/// Unmaps and frees a context loaded by meraki_load_epoch_context() from a
+/// light cache file. Returns false, doing nothing, for a built context.
+bool release_mapped_epoch_context(epoch_context* context);
+
+/// Allocates size zeroed bytes, 64-byte aligned, for a built epoch context as
+/// meraki_set_epoch_context_memory() last set. Returns null if out of memory.
+void* allocate_context_memory(size_t size);
+
+/// Frees memory from allocate_context_memory().
+void free_context_memory(void* memory);
+
+/// The MERAKI_BACKING_* value of memory from allocate_context_memory().
+int get_context_memory_backing(const void* memory);
+
 namespace generic
 {
 using hash_fn_512 = hash512 (*)(const uint8_t* data, size_t size);
@@ -11,10 +11,17 @@
 #include "algomodule/meraki/keccak/keccak.hpp"
 #include "algomodule/meraki/support/progpow.hpp"
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cstdlib>
 #include <cstring>
 #include <limits>
+#include <mutex>
+#include <new>
+#include <system_error>
+#include <thread>
+#include <vector>
 
 namespace meraki
 {
@@ -54,45 +61,147 @@ inline hash512 bitwise_xor(const hash512& x, const hash512& y)
         z.word64s[i] = x.word64s[i] ^ y.word64s[i];
     return z;
 }
+
+/// The seed and item counts of the epochs, computed once per process.
+///
+/// The table grows on demand by chunks of chunk_epochs epochs, each seed
+/// chained from the one before. Chunks are never freed or moved, so a
+/// published chunk is read without locking. The item counts are filled in on
+/// first use: 0 means not computed yet. Threads racing to fill one in store
+/// the same value.
+namespace epoch_table
+{
+struct entry
+{
+    hash256 seed;
+    std::atomic<int> light_cache_num_items;
+    std::atomic<int> full_dataset_num_items;
+};
+
+constexpr int chunk_epochs = 1024;
+constexpr int max_chunks = 32;  // Covers the 30000 seeds find_epoch_number() tries.
+constexpr int max_epochs = chunk_epochs * max_chunks;
+
+std::atomic<entry*> chunks[max_chunks];
+std::mutex grow_mutex;
+
+/// The entry of epoch_number, or null if it is outside the table.
+entry* get(int epoch_number) 
+{
+    if (epoch_number < 0 || epoch_number >= max_epochs)
+        return nullptr;
+
+    const int c = epoch_number / chunk_epochs;
+    entry* chunk = chunks[c].load(std::memory_order_acquire);
+    if (!chunk)
+    {
+        std::lock_guard<std::mutex> lock{grow_mutex};
+        for (int i = 0; i <= c; ++i)
+        {
+            if (chunks[i].load(std::memory_order_relaxed))
+                continue;
+
+            chunk = new (std::nothrow) entry[chunk_epochs]();
+            if (!chunk)
+                return nullptr;
+            hash256 seed = {};
+            if (i != 0)
+                seed = keccak256(chunks[i - 1].load(std::memory_order_relaxed)[chunk_epochs - 1].seed);
+            for (int j = 0; j < chunk_epochs; ++j)
+            {
+                chunk[j].seed = seed;
+                seed = keccak256(seed);
+            }
+            chunks[i].store(chunk, std::memory_order_release);
+        }
+        chunk = chunks[c].load(std::memory_order_relaxed);
+    }
+    return &chunk[epoch_number % chunk_epochs];
+}
+
+inline int get_num_items(std::atomic<int>& cached, int (*calculate)(int), int epoch_number) 
+{
+    int num_items = cached.load(std::memory_order_relaxed);
+    if (num_items == 0)
+    {
+        num_items = calculate(epoch_number);
+        cached.store(num_items, std::memory_order_relaxed);
+    }
+    return num_items;
+}
+}  // namespace epoch_table
+
+hash256 compute_epoch_seed(int epoch_number) 
+{
+    hash256 epoch_seed = {};
+    for (int i = 0; i < epoch_number; ++i)
+        epoch_seed = keccak256(epoch_seed);
+    return epoch_seed;
+}
+
+int compute_light_cache_num_items(int epoch_number) 
+{
+    static constexpr int item_size = sizeof(hash512);
+    static constexpr int num_items_init = light_cache_init_size / item_size;
+    static constexpr int num_items_growth = light_cache_growth / item_size;
+    static_assert(
+        light_cache_init_size % item_size == 0, "light_cache_init_size not multiple of item size");
+    static_assert(
+        light_cache_growth % item_size == 0, "light_cache_growth not multiple of item size");
+
+    int num_items_upper_bound = num_items_init + (epoch_number * 4) * num_items_growth;
+    int num_items = meraki_find_largest_prime(num_items_upper_bound);
+    return num_items;
+}
+
+int compute_full_dataset_num_items(int epoch_number) 
+{
+    static constexpr int item_size = sizeof(hash1024);
+    static constexpr int num_items_init = full_dataset_init_size / item_size;
+    static constexpr int num_items_growth = full_dataset_growth / item_size;
+    static_assert(full_dataset_init_size % item_size == 0,
+        "full_dataset_init_size not multiple of item size");
+    static_assert(
+        full_dataset_growth % item_size == 0, "full_dataset_growth not multiple of item size");
+
+    int num_items_upper_bound = num_items_init + (epoch_number * 4) * num_items_growth;
+    int num_items = meraki_find_largest_prime(num_items_upper_bound);
+    return num_items;
+}
 }  // namespace
 
 int find_epoch_number(const hash256& seed) 
 {
-    static constexpr int num_tries = 30000;  // Divisible by 16.
+    static constexpr int num_tries = 30000;
 
     // Thread-local cache of the last search.
     static thread_local int cached_epoch_number = 0;
-    static thread_local hash256 cached_seed = {};
 
-    // Load from memory once (memory will be clobbered by keccak256()).
     const uint32_t seed_part = seed.word32s[0];
     const int e = cached_epoch_number;
-    hash256 s = cached_seed;
 
-    if (s.word32s[0] == seed_part)
-        return e;
-
-    // Try the next seed, will match for sequential epoch access.
-    s = keccak256(s);
-    if (s.word32s[0] == seed_part)
+    // The last epoch found, or the next one for sequential epoch access.
+    for (int i = e; i <= e + 1; ++i)
     {
-        cached_seed = s;
-        cached_epoch_number = e + 1;
-        return e + 1;
+        const epoch_table::entry* entry = epoch_table::get(i);
+        if (entry && entry->seed.word32s[0] == seed_part)
+        {
+            cached_epoch_number = i;
+            return i;
+        }
     }
 
-    // Search for matching seed starting from epoch 0.
-    s = {};
+    // Scan the table from epoch 0.
     for (int i = 0; i < num_tries; ++i)
     {
-        if (s.word32s[0] == seed_part)
+        const epoch_table::entry* entry = epoch_table::get(i);
+        if (!entry)
+            break;
+        if (entry->seed.word32s[0] == seed_part)
         {
-            cached_seed = s;
             cached_epoch_number = i;
             return i;
         }
-
-        s = keccak256(s);
     }
 
     return -1;
@@ -139,13 +248,16 @@ epoch_context_full* create_epoch_context(
     const int light_cache_num_items = calculate_light_cache_num_items(epoch_number);
     const int full_dataset_num_items = calculate_full_dataset_num_items(epoch_number);
     const size_t light_cache_size = get_light_cache_size(light_cache_num_items);
+    // The full dataset is padded to whole pairs of items, followed by the
+    // ready and claimed bitmaps of the pairs.
+    const size_t num_pairs = (static_cast<size_t>(full_dataset_num_items) + 1) / 2;
+    const size_t pair_bitmap_size = (num_pairs + 31) / 32 * sizeof(uint32_t);
     const size_t full_dataset_size =
-        full ? static_cast<size_t>(full_dataset_num_items) * sizeof(hash1024) :
-               progpow::l1_cache_size;
+        full ? num_pairs * sizeof(hash2048) + 2 * pair_bitmap_size : progpow::l1_cache_size;
 
     const size_t alloc_size = context_alloc_size + light_cache_size + full_dataset_size;
 
-    char* const alloc_data = static_cast<char*>(std::calloc(1, alloc_size));
+    char* const alloc_data = static_cast<char*>(allocate_context_memory(alloc_size));
     if (!alloc_data)
         return nullptr;  // Signal out-of-memory by returning null pointer.
 
@@ -157,6 +269,14 @@ epoch_context_full* create_epoch_context(
         reinterpret_cast<uint32_t*>(alloc_data + context_alloc_size + light_cache_size);
 
     hash1024* full_dataset = full ? reinterpret_cast<hash1024*>(l1_cache) : nullptr;
+    std::atomic<uint32_t>* pair_ready = nullptr;
+    std::atomic<uint32_t>* pair_claimed = nullptr;
+    if (full)
+    {
+        char* const bitmaps = reinterpret_cast<char*>(full_dataset) + num_pairs * sizeof(hash2048);
+        pair_ready = reinterpret_cast<std::atomic<uint32_t>*>(bitmaps);
+        pair_claimed = reinterpret_cast<std::atomic<uint32_t>*>(bitmaps + pair_bitmap_size);
+    }
 
     epoch_context_full* const context = new (alloc_data) epoch_context_full{
         epoch_number,
@@ -165,11 +285,25 @@ epoch_context_full* create_epoch_context(
         l1_cache,
         full_dataset_num_items,
         full_dataset,
+        pair_ready,
+        pair_claimed,
     };
 
     auto* full_dataset_2048 = reinterpret_cast<hash2048*>(l1_cache);
     for (uint32_t i = 0; i < progpow::l1_cache_size / sizeof(full_dataset_2048[0]); ++i)
         full_dataset_2048[i] = calculate_dataset_item_2048(*context, i);
+
+    // The L1 cache is the start of the full dataset: those pairs are final.
+    if (full)
+    {
+        static constexpr uint32_t l1_pairs = progpow::l1_cache_size / sizeof(hash2048);
+        static_assert(l1_pairs % 32 == 0, "L1 cache not a whole number of bitmap words");
+        for (uint32_t i = 0; i < l1_pairs / 32; ++i)
+        {
+            pair_claimed[i].store(~uint32_t{0}, std::memory_order_relaxed);
+            pair_ready[i].store(~uint32_t{0}, std::memory_order_relaxed);
+        }
+    }
     return context;
 }
 }  // namespace generic
@@ -252,6 +386,19 @@ hash2048 calculate_dataset_item_2048(const epoch_context& context, uint32_t inde
     return hash2048{{item0.final(), item1.final(), item2.final(), item3.final()}};
 }
 
+hash2048 fill_dataset_pair(const epoch_context_full& context, uint32_t index) 
+{
+    const hash2048 item = calculate_dataset_item_2048(context, index);
+
+    const uint32_t bit = uint32_t{1} << (index % 32);
+    if ((context.pair_claimed[index / 32].fetch_or(bit, std::memory_order_relaxed) & bit) == 0)
+    {
+        reinterpret_cast<hash2048*>(context.full_dataset)[index] = item;
+        context.pair_ready[index / 32].fetch_or(bit, std::memory_order_release);
+    }
+    return item;
+}
+
 namespace
 {
 using lookup_fn = hash1024 (*)(const epoch_context&, uint32_t);
@@ -309,15 +456,13 @@ result hash(const epoch_context_full& context, const hash256& header_hash, uint6
 {
     static const auto lazy_lookup = [](const epoch_context& ctx, uint32_t index) 
     {
-        auto full_dataset = static_cast<const epoch_context_full&>(ctx).full_dataset;
-        hash1024& item = full_dataset[index];
-        if (item.word64s[0] == 0)
-        {
-            // TODO: Copy elision here makes it thread-safe?
-            item = calculate_dataset_item_1024(ctx, index);
-        }
+        const auto& context = static_cast<const epoch_context_full&>(ctx);
+        if (find_dataset_pair(context, index / 2))
+            return context.full_dataset[index];
 
-        return item;
+        // Fill the whole pair: four interleaved halves cost little more than two.
+        const hash2048 pair = fill_dataset_pair(context, index / 2);
+        return hash1024{{pair.hash512s[(index % 2) * 2], pair.hash512s[(index % 2) * 2 + 1]}};
     };
 
     const hash512 seed = hash_seed(header_hash, nonce);
@@ -358,40 +503,25 @@ extern "C" {
 
 meraki_hash256 meraki_calculate_epoch_seed(int epoch_number) 
 {
-    meraki_hash256 epoch_seed = {};
-    for (int i = 0; i < epoch_number; ++i)
-        epoch_seed = meraki_keccak256_32(epoch_seed.bytes);
-    return epoch_seed;
+    if (const epoch_table::entry* entry = epoch_table::get(epoch_number))
+        return entry->seed;
+    return compute_epoch_seed(epoch_number);
 }
 
 int meraki_calculate_light_cache_num_items(int epoch_number) 
 {
-    static constexpr int item_size = sizeof(hash512);
-    static constexpr int num_items_init = light_cache_init_size / item_size;
-    static constexpr int num_items_growth = light_cache_growth / item_size;
-    static_assert(
-        light_cache_init_size % item_size == 0, "light_cache_init_size not multiple of item size");
-    static_assert(
-        light_cache_growth % item_size == 0, "light_cache_growth not multiple of item size");
-
-    int num_items_upper_bound = num_items_init + (epoch_number * 4) * num_items_growth;
-    int num_items = meraki_find_largest_prime(num_items_upper_bound);
-    return num_items;
+    if (epoch_table::entry* entry = epoch_table::get(epoch_number))
+        return epoch_table::get_num_items(
+            entry->light_cache_num_items, compute_light_cache_num_items, epoch_number);
+    return compute_light_cache_num_items(epoch_number);
 }
 
 int meraki_calculate_full_dataset_num_items(int epoch_number) 
 {
-    static constexpr int item_size = sizeof(hash1024);
-    static constexpr int num_items_init = full_dataset_init_size / item_size;
-    static constexpr int num_items_growth = full_dataset_growth / item_size;
-    static_assert(full_dataset_init_size % item_size == 0,
-        "full_dataset_init_size not multiple of item size");
-    static_assert(
-        full_dataset_growth % item_size == 0, "full_dataset_growth not multiple of item size");
-
-    int num_items_upper_bound = num_items_init + (epoch_number * 4) * num_items_growth;
-    int num_items = meraki_find_largest_prime(num_items_upper_bound);
-    return num_items;
+    if (epoch_table::entry* entry = epoch_table::get(epoch_number))
+        return epoch_table::get_num_items(
+            entry->full_dataset_num_items, compute_full_dataset_num_items, epoch_number);
+    return compute_full_dataset_num_items(epoch_number);
 }
 
 epoch_context* meraki_create_epoch_context(int epoch_number) 
@@ -404,15 +534,96 @@ epoch_context_full* meraki_create_epoch_context_full(int epoch_number)
     return generic::create_epoch_context(build_light_cache, epoch_number, true);
 }
 
+bool meraki_prepare_dataset(const epoch_context_full* context, int num_threads,
+    meraki_progress_callback progress, void* user_data)
+{
+    // Work is handed out in runs of 2048-bit items (pairs of dataset items),
+    // each computed as four interleaved 512-bit halves by
+    // calculate_dataset_item_2048().
+    static constexpr uint32_t chunk_size = 1024;
+
+    const int num_items = context->full_dataset_num_items;
+    const uint32_t num_pairs = (static_cast<uint32_t>(num_items) + 1) / 2;
+
+    std::atomic<uint32_t> next_item{0};
+    std::atomic<int> items_done{0};
+    std::atomic<bool> cancelled{false};
+
+    // Fills one chunk; false when there is none left or the run was cancelled.
+    const auto fill_chunk = [&]() -> bool {
+        if (cancelled.load(std::memory_order_relaxed))
+            return false;
+        const uint32_t begin = next_item.fetch_add(chunk_size, std::memory_order_relaxed);
+        if (begin >= num_pairs)
+            return false;
+        const uint32_t end = std::min(begin + chunk_size, num_pairs);
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            if (!find_dataset_pair(*context, i))
+                fill_dataset_pair(*context, i);
+        }
+        items_done.fetch_add(static_cast<int>(end - begin) * 2, std::memory_order_relaxed);
+        return true;
+    };
+
+    if (num_threads <= 0)
+        num_threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+
+    std::vector<std::thread> workers;
+    for (int i = 1; i < num_threads; ++i)
+    {
+        try
+        {
+            workers.emplace_back([&fill_chunk] {
+                while (fill_chunk())
+                {
+                }
+            });
+        }
+        catch (const std::system_error&)
+        {
+            break;  // Carry on with the threads we have.
+        }
+    }
+
+    // The calling thread works too, and is the only one to report progress.
+    while (fill_chunk())
+    {
+        const int done = std::min(items_done.load(), num_items);
+        if (progress && progress(user_data, done, num_items) != 0)
+            cancelled = true;
+    }
+    for (auto& worker : workers)
+        worker.join();
+
+    if (cancelled)
+        return false;
+
+    if (progress)
+        progress(user_data, num_items, num_items);
+    return true;
+}
+
 void meraki_destroy_epoch_context_full(epoch_context_full* context) 
 {
     meraki_destroy_epoch_context(context);
 }
 
+int meraki_get_epoch_context_backing(const epoch_context* context)
+{
+    if (is_mapped_epoch_context(*context))
+        return MERAKI_BACKING_FILE;
+    return get_context_memory_backing(context);
+}
+
 void meraki_destroy_epoch_context(epoch_context* context) 
 {
+    if (!context)
+        return;
+    if (release_mapped_epoch_context(context))
+        return;
     context->~epoch_context();
-    std::free(context);
+    free_context_memory(context);
 }
 
 meraki_result meraki_hash(
@@ -512,4 +723,60 @@ hash256 light_verify(const hash256* header_hash,
     return output;
 }
 
+void light_verify_many(const hash256* header_hashes, const hash256* mix_hashes,
+    const uint64_t* nonces, size_t count, hash256* final_hashes)
+{
+    static constexpr size_t batch_size = 16;
+
+    // The constant words of both absorptions, laid out for a whole batch
+    // once per process; each batch only writes the header, nonce and mix.
+    struct absorb_states
+    {
+        uint32_t initial[25][batch_size];
+        uint32_t final[25][batch_size];
+    };
+    static const absorb_states constants = [] {
+        absorb_states s = {};
+        for (size_t j = 0; j < batch_size; ++j)
+        {
+            for (int i = 10; i < 25; ++i)
+                s.initial[i][j] = meowcoin_meraki[i - 10];
+            for (int i = 16; i < 25; ++i)
+                s.final[i][j] = meowcoin_meraki[i - 16];
+        }
+        return s;
+    }();
+
+    absorb_states state;
+    for (size_t begin = 0; begin < count; begin += batch_size)
+    {
+        const size_t n = std::min(batch_size, count - begin);
+        state = constants;
+
+        for (size_t j = 0; j < n; ++j)
+        {
+            for (int i = 0; i < 8; ++i)
+                state.initial[i][j] = header_hashes[begin + j].word32s[i];
+            state.initial[8][j] = (uint32_t)nonces[begin + j];
+            state.initial[9][j] = (uint32_t)(nonces[begin + j] >> 32);
+        }
+        meraki_keccakf800_x16(state.initial);
+
+        for (size_t j = 0; j < n; ++j)
+        {
+            for (int i = 0; i < 8; ++i)
+                state.final[i][j] = state.initial[i][j];
+            for (int i = 8; i < 16; ++i)
+                state.final[i][j] = mix_hashes[begin + j].word32s[i - 8];
+        }
+        meraki_keccakf800_x16(state.final);
+
+        for (size_t j = 0; j < n; ++j)
+        {
+            for (int i = 0; i < 8; ++i)
+                final_hashes[begin + j].word32s[i] = le::uint32(state.final[i][j]);
+        }
+    }
+}
+
 }  // extern "C"
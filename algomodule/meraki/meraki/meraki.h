@@ -8,6 +8,7 @@
 #include "algomodule/meraki/support/hash_types.h"
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -92,11 +93,140 @@ struct meraki_epoch_context* meraki_create_epoch_context(int epoch_number) ;
  */
 struct meraki_epoch_context_full* meraki_create_epoch_context_full(int epoch_number) ;
 
+/**
+ * Loads the epoch context from the light cache file of the epoch in dir.
+ *
+ * The file holds the light cache and the L1 cache and is mapped read-only, so
+ * every process that loads it shares one copy through the page cache. If the
+ * file is missing or fails its version, size or checksum checks, the context
+ * is built as by meraki_create_epoch_context() and the file is written to a
+ * temporary name and renamed into place. A null dir, or a file that cannot be
+ * written, only builds the context.
+ *
+ * The context MUST be freed with meraki_destroy_epoch_context().
+ *
+ * @param dir           The directory of the light cache files, or null.
+ * @param epoch_number  The epoch number.
+ * @return              The epoch context, or null on out-of-memory.
+ */
+struct meraki_epoch_context* meraki_load_epoch_context(const char* dir, int epoch_number);
+
+/** Frees a context made by any of the functions above. Null is ignored. */
 void meraki_destroy_epoch_context(struct meraki_epoch_context* context) ;
 
+/**
+ * Memory policies of meraki_set_epoch_context_memory(), or-ed together.
+ *
+ * MERAKI_MEMORY_HUGE_PAGES maps contexts on explicit huge pages when some are
+ * reserved (1 GiB ones for full datasets of 1 GiB or more, else 2 MiB), or
+ * with transparent huge pages advised otherwise, so that random dataset and
+ * light cache reads take far fewer TLB misses. MERAKI_MEMORY_INTERLEAVE
+ * spreads the pages of a context over all online NUMA nodes instead of
+ * placing them all on the node of the thread that touches them first.
+ */
+#define MERAKI_MEMORY_DEFAULT 0
+#define MERAKI_MEMORY_HUGE_PAGES 1
+#define MERAKI_MEMORY_INTERLEAVE 2
+
+/** How the memory of a context is backed; see meraki_get_epoch_context_backing(). */
+#define MERAKI_BACKING_HEAP 0    /* heap block */
+#define MERAKI_BACKING_MAP 1     /* anonymous mapping of normal pages */
+#define MERAKI_BACKING_THP 2     /* anonymous mapping, transparent huge pages advised */
+#define MERAKI_BACKING_HUGETLB 3 /* explicit huge pages */
+#define MERAKI_BACKING_FILE 4    /* light cache file mapping */
+
+/**
+ * Sets the memory policy of the epoch contexts built from now on, including
+ * those of the global shared context. A context whose mapping fails, for
+ * instance for want of huge pages, is allocated on the heap as by default.
+ */
+void meraki_set_epoch_context_memory(int policy);
+
+/** Returns the MERAKI_BACKING_* value of context. */
+int meraki_get_epoch_context_backing(const struct meraki_epoch_context* context);
+
+/**
+ * Reports the progress of meraki_prepare_dataset(): items_done of items_total
+ * full dataset items are generated. Returning non-zero cancels the run.
+ */
+typedef int (*meraki_progress_callback)(void* user_data, int items_done, int items_total);
+
+/**
+ * Generates every item of the full dataset up front instead of on first use.
+ *
+ * The dataset is split into chunks that num_threads threads, the calling one
+ * included, take in turn; 0 uses one thread per CPU. progress, if not null,
+ * is called on the calling thread after each chunk it finishes and once more
+ * at the end. Items already generated by lazy lookups are skipped, and
+ * threads may hash with the context while it runs.
+ *
+ * @return  True if the whole dataset was generated, false if progress
+ *          cancelled the run.
+ */
+bool meraki_prepare_dataset(const struct meraki_epoch_context_full* context, int num_threads,
+    meraki_progress_callback progress, void* user_data);
+
 void meraki_destroy_epoch_context_full(struct meraki_epoch_context_full* context) ;
 
 
+/**
+ * Makes the global shared epoch context load its epochs from, and store them
+ * as, light cache files in dir; see meraki_load_epoch_context(). The path is
+ * copied. Null, the default, builds every epoch in memory.
+ */
+void meraki_set_global_epoch_cache_dir(const char* dir);
+
+/**
+ * Sets how many blocks before an epoch boundary
+ * meraki_prebuild_global_epoch_context() starts building the next epoch's
+ * global shared context. 0, the default, turns prebuilding off.
+ */
+void meraki_set_global_epoch_prebuild_lead(int lead_blocks);
+
+/**
+ * Tells the global shared context that the chain is at block_number.
+ *
+ * Within the prebuild lead of the next epoch boundary, this starts building
+ * the next epoch's context on a background thread, once per epoch. When the
+ * first request for that epoch arrives, the finished context is already in
+ * the shared cache, published with an atomic pointer store, so no thread
+ * waits for the build. A request that arrives while the build is still
+ * running waits for it instead of starting a second one.
+ */
+void meraki_prebuild_global_epoch_context(int block_number);
+
+/**
+ * The epoch of the context built ahead by meraki_prebuild_global_epoch_context(),
+ * or -1 if there is none or it has been evicted.
+ */
+int meraki_get_global_prebuilt_epoch(void);
+
+/**
+ * Counters of the global shared context cache (see
+ * meraki_get_global_context_stats()). Lookups are counted when a thread does
+ * not already hold the epoch's context.
+ */
+struct meraki_global_context_stats
+{
+    uint64_t hits;           /** Lookups served from the cache. */
+    uint64_t misses;         /** Lookups that had to wait for a build. */
+    uint64_t builds;         /** Contexts built or loaded, prebuilds included. */
+    uint64_t build_time_ns;  /** Total time spent in those builds. */
+    uint64_t evictions;      /** Contexts dropped to stay within the limits. */
+    int num_contexts;        /** Contexts cached now. */
+    uint64_t num_bytes;      /** Their approximate size. */
+};
+
+/**
+ * Bounds the global shared cache of light (full = false) or full epoch
+ * contexts to max_contexts epochs (at most 16) and, unless max_bytes is 0, to
+ * about max_bytes of memory. The least recently used epochs are evicted
+ * first. Defaults: 4 light contexts and 1 full context, no byte limit.
+ */
+void meraki_set_global_context_limits(bool full, int max_contexts, uint64_t max_bytes);
+
+void meraki_get_global_context_stats(bool full, struct meraki_global_context_stats* stats);
+
 /**
  * Get global shared epoch context.
  */
@@ -123,6 +253,15 @@ bool meraki_verify_final_hash(const union meraki_hash256* header_hash,
 union meraki_hash256 light_verify(const union meraki_hash256* header_hash,
                        const union meraki_hash256* mix_hash, uint64_t nonce) ;
 
+/**
+ * light_verify() of count shares at once: final_hashes[i] is the final hash of
+ * header_hashes[i], mix_hashes[i] and nonces[i]. Both Keccak-f[800] passes
+ * run on 16 shares at a time with meraki_keccakf800_x16().
+ */
+void light_verify_many(const union meraki_hash256* header_hashes,
+    const union meraki_hash256* mix_hashes, const uint64_t* nonces, size_t count,
+    union meraki_hash256* final_hashes);
+
 #ifdef __cplusplus
 }
 #endif
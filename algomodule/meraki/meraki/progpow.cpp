@@ -9,8 +9,24 @@
 #include "algomodule/meraki/meraki/meraki-internal.hpp"
 #include "algomodule/meraki/meraki/kiss99.hpp"
 #include "algomodule/meraki/keccak/keccak.hpp"
+#include "algomodule/meraki/support/attributes.h"
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define PROGPOW_X86_KERNELS 1
+#include <immintrin.h>
+#else
+#define PROGPOW_X86_KERNELS 0
+#endif
 
 namespace progpow
 {
@@ -88,61 +104,6 @@ mix_rng_state::mix_rng_state(uint32_t* hash_seed)
 }
 
 
-NO_SANITIZE("unsigned-integer-overflow")
-inline uint32_t random_math(uint32_t a, uint32_t b, uint32_t selector) 
-{
-    switch (selector % 11)
-    {
-    default:
-    case 0:
-        return a + b;
-    case 1:
-        return a * b;
-    case 2:
-        return mul_hi32(a, b);
-    case 3:
-        return std::min(a, b);
-    case 4:
-        return rotl32(a, b);
-    case 5:
-        return rotr32(a, b);
-    case 6:
-        return a & b;
-    case 7:
-        return a | b;
-    case 8:
-        return a ^ b;
-    case 9:
-        return clz32(a) + clz32(b);
-    case 10:
-        return popcount32(a) + popcount32(b);
-    }
-}
-
-/// Merge data from `b` and `a`.
-/// Assuming `a` has high entropy, only do ops that retain entropy even if `b`
-/// has low entropy (i.e. do not do `a & b`).
-NO_SANITIZE("unsigned-integer-overflow")
-inline void random_merge(uint32_t& a, uint32_t b, uint32_t selector) 
-{
-    const auto x = (selector >> 16) % 31 + 1;  // Additional non-zero selector from higher bits.
-    switch (selector % 4)
-    {
-    case 0:
-        a = (a * 33) + b;
-        break;
-    case 1:
-        a = (a ^ b) * 33;
-        break;
-    case 2:
-        a = rotl32(a, x) ^ b;
-        break;
-    case 3:
-        a = rotr32(a, x) ^ b;
-        break;
-    }
-}
-
 static const uint32_t ravencoin_kawpow[15] = {
         0x00000072, //R
         0x00000041, //A
@@ -163,313 +124,496 @@ static const uint32_t ravencoin_kawpow[15] = {
 
 using lookup_fn = hash2048 (*)(const epoch_context&, uint32_t);
 
-using mix_array = std::array<std::array<uint32_t, num_regs>, num_lanes>;
+constexpr uint32_t num_rounds = 32;
 
-void round(
-    const epoch_context& context, uint32_t r, mix_array& mix, mix_rng_state state, lookup_fn lookup)
+/// The number of hashes a search thread computes together.
+constexpr size_t max_interleaved = 4;
+constexpr int max_operations =
+    num_cache_accesses > num_math_operations ? num_cache_accesses : num_math_operations;
+constexpr size_t num_dag_words = sizeof(hash2048) / (sizeof(uint32_t) * num_lanes);
+
+/// Random access to the L1 cache: merges l1_cache[mix[src] % l1_cache_num_items] into mix[dst].
+struct cache_op
 {
-    const uint32_t num_items = static_cast<uint32_t>(context.full_dataset_num_items / 2);
-    const uint32_t item_index = mix[r % num_lanes][0] % num_items;
-    const hash2048 item = lookup(context, item_index);
+    uint32_t src;
+    uint32_t dst;
+    uint32_t sel;
+};
 
-    constexpr size_t num_words_per_lane = sizeof(item) / (sizeof(uint32_t) * num_lanes);
-    constexpr int max_operations =
-        num_cache_accesses > num_math_operations ? num_cache_accesses : num_math_operations;
+/// Random math: merges the result of operation sel1 on mix[src1] and mix[src2] into mix[dst].
+struct math_op
+{
+    uint32_t src1;
+    uint32_t src2;
+    uint32_t sel1;
+    uint32_t dst;
+    uint32_t sel2;
+};
+
+/// The registers and selectors of every step of a round, as drawn from mix_rng_state.
+///
+/// Each round starts from a copy of the same state, seeded with the period
+/// number, so all rounds of all hashes in a period run the same program:
+/// it is compiled once per period and thread, and hashing does no RNG work.
+struct mix_program
+{
+    cache_op cache[num_cache_accesses];
+    math_op math[num_math_operations];
+    uint32_t dag_dst[num_dag_words];
+    uint32_t dag_sel[num_dag_words];
+};
+
+mix_program make_mix_program(int period) 
+{
+    const auto number = uint64_t(period);
+    uint32_t seed[2];
+    seed[0] = (uint32_t)number;
+    seed[1] = (uint32_t)(number >> 32);
+    mix_rng_state state{seed};
 
-    // Process lanes.
+    mix_program program;
     for (int i = 0; i < max_operations; ++i)
     {
-        if (i < num_cache_accesses)  // Random access to cached memory.
+        if (i < num_cache_accesses)
         {
-            const auto src = state.next_src();
-            const auto dst = state.next_dst();
-            const auto sel = state.rng();
-
-            for (size_t l = 0; l < num_lanes; ++l)
-            {
-                const size_t offset = mix[l][src] % l1_cache_num_items;
-                random_merge(mix[l][dst], le::uint32(context.l1_cache[offset]), sel);
-            }
+            auto& op = program.cache[i];
+            op.src = state.next_src();
+            op.dst = state.next_dst();
+            op.sel = state.rng();
         }
-        if (i < num_math_operations)  // Random math.
+        if (i < num_math_operations)
         {
             // Generate 2 unique source indexes.
+            auto& op = program.math[i];
             const auto src_rnd = state.rng() % (num_regs * (num_regs - 1));
-            const auto src1 = src_rnd % num_regs;  // O <= src1 < num_regs
-            auto src2 = src_rnd / num_regs;        // 0 <= src2 < num_regs - 1
-            if (src2 >= src1)
-                ++src2;
-
-            const auto sel1 = state.rng();
-            const auto dst = state.next_dst();
-            const auto sel2 = state.rng();
-
-            for (size_t l = 0; l < num_lanes; ++l)
-            {
-                const uint32_t data = random_math(mix[l][src1], mix[l][src2], sel1);
-                random_merge(mix[l][dst], data, sel2);
-            }
+            op.src1 = src_rnd % num_regs;  // O <= src1 < num_regs
+            op.src2 = src_rnd / num_regs;  // 0 <= src2 < num_regs - 1
+            if (op.src2 >= op.src1)
+                ++op.src2;
+
+            op.sel1 = state.rng();
+            op.dst = state.next_dst();
+            op.sel2 = state.rng();
         }
     }
 
-    // DAG access pattern.
-    uint32_t dsts[num_words_per_lane];
-    uint32_t sels[num_words_per_lane];
-    for (size_t i = 0; i < num_words_per_lane; ++i)
-    {
-        dsts[i] = i == 0 ? 0 : state.next_dst();
-        sels[i] = state.rng();
-    }
-
-    // DAG access.
-    for (size_t l = 0; l < num_lanes; ++l)
+    for (size_t i = 0; i < num_dag_words; ++i)
     {
-        const auto offset = ((l ^ r) % num_lanes) * num_words_per_lane;
-        for (size_t i = 0; i < num_words_per_lane; ++i)
-        {
-            const auto word = le::uint32(item.word32s[offset + i]);
-            random_merge(mix[l][dsts[i]], word, sels[i]);
-        }
+        program.dag_dst[i] = i == 0 ? 0 : state.next_dst();
+        program.dag_sel[i] = state.rng();
     }
+    return program;
 }
 
-mix_array init_mix(uint32_t* hash_seed)
-{
-    const uint32_t z = fnv1a(fnv_offset_basis, static_cast<uint32_t>(hash_seed[0]));
-    const uint32_t w = fnv1a(z, static_cast<uint32_t>(hash_seed[1]));
+using hash_mix_fn = void (*)(const epoch_context&, const mix_program&, const uint32_t (*)[2],
+    size_t, lookup_fn, hash256*);
 
-    mix_array mix;
-    for (uint32_t l = 0; l < mix.size(); ++l)
-    {
-        const uint32_t jsr = fnv1a(w, l);
-        const uint32_t jcong = fnv1a(jsr, l);
-        kiss99 rng{z, w, jsr, jcong};
+/// One lane at a time, for any CPU.
+namespace generic_kernel
+{
+struct lanes
+{
+    using vec = uint32_t;
+    static constexpr size_t width = 1;
+
+    static vec load(const uint32_t* p) { return *p; }
+    static void store(uint32_t* p, vec v) { *p = v; }
+    static vec set1(uint32_t x) { return x; }
+    static vec lane_index(size_t c) { return static_cast<uint32_t>(c); }
+
+    NO_SANITIZE("unsigned-integer-overflow")
+    static vec add(vec a, vec b) { return a + b; }
+    NO_SANITIZE("unsigned-integer-overflow")
+    static vec mul(vec a, vec b) { return a * b; }
+    static vec mul_hi(vec a, vec b) { return mul_hi32(a, b); }
+    static vec min(vec a, vec b) { return std::min(a, b); }
+    static vec rotl(vec a, vec b) { return rotl32(a, b); }
+    static vec rotr(vec a, vec b) { return rotr32(a, b); }
+    static vec rotl_n(vec a, uint32_t n) { return rotl32(a, n); }
+    static vec rotr_n(vec a, uint32_t n) { return rotr32(a, n); }
+    static vec bit_and(vec a, vec b) { return a & b; }
+    static vec bit_or(vec a, vec b) { return a | b; }
+    static vec bit_xor(vec a, vec b) { return a ^ b; }
+    static vec gather(const uint32_t* base, vec index) { return le::uint32(base[index]); }
+};
 
-        for (auto& row : mix[l])
-            row = rng();
-    }
-    return mix;
-}
+#include "algomodule/meraki/meraki/progpow_lanes.hpp"
+}  // namespace generic_kernel
 
-hash256 hash_mix(
-    const epoch_context& context, int block_number, uint32_t * seed, lookup_fn lookup) 
+#if PROGPOW_X86_KERNELS
+#pragma GCC push_options
+#pragma GCC target("avx2")
+/// 8 lanes per AVX2 register.
+namespace avx2_kernel
 {
-    auto mix = init_mix(seed);
-    auto number = uint64_t(block_number / period_length);
-    uint32_t new_state[2];
-    new_state[0] = (uint32_t)number;
-    new_state[1] = (uint32_t)(number >> 32);
-    mix_rng_state state{new_state};
-
-    for (uint32_t i = 0; i < 32; ++i)
-        round(context, i, mix, state, lookup);
+struct lanes
+{
+    using vec = __m256i;
+    static constexpr size_t width = 8;
 
-    // Reduce mix data to a single per-lane result.
-    uint32_t lane_hash[num_lanes];
-    for (size_t l = 0; l < num_lanes; ++l)
+    static vec load(const uint32_t* p) { return _mm256_load_si256(reinterpret_cast<const vec*>(p)); }
+    static void store(uint32_t* p, vec v) { _mm256_store_si256(reinterpret_cast<vec*>(p), v); }
+    static vec set1(uint32_t x) { return _mm256_set1_epi32(static_cast<int>(x)); }
+    static vec lane_index(size_t c)
     {
-        lane_hash[l] = fnv_offset_basis;
-        for (uint32_t i = 0; i < num_regs; ++i)
-            lane_hash[l] = fnv1a(lane_hash[l], mix[l][i]);
+        return _mm256_add_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), set1(uint32_t(c)));
     }
 
-    // Reduce all lanes to a single 256-bit result.
-    static constexpr size_t num_words = sizeof(hash256) / sizeof(uint32_t);
-    hash256 mix_hash;
-    for (uint32_t& w : mix_hash.word32s)
-        w = fnv_offset_basis;
-    for (size_t l = 0; l < num_lanes; ++l)
-        mix_hash.word32s[l % num_words] = fnv1a(mix_hash.word32s[l % num_words], lane_hash[l]);
-    return le::uint32s(mix_hash);
-}
-}  // namespace
+    static vec add(vec a, vec b) { return _mm256_add_epi32(a, b); }
+    static vec mul(vec a, vec b) { return _mm256_mullo_epi32(a, b); }
+    static vec mul_hi(vec a, vec b)
+    {
+        const vec even = _mm256_srli_epi64(_mm256_mul_epu32(a, b), 32);
+        const vec odd = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), _mm256_srli_epi64(b, 32));
+        return _mm256_blend_epi32(even, odd, 0xaa);
+    }
+    static vec min(vec a, vec b) { return _mm256_min_epu32(a, b); }
+    static vec rotl(vec a, vec b)
+    {
+        const vec n = _mm256_and_si256(b, set1(31));
+        return _mm256_or_si256(
+            _mm256_sllv_epi32(a, n), _mm256_srlv_epi32(a, _mm256_sub_epi32(set1(32), n)));
+    }
+    static vec rotr(vec a, vec b)
+    {
+        const vec n = _mm256_and_si256(b, set1(31));
+        return _mm256_or_si256(
+            _mm256_srlv_epi32(a, n), _mm256_sllv_epi32(a, _mm256_sub_epi32(set1(32), n)));
+    }
+    static vec rotl_n(vec a, uint32_t n)
+    {
+        return _mm256_or_si256(_mm256_sll_epi32(a, _mm_cvtsi32_si128(int(n))),
+            _mm256_srl_epi32(a, _mm_cvtsi32_si128(int(32 - n))));
+    }
+    static vec rotr_n(vec a, uint32_t n) { return rotl_n(a, 32 - n); }
+    static vec bit_and(vec a, vec b) { return _mm256_and_si256(a, b); }
+    static vec bit_or(vec a, vec b) { return _mm256_or_si256(a, b); }
+    static vec bit_xor(vec a, vec b) { return _mm256_xor_si256(a, b); }
+    static vec gather(const uint32_t* base, vec index)
+    {
+        return _mm256_i32gather_epi32(reinterpret_cast<const int*>(base), index, 4);
+    }
+};
 
-result hash(const epoch_context& context, int block_number, const hash256& header_hash,
-    uint64_t nonce) 
+#include "algomodule/meraki/meraki/progpow_lanes.hpp"
+}  // namespace avx2_kernel
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+#pragma GCC diagnostic push
+// GCC 12 takes the _mm512_undefined_epi32() inside the intrinsics for an uninitialized use.
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+/// All 16 lanes in one AVX-512 register.
+namespace avx512_kernel
 {
-    uint32_t hash_seed[2];  // KISS99 initiator
-
-    uint32_t state2[8];
+struct lanes
+{
+    using vec = __m512i;
+    static constexpr size_t width = 16;
 
+    static vec load(const uint32_t* p) { return _mm512_load_si512(p); }
+    static void store(uint32_t* p, vec v) { _mm512_store_si512(p, v); }
+    static vec set1(uint32_t x) { return _mm512_set1_epi32(static_cast<int>(x)); }
+    static vec lane_index(size_t c)
     {
-        uint32_t state[25] = {0x0};     // Keccak's state
-
-        // Absorb phase for initial round of keccak
-        // 1st fill with header data (8 words)
-        for (int i = 0; i < 8; i++)
-            state[i] = header_hash.word32s[i];
-
-        // 2nd fill with nonce (2 words)
-        state[8] = (uint32_t)nonce;
-        state[9] = (uint32_t)(nonce >> 32);
-
-        // 3rd apply ravencoin input constraints
-        for (int i = 10; i < 25; i++)
-            state[i] = ravencoin_kawpow[i-10];
-
-        keccak_progpow_64(state);
-
-        for (int i = 0; i < 8; i++)
-            state2[i] = state[i];
+        return _mm512_add_epi32(
+            _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15),
+            set1(uint32_t(c)));
     }
 
-    hash_seed[0] = state2[0];
-    hash_seed[1] = state2[1];
-    const hash256 mix_hash = hash_mix(context, block_number, hash_seed, calculate_dataset_item_2048);
-
-    uint32_t state[25] = {0x0};     // Keccak's state
-
-    // Absorb phase for last round of keccak (256 bits)
-    // 1st initial 8 words of state are kept as carry-over from initial keccak
-    for (int i = 0; i < 8; i++)
-        state[i] = state2[i];
+    static vec add(vec a, vec b) { return _mm512_add_epi32(a, b); }
+    static vec mul(vec a, vec b) { return _mm512_mullo_epi32(a, b); }
+    static vec mul_hi(vec a, vec b)
+    {
+        const vec even = _mm512_srli_epi64(_mm512_mul_epu32(a, b), 32);
+        const vec odd = _mm512_mul_epu32(_mm512_srli_epi64(a, 32), _mm512_srli_epi64(b, 32));
+        return _mm512_mask_blend_epi32(0xaaaa, even, odd);
+    }
+    static vec min(vec a, vec b) { return _mm512_min_epu32(a, b); }
+    static vec rotl(vec a, vec b) { return _mm512_rolv_epi32(a, b); }
+    static vec rotr(vec a, vec b) { return _mm512_rorv_epi32(a, b); }
+    static vec rotl_n(vec a, uint32_t n) { return _mm512_rolv_epi32(a, set1(n)); }
+    static vec rotr_n(vec a, uint32_t n) { return _mm512_rorv_epi32(a, set1(n)); }
+    static vec bit_and(vec a, vec b) { return _mm512_and_si512(a, b); }
+    static vec bit_or(vec a, vec b) { return _mm512_or_si512(a, b); }
+    static vec bit_xor(vec a, vec b) { return _mm512_xor_si512(a, b); }
+    static vec gather(const uint32_t* base, vec index)
+    {
+        return _mm512_i32gather_epi32(index, base, 4);
+    }
+};
 
-    // 2nd subsequent 8 words are carried from digest/mix
-    for (int i = 8; i < 16; i++)
-        state[i] = mix_hash.word32s[i-8];
+#include "algomodule/meraki/meraki/progpow_lanes.hpp"
+}  // namespace avx512_kernel
+#pragma GCC diagnostic pop
+#pragma GCC pop_options
+#endif
 
-    // 3rd apply ravencoin input constraints
-    for (int i = 16; i < 25; i++)
-        state[i] = ravencoin_kawpow[i - 16];
+struct mix_kernel
+{
+    const char* name;
+    hash_mix_fn hash_mix;
+    bool (*supported)();
+};
 
-    // Run keccak loop
-    keccak_progpow_256(state);
+/// In order of preference.
+const mix_kernel mix_kernels[] = {
+#if PROGPOW_X86_KERNELS
+    {"avx512", avx512_kernel::hash_mix, [] { return __builtin_cpu_supports("avx512f") != 0; }},
+    {"avx2", avx2_kernel::hash_mix, [] { return __builtin_cpu_supports("avx2") != 0; }},
+#endif
+    {"generic", generic_kernel::hash_mix, [] { return true; }},
+};
 
-    hash256 output;
-    for (int i = 0; i < 8; ++i)
-        output.word32s[i] = le::uint32(state[i]);
+std::atomic<const mix_kernel*> selected_kernel{nullptr};
 
-    return {output, mix_hash};
+const mix_kernel& best_kernel() 
+{
+    for (const auto& kernel : mix_kernels)
+    {
+        if (kernel.supported())
+            return kernel;
+    }
+    return mix_kernels[0];
 }
 
-result hash(const epoch_context_full& context, int block_number, const hash256& header_hash,
-    uint64_t nonce) 
+const mix_kernel& current_kernel() 
 {
-    static const auto lazy_lookup = [](const epoch_context& ctx, uint32_t index) 
+    const mix_kernel* kernel = selected_kernel.load(std::memory_order_relaxed);
+    if (!kernel)
     {
-        auto* full_dataset_1024 = static_cast<const epoch_context_full&>(ctx).full_dataset;
-        auto* full_dataset_2048 = reinterpret_cast<hash2048*>(full_dataset_1024);
-        hash2048& item = full_dataset_2048[index];
-        if (item.word64s[0] == 0)
-        {
-            // TODO: Copy elision here makes it thread-safe?
-            item = calculate_dataset_item_2048(ctx, index);
-        }
+        kernel = &best_kernel();
+        selected_kernel.store(kernel, std::memory_order_relaxed);
+    }
+    return *kernel;
+}
 
-        return item;
-    };
+struct period_program
+{
+    int period = std::numeric_limits<int>::min();
+    mix_program program;
+};
 
-    uint32_t hash_seed[2];  // KISS99 initiator
+/// Each thread keeps the programs of the two periods it hashed most recently,
+/// so that shares straddling a period boundary never recompile one.
+thread_local period_program thread_local_programs[2];
 
-    uint32_t state2[8];
+/// Moves the program of period to the front of the thread's pair, compiling
+/// it if the thread has neither.
+///
+/// This function is on the slow path. It's separated to allow inlining the fast
+/// path.
+ATTRIBUTE_NOINLINE void update_local_program(int period) 
+{
+    auto& local = thread_local_programs;
+    std::swap(local[0], local[1]);
+    if (local[0].period == period)
+        return;
 
-    {
-        uint32_t state[25] = {0x0};     // Keccak's state
+    local[0].program = make_mix_program(period);
+    local[0].period = period;
+}
 
-        // Absorb phase for initial round of keccak
-        // 1st fill with header data (8 words)
-        for (int i = 0; i < 8; i++)
-            state[i] = header_hash.word32s[i];
+inline const mix_program& get_mix_program(int block_number) 
+{
+    const int period = block_number / period_length;
+    if (thread_local_programs[0].period != period)
+        update_local_program(period);
+    return thread_local_programs[0].program;
+}
 
-        // 2nd fill with nonce (2 words)
-        state[8] = (uint32_t)nonce;
-        state[9] = (uint32_t)(nonce >> 32);
+hash256 hash_mix(
+    const epoch_context& context, int block_number, uint32_t * seed, lookup_fn lookup) 
+{
+    const uint32_t seeds[1][2] = {{seed[0], seed[1]}};
+    hash256 mix_hash;
+    current_kernel().hash_mix(context, get_mix_program(block_number), seeds, 1, lookup, &mix_hash);
+    return mix_hash;
+}
 
-        // 3rd apply ravencoin input constraints
-        for (int i = 10; i < 25; i++)
-            state[i] = ravencoin_kawpow[i-10];
+/// Looks up an item of the full dataset, generating and storing it first if
+/// no thread has yet.
+hash2048 lookup_dataset_pair(const epoch_context& ctx, uint32_t index) 
+{
+    const auto& context = static_cast<const epoch_context_full&>(ctx);
+    if (const hash2048* item = find_dataset_pair(context, index))
+        return *item;
+    return fill_dataset_pair(context, index);
+}
 
-        keccak_progpow_64(state);
+/// The initial Keccak of hash(): its first 8 words, of which the first two
+/// seed the mix.
+void keccak_header(const hash256& header_hash, uint64_t nonce, uint32_t* state2) 
+{
+    uint32_t state[25] = {0x0};     // Keccak's state
 
-        for (int i = 0; i < 8; i++)
-            state2[i] = state[i];
-    }
+    // Header data, the nonce and then the ravencoin input constraints.
+    for (int i = 0; i < 8; i++)
+        state[i] = header_hash.word32s[i];
+    state[8] = (uint32_t)nonce;
+    state[9] = (uint32_t)(nonce >> 32);
+    for (int i = 10; i < 25; i++)
+        state[i] = ravencoin_kawpow[i - 10];
 
-    hash_seed[0] = state2[0];
-    hash_seed[1] = state2[1];
+    keccak_progpow_64(state);
 
-    const hash256 mix_hash = hash_mix(context, block_number, hash_seed, lazy_lookup);
+    for (int i = 0; i < 8; i++)
+        state2[i] = state[i];
+}
 
+/// The final Keccak of hash() over the initial one and the mix hash.
+hash256 keccak_final(const uint32_t* state2, const hash256& mix_hash) 
+{
     uint32_t state[25] = {0x0};     // Keccak's state
 
-    // Absorb phase for last round of keccak (256 bits)
-    // 1st initial 8 words of state are kept as carry-over from initial keccak
+    // The carry-over from the initial Keccak, the mix hash and then the
+    // ravencoin input constraints.
     for (int i = 0; i < 8; i++)
         state[i] = state2[i];
-
-    // 2nd subsequent 8 words are carried from digest/mix
     for (int i = 8; i < 16; i++)
-        state[i] = mix_hash.word32s[i-8];
-
-    // 3rd apply ravencoin input constraints
+        state[i] = mix_hash.word32s[i - 8];
     for (int i = 16; i < 25; i++)
         state[i] = ravencoin_kawpow[i - 16];
 
-    // Run keccak loop
     keccak_progpow_256(state);
 
     hash256 output;
     for (int i = 0; i < 8; ++i)
         output.word32s[i] = le::uint32(state[i]);
-
-    return {output, mix_hash};
+    return output;
 }
 
-bool verify(const epoch_context& context, int block_number, const hash256& header_hash,
-    const hash256& mix_hash, uint64_t nonce, const hash256& boundary) 
+/// Searches [start_nonce, start_nonce + iterations) on num_threads threads and
+/// returns the lowest nonce whose final hash is within boundary, as the
+/// single-threaded search does.
+///
+/// Threads take runs of nonces in increasing order and hash max_interleaved of
+/// them at a time. Once a solution is found no new run is started, and the
+/// runs in progress stop at the solution's nonce: only they can hold a lower one.
+search_result search_threads(const epoch_context& context, int block_number,
+    const hash256& header_hash, const hash256& boundary, uint64_t start_nonce,
+    size_t iterations, int num_threads, lookup_fn lookup) 
 {
-    uint32_t hash_seed[2];  // KISS99 initiator
-    uint32_t state2[8];
+    static constexpr uint64_t chunk_size = 256;
+
+    std::atomic<uint64_t> next_offset{0};
+    std::atomic<uint64_t> found_offset{iterations};
+    std::mutex found_mutex;
+    search_result found;
+
+    // Searches one run; false when there is none left or a solution is known.
+    const auto search_chunk = [&]() -> bool {
+        if (found_offset.load(std::memory_order_relaxed) < iterations)
+            return false;
+        const uint64_t begin = next_offset.fetch_add(chunk_size, std::memory_order_relaxed);
+        if (begin >= iterations)
+            return false;
+        const uint64_t end = std::min<uint64_t>(begin + chunk_size, iterations);
+
+        const mix_program& program = get_mix_program(block_number);
+        const hash_mix_fn kernel_hash_mix = current_kernel().hash_mix;
+        for (uint64_t offset = begin; offset < end; offset += max_interleaved)
+        {
+            if (offset >= found_offset.load(std::memory_order_relaxed))
+                break;
+
+            const size_t count =
+                static_cast<size_t>(std::min<uint64_t>(max_interleaved, end - offset));
+            uint32_t state2[max_interleaved][8];
+            uint32_t seeds[max_interleaved][2];
+            hash256 mix_hashes[max_interleaved];
+            for (size_t k = 0; k < count; ++k)
+            {
+                keccak_header(header_hash, start_nonce + offset + k, state2[k]);
+                seeds[k][0] = state2[k][0];
+                seeds[k][1] = state2[k][1];
+            }
 
-    {
-        // Absorb phase for initial round of keccak
-        // 1st fill with header data (8 words)
-        uint32_t state[25] = {0x0};     // Keccak's state
-        for (int i = 0; i < 8; i++)
-            state[i] = header_hash.word32s[i];
+            kernel_hash_mix(context, program, seeds, count, lookup, mix_hashes);
 
-        // 2nd fill with nonce (2 words)
-        state[8] = (uint32_t)nonce;
-        state[9] = (uint32_t)(nonce >> 32);
+            for (size_t k = 0; k < count; ++k)
+            {
+                const hash256 final_hash = keccak_final(state2[k], mix_hashes[k]);
+                if (!is_less_or_equal(final_hash, boundary))
+                    continue;
+
+                std::lock_guard<std::mutex> lock{found_mutex};
+                if (offset + k < found_offset.load(std::memory_order_relaxed))
+                {
+                    found = {{final_hash, mix_hashes[k]}, start_nonce + offset + k};
+                    found_offset.store(offset + k, std::memory_order_relaxed);
+                }
+                break;
+            }
+        }
+        return true;
+    };
 
-        // 3rd apply ravencoin input constraints
-        for (int i = 10; i < 25; i++)
-            state[i] = ravencoin_kawpow[i-10];
+    if (num_threads <= 0)
+        num_threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
 
-        keccak_progpow_64(state);
+    std::vector<std::thread> workers;
+    for (int i = 1; i < num_threads; ++i)
+    {
+        try
+        {
+            workers.emplace_back([&search_chunk] {
+                while (search_chunk())
+                {
+                }
+            });
+        }
+        catch (const std::system_error&)
+        {
+            break;  // Carry on with the threads we have.
+        }
+    }
 
-        for (int i = 0; i < 8; i++)
-            state2[i] = state[i];
+    while (search_chunk())
+    {
     }
+    for (auto& worker : workers)
+        worker.join();
 
-    hash_seed[0] = state2[0];
-    hash_seed[1] = state2[1];
+    return found;
+}
+}  // namespace
 
-    uint32_t state[25] = {0x0};     // Keccak's state
+result hash(const epoch_context& context, int block_number, const hash256& header_hash,
+    uint64_t nonce) 
+{
+    uint32_t state2[8];
+    keccak_header(header_hash, nonce, state2);
 
-    // Absorb phase for last round of keccak (256 bits)
-    // 1st initial 8 words of state are kept as carry-over from initial keccak
-    for (int i = 0; i < 8; i++)
-        state[i] = state2[i];
+    uint32_t hash_seed[2] = {state2[0], state2[1]};  // KISS99 initiator
+    const hash256 mix_hash = hash_mix(context, block_number, hash_seed, calculate_dataset_item_2048);
 
+    return {keccak_final(state2, mix_hash), mix_hash};
+}
 
-    // 2nd subsequent 8 words are carried from digest/mix
-    for (int i = 8; i < 16; i++)
-        state[i] = mix_hash.word32s[i-8];
+result hash(const epoch_context_full& context, int block_number, const hash256& header_hash,
+    uint64_t nonce) 
+{
+    uint32_t state2[8];
+    keccak_header(header_hash, nonce, state2);
 
-    // 3rd apply ravencoin input constraints
-    for (int i = 16; i < 25; i++)
-        state[i] = ravencoin_kawpow[i - 16];
+    uint32_t hash_seed[2] = {state2[0], state2[1]};  // KISS99 initiator
+    const hash256 mix_hash = hash_mix(context, block_number, hash_seed, lookup_dataset_pair);
 
-    // Run keccak loop
-    keccak_progpow_256(state);
+    return {keccak_final(state2, mix_hash), mix_hash};
+}
 
-    hash256 output;
-    for (int i = 0; i < 8; ++i)
-        output.word32s[i] = le::uint32(state[i]);
-    if (!is_less_or_equal(output, boundary))
+bool verify(const epoch_context& context, int block_number, const hash256& header_hash,
+    const hash256& mix_hash, uint64_t nonce, const hash256& boundary) 
+{
+    uint32_t state2[8];
+    keccak_header(header_hash, nonce, state2);
+
+    if (!is_less_or_equal(keccak_final(state2, mix_hash), boundary))
         return false;
 
+    uint32_t hash_seed[2] = {state2[0], state2[1]};  // KISS99 initiator
     const hash256 expected_mix_hash =
         hash_mix(context, block_number, hash_seed, calculate_dataset_item_2048);
 
@@ -565,4 +709,43 @@ search_result search(const epoch_context_full& context, int block_number,
     return {};
 }
 
+search_result search_light(const epoch_context& context, int block_number,
+    const hash256& header_hash, const hash256& boundary, uint64_t start_nonce,
+    size_t iterations, int num_threads) 
+{
+    return search_threads(context, block_number, header_hash, boundary, start_nonce, iterations,
+        num_threads, calculate_dataset_item_2048);
+}
+
+search_result search(const epoch_context_full& context, int block_number,
+    const hash256& header_hash, const hash256& boundary, uint64_t start_nonce,
+    size_t iterations, int num_threads) 
+{
+    return search_threads(context, block_number, header_hash, boundary, start_nonce, iterations,
+        num_threads, lookup_dataset_pair);
+}
+
+const char* mix_backend() 
+{
+    return current_kernel().name;
+}
+
+bool set_mix_backend(const char* name) 
+{
+    if (std::strcmp(name, "auto") == 0)
+    {
+        selected_kernel.store(&best_kernel(), std::memory_order_relaxed);
+        return true;
+    }
+    for (const auto& kernel : mix_kernels)
+    {
+        if (std::strcmp(name, kernel.name) == 0 && kernel.supported())
+        {
+            selected_kernel.store(&kernel, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
 }  // namespace progpow
@@ -0,0 +1,216 @@
+// meraki: C/C++ implementation of Meraki, the Telestai Proof of Work algorithm.
+// Copyright 2018-2019 Pawel Bylica.
+// Licensed under the Apache License, Version 2.0.
+
+/// @file
+/// The ProgPoW mix computed on all lanes at once.
+///
+/// Included by progpow.cpp once per instruction set, each time inside a
+/// namespace of its own that defines `lanes`: a vector of `lanes::width`
+/// 32-bit lanes and the operations on it (load, store, set1, lane_index, add,
+/// mul, mul_hi, min, rotl, rotr, rotl_n, rotr_n, bit_and, bit_or, bit_xor and
+/// gather). progpow.cpp also provides mix_program and lookup_fn.
+///
+/// The mix is kept transposed: mix[r] holds register r of every lane, so a
+/// program step is one vector operation per lanes::width lanes. The selectors
+/// of a step are the same in every lane and are switched on once per step.
+///
+/// There is no include guard on purpose.
+
+using mix_rows = uint32_t[num_regs][num_lanes];
+
+/// Merges data(c) into the lanes c .. c + lanes::width - 1 of a, for every c.
+/// Assuming `a` has high entropy, only do ops that retain entropy even if the
+/// data has low entropy (i.e. do not do `a & data`).
+template <typename Data>
+inline void merge(uint32_t* a, uint32_t selector, const Data& data)
+{
+    const uint32_t x = (selector >> 16) % 31 + 1;  // Additional non-zero selector from higher bits.
+    const auto k = lanes::set1(33);
+    switch (selector % 4)
+    {
+    case 0:
+        for (size_t c = 0; c < num_lanes; c += lanes::width)
+            lanes::store(a + c, lanes::add(lanes::mul(lanes::load(a + c), k), data(c)));
+        break;
+    case 1:
+        for (size_t c = 0; c < num_lanes; c += lanes::width)
+            lanes::store(a + c, lanes::mul(lanes::bit_xor(lanes::load(a + c), data(c)), k));
+        break;
+    case 2:
+        for (size_t c = 0; c < num_lanes; c += lanes::width)
+            lanes::store(a + c, lanes::bit_xor(lanes::rotl_n(lanes::load(a + c), x), data(c)));
+        break;
+    case 3:
+        for (size_t c = 0; c < num_lanes; c += lanes::width)
+            lanes::store(a + c, lanes::bit_xor(lanes::rotr_n(lanes::load(a + c), x), data(c)));
+        break;
+    }
+}
+
+/// Lane by lane, for the operations without a vector instruction.
+template <typename Op>
+inline lanes::vec per_lane(const uint32_t* a, const uint32_t* b, const Op& op)
+{
+    alignas(64) uint32_t r[lanes::width];
+    for (size_t j = 0; j < lanes::width; ++j)
+        r[j] = op(a[j], b[j]);
+    return lanes::load(r);
+}
+
+inline void cache_step(const epoch_context& context, mix_rows& mix, const cache_op& op)
+{
+    const uint32_t* src = mix[op.src];
+    const auto mask = lanes::set1(l1_cache_num_items - 1);
+    merge(mix[op.dst], op.sel, [&](size_t c) {
+        return lanes::gather(context.l1_cache, lanes::bit_and(lanes::load(src + c), mask));
+    });
+}
+
+inline void math_step(mix_rows& mix, const math_op& op)
+{
+    const uint32_t* a = mix[op.src1];
+    const uint32_t* b = mix[op.src2];
+    uint32_t* dst = mix[op.dst];
+    switch (op.sel1 % 11)
+    {
+    default:
+    case 0:
+        merge(dst, op.sel2,
+            [&](size_t c) { return lanes::add(lanes::load(a + c), lanes::load(b + c)); });
+        break;
+    case 1:
+        merge(dst, op.sel2,
+            [&](size_t c) { return lanes::mul(lanes::load(a + c), lanes::load(b + c)); });
+        break;
+    case 2:
+        merge(dst, op.sel2,
+            [&](size_t c) { return lanes::mul_hi(lanes::load(a + c), lanes::load(b + c)); });
+        break;
+    case 3:
+        merge(dst, op.sel2,
+            [&](size_t c) { return lanes::min(lanes::load(a + c), lanes::load(b + c)); });
+        break;
+    case 4:
+        merge(dst, op.sel2,
+            [&](size_t c) { return lanes::rotl(lanes::load(a + c), lanes::load(b + c)); });
+        break;
+    case 5:
+        merge(dst, op.sel2,
+            [&](size_t c) { return lanes::rotr(lanes::load(a + c), lanes::load(b + c)); });
+        break;
+    case 6:
+        merge(dst, op.sel2,
+            [&](size_t c) { return lanes::bit_and(lanes::load(a + c), lanes::load(b + c)); });
+        break;
+    case 7:
+        merge(dst, op.sel2,
+            [&](size_t c) { return lanes::bit_or(lanes::load(a + c), lanes::load(b + c)); });
+        break;
+    case 8:
+        merge(dst, op.sel2,
+            [&](size_t c) { return lanes::bit_xor(lanes::load(a + c), lanes::load(b + c)); });
+        break;
+    case 9:
+        merge(dst, op.sel2, [&](size_t c) {
+            return per_lane(a + c, b + c,
+                [](uint32_t x, uint32_t y) { return clz32(x) + clz32(y); });
+        });
+        break;
+    case 10:
+        merge(dst, op.sel2, [&](size_t c) {
+            return per_lane(a + c, b + c,
+                [](uint32_t x, uint32_t y) { return popcount32(x) + popcount32(y); });
+        });
+        break;
+    }
+}
+
+inline void round(
+    const epoch_context& context, uint32_t r, mix_rows& mix, const mix_program& program,
+    const hash2048& item)
+{
+    for (int i = 0; i < max_operations; ++i)
+    {
+        if (i < num_cache_accesses)
+            cache_step(context, mix, program.cache[i]);
+        if (i < num_math_operations)
+            math_step(mix, program.math[i]);
+    }
+
+    // Lane l merges the words of slice (l ^ r) % num_lanes of the item.
+    const auto slice_mask = lanes::set1(num_lanes - 1);
+    const auto slice_size = lanes::set1(num_dag_words);
+    for (size_t i = 0; i < num_dag_words; ++i)
+    {
+        merge(mix[program.dag_dst[i]], program.dag_sel[i], [&](size_t c) {
+            const auto slice =
+                lanes::bit_and(lanes::bit_xor(lanes::lane_index(c), lanes::set1(r)), slice_mask);
+            const auto offset = lanes::add(lanes::mul(slice, slice_size), lanes::set1(i));
+            return lanes::gather(item.word32s, offset);
+        });
+    }
+}
+
+inline void init_mix(mix_rows& mix, const uint32_t* hash_seed)
+{
+    const uint32_t z = fnv1a(fnv_offset_basis, hash_seed[0]);
+    const uint32_t w = fnv1a(z, hash_seed[1]);
+    for (uint32_t l = 0; l < num_lanes; ++l)
+    {
+        const uint32_t jsr = fnv1a(w, l);
+        const uint32_t jcong = fnv1a(jsr, l);
+        kiss99 rng{z, w, jsr, jcong};
+
+        for (uint32_t i = 0; i < num_regs; ++i)
+            mix[i][l] = rng();
+    }
+}
+
+inline hash256 reduce_mix(const mix_rows& mix)
+{
+    // Reduce mix data to a single per-lane result.
+    alignas(64) uint32_t lane_hash[num_lanes];
+    const auto prime = lanes::set1(fnv_prime);
+    for (size_t c = 0; c < num_lanes; c += lanes::width)
+    {
+        auto h = lanes::set1(fnv_offset_basis);
+        for (uint32_t i = 0; i < num_regs; ++i)
+            h = lanes::mul(lanes::bit_xor(h, lanes::load(mix[i] + c)), prime);
+        lanes::store(lane_hash + c, h);
+    }
+
+    // Reduce all lanes to a single 256-bit result.
+    static constexpr size_t num_words = sizeof(hash256) / sizeof(uint32_t);
+    hash256 mix_hash;
+    for (uint32_t& word : mix_hash.word32s)
+        word = fnv_offset_basis;
+    for (size_t l = 0; l < num_lanes; ++l)
+        mix_hash.word32s[l % num_words] = fnv1a(mix_hash.word32s[l % num_words], lane_hash[l]);
+    return le::uint32s(mix_hash);
+}
+
+/// The mix hashes of count <= max_interleaved hash seeds, computed round by
+/// round together: the dataset lookups of a round are all made before its
+/// math, so that their memory latency overlaps.
+void hash_mix(const epoch_context& context, const mix_program& program,
+    const uint32_t (*hash_seeds)[2], size_t count, lookup_fn lookup, hash256* mix_hashes)
+{
+    alignas(64) mix_rows mix[max_interleaved];
+    hash2048 items[max_interleaved];
+
+    for (size_t k = 0; k < count; ++k)
+        init_mix(mix[k], hash_seeds[k]);
+
+    const uint32_t num_items = static_cast<uint32_t>(context.full_dataset_num_items / 2);
+    for (uint32_t r = 0; r < num_rounds; ++r)
+    {
+        for (size_t k = 0; k < count; ++k)
+            items[k] = lookup(context, mix[k][0][r % num_lanes] % num_items);
+        for (size_t k = 0; k < count; ++k)
+            round(context, r, mix[k], program, items[k]);
+    }
+
+    for (size_t k = 0; k < count; ++k)
+        mix_hashes[k] = reduce_mix(mix[k]);
+}
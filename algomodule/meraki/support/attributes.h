@@ -24,6 +24,18 @@
 #define ALWAYS_INLINE
 #endif
 
+/** [[noinline]] */
+#if _MSC_VER
+#define ATTRIBUTE_NOINLINE __declspec(noinline)
+#elif defined(__has_attribute)
+#if __has_attribute(noinline)
+#define ATTRIBUTE_NOINLINE __attribute__((noinline))
+#endif
+#endif
+#if !defined(ATTRIBUTE_NOINLINE)
+#define ATTRIBUTE_NOINLINE
+#endif
+
 /** [[no_sanitize()]] */
 #if __clang__
 #define NO_SANITIZE(sanitizer) \
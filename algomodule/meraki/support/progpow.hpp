@@ -47,4 +47,24 @@ search_result search(const epoch_context_full& context, int block_number,
     const hash256& header_hash, const hash256& boundary, uint64_t start_nonce,
     size_t iterations) ;
 
+/// Multi-threaded search_light() and search(): the range is split across
+/// num_threads threads (one per CPU if 0 or less), each hashing several
+/// nonces together, and the search stops once the lowest matching nonce is
+/// known. The result is the same as the single-threaded search's.
+search_result search_light(const epoch_context& context, int block_number,
+    const hash256& header_hash, const hash256& boundary, uint64_t start_nonce,
+    size_t iterations, int num_threads);
+
+search_result search(const epoch_context_full& context, int block_number,
+    const hash256& header_hash, const hash256& boundary, uint64_t start_nonce,
+    size_t iterations, int num_threads);
+
+/// The name of the ProgPoW mix implementation in use: "avx512", "avx2" or "generic".
+const char* mix_backend();
+
+/// Selects a mix implementation by name, or the fastest one the CPU supports
+/// for "auto". Returns false, changing nothing, if the name is unknown or the
+/// CPU lacks the instructions.
+bool set_mix_backend(const char* name);
+
 }  // namespace progpow
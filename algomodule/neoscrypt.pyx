@@ -2,11 +2,169 @@ from libc.stdint cimport uint32_t, int64_t, uint8_t, uint64_t
 from libc.stdlib cimport malloc, free
 from libc.string cimport memcpy
 
+cdef extern from "core/scratch.h":
+	ctypedef struct core_scratch:
+		size_t size;
+		int backing;
+	enum:
+		CORE_SCRATCH_HUGE
+		CORE_SCRATCH_HEAP
+		CORE_SCRATCH_THP
+		CORE_SCRATCH_HUGETLB
+	extern void core_scratch_init(core_scratch* s, int flags);
+	extern void core_scratch_free(core_scratch* s);
+	extern core_scratch* core_scratch_thread() nogil;
+
 cdef extern from "neoscrypt/neoscrypt.h":
-	extern void neoscrypt_hash(const unsigned char* input, unsigned char* output, uint32_t input_len);
+	extern int neoscrypt_hash_ctx(core_scratch* scratch, const unsigned char* input, unsigned char* output, uint32_t profile) nogil;
+	extern int neoscrypt_hash_many_ctx(core_scratch* scratch, const unsigned char* input, unsigned char* output, uint32_t profile, size_t count) nogil;
+	extern const char* neoscrypt_many_backend();
+	extern const char* neoscrypt_blake2s_backend();
+	extern const char* neoscrypt_core_backend();
+	enum:
+		NEOSCRYPT_KDF_AUTO
+		NEOSCRYPT_KDF_OPT
+		NEOSCRYPT_KDF_GENERIC
+	extern void neoscrypt_set_kdf(int kdf);
+	extern void neoscrypt_fastkdf_only(const unsigned char* password, unsigned char* output) nogil;
+
+
+# Standard NeoScrypt, and Scrypt(1024, 1, 1) with PBKDF2-HMAC-SHA256 as
+# Litecoin hashes it.
+PROFILE_NEOSCRYPT = 0x0;
+PROFILE_SCRYPT = 0x3;
+
+def custom_profile(N, r, salsa_only=False, sha256=False):
+	"""Extended profile for NeoScrypt(N, r, 1): ChaCha20/20 and Salsa20/20 with
+	FastKDF by default, Salsa20/8 only and PBKDF2-HMAC-SHA256 as requested."""
+	if N < 2 or N > 0x80000000 or N & (N - 1):
+		raise ValueError("N must be a power of 2 between 2 and 2**31");
+	if r < 1 or r > 128 or r & (r - 1):
+		raise ValueError("r must be a power of 2 between 1 and 128");
+	return (0x80000000 | ((N.bit_length() - 2) << 8) | ((r.bit_length() - 1) << 5)
+		| (0x2 if sha256 else 0) | (0x1 if salsa_only else 0));
+
+cdef _neoscrypt(core_scratch* scratch, hash, uint32_t profile):
+	cdef unsigned char output[32];
+	cdef int ret;
+	if len(hash) != 80:
+		raise ValueError("input must be 80 bytes");
+	cdef const unsigned char* input = hash;
+	with nogil:
+		if scratch == NULL:
+			scratch = core_scratch_thread();
+		ret = neoscrypt_hash_ctx(scratch, input, output, profile);
+	if ret:
+		raise MemoryError();
+	return output[:32];
 
-def _neoscrypt_hash(hash):
+cdef _neoscrypt_many(core_scratch* scratch, hashes, uint32_t profile):
+	hashes = list(hashes);
+	cdef size_t count = len(hashes);
+	cdef int ret;
+	if count == 0:
+		return [];
+	for h in hashes:
+		if len(h) != 80:
+			raise ValueError("all inputs must be 80 bytes");
+	cdef bytes data = b''.join(hashes);
+	cdef const unsigned char* input = data;
+	cdef unsigned char* output = <unsigned char*>malloc(count * 32);
+	if not output:
+		raise MemoryError();
+	try:
+		with nogil:
+			if scratch == NULL:
+				scratch = core_scratch_thread();
+			ret = neoscrypt_hash_many_ctx(scratch, input, output, profile, count);
+		if ret:
+			raise MemoryError();
+		result = output[:count * 32];
+	finally:
+		free(output);
+	return [result[i * 32:(i + 1) * 32] for i in range(count)];
+
+
+def _neoscrypt_hash(hash, profile=PROFILE_NEOSCRYPT):
+	return _neoscrypt(NULL, hash, profile);
+
+def _neoscrypt_hash_many(hashes, profile=PROFILE_NEOSCRYPT):
+	return _neoscrypt_many(NULL, hashes, profile);
+
+def _fastkdf_only(hash):
 	cdef unsigned char output[32];
-	cdef uint32_t input_len = len(hash);
-	neoscrypt_hash(hash, output, input_len);
-	return output[:32];
\ No newline at end of file
+	if len(hash) != 80:
+		raise ValueError("input must be 80 bytes");
+	cdef const unsigned char* input = hash;
+	with nogil:
+		neoscrypt_fastkdf_only(input, output);
+	return output[:32];
+
+def backend():
+	return neoscrypt_many_backend().decode();
+
+def core_backend():
+	return neoscrypt_core_backend().decode();
+
+def kdf_backend():
+	return neoscrypt_blake2s_backend().decode();
+
+_kdf_modes = {
+	'auto': NEOSCRYPT_KDF_AUTO,
+	'opt': NEOSCRYPT_KDF_OPT,
+	'generic': NEOSCRYPT_KDF_GENERIC,
+};
+
+def set_kdf(name):
+	"""Force the FastKDF ('opt' on scalar BLAKE2s, 'generic') or go back to 'auto'."""
+	if name not in _kdf_modes:
+		raise ValueError("unknown kdf %r" % (name,));
+	neoscrypt_set_kdf(_kdf_modes[name]);
+
+cdef class NeoScryptContext:
+	"""Owns a NeoScrypt scratchpad that is reused by every hash run through it.
+
+	The module-level functions use a per-thread scratchpad instead.  A
+	context is not shared between threads: calling it while another thread
+	is inside it raises RuntimeError.
+	"""
+	cdef core_scratch scratch
+	cdef bint busy
+
+	def __cinit__(self, huge_pages=False):
+		core_scratch_init(&self.scratch, CORE_SCRATCH_HUGE if huge_pages else 0);
+		self.busy = False;
+
+	def __dealloc__(self):
+		core_scratch_free(&self.scratch);
+
+	cdef _enter(self):
+		if self.busy:
+			raise RuntimeError("NeoScryptContext is in use by another thread");
+		self.busy = True;
+
+	def hash(self, header, profile=PROFILE_NEOSCRYPT):
+		self._enter();
+		try:
+			return _neoscrypt(&self.scratch, header, profile);
+		finally:
+			self.busy = False;
+
+	def hash_many(self, headers, profile=PROFILE_NEOSCRYPT):
+		self._enter();
+		try:
+			return _neoscrypt_many(&self.scratch, headers, profile);
+		finally:
+			self.busy = False;
+
+	@property
+	def size(self):
+		return self.scratch.size;
+
+	@property
+	def backing(self):
+		if self.scratch.backing == CORE_SCRATCH_HUGETLB:
+			return 'hugetlb';
+		if self.scratch.backing == CORE_SCRATCH_THP:
+			return 'thp';
+		return 'heap';
@@ -32,8 +32,28 @@
 #include <stdint.h>
 #include <string.h>
 
+#include "../core/cpu.h"
 #include "neoscrypt.h"
 
+#ifdef CORE_CPU_X86
+#include <immintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#define NEOSCRYPT_TARGET_SSE2  __attribute__((target("sse2")))
+#define NEOSCRYPT_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define NEOSCRYPT_TARGET_AVX512 \
+    __attribute__((target("avx512f,avx512vl")))
+#else
+#define NEOSCRYPT_TARGET_SSE2
+#define NEOSCRYPT_TARGET_SSE41
+#define NEOSCRYPT_TARGET_AVX512
+#endif
+#endif
+
+/* PBKDF2-HMAC-SHA256 for the Scrypt compatible profiles, e.g. 0x3 */
+#ifndef SHA256
+#define SHA256
+#endif
+
 #ifdef _WIN32
 #include <stdio.h>
 #define alloca(x) _alloca(x)
@@ -43,36 +63,7 @@
 
 /* SHA-256 */
 
-static const uint sha256_constants[64] = {
-    0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
-    0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
-    0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
-    0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
-    0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
-    0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
-    0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
-    0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
-};
-
-#define Ch(x,y,z)  (z ^ (x & (y ^ z)))
-#define Maj(x,y,z) (((x | y) & z) | (x & y))
-#define S0(x)      (ROTR32(x,  2) ^ ROTR32(x, 13) ^ ROTR32(x, 22))
-#define S1(x)      (ROTR32(x,  6) ^ ROTR32(x, 11) ^ ROTR32(x, 25))
-#define G0(x)      (ROTR32(x,  7) ^ ROTR32(x, 18) ^ (x >>  3))
-#define G1(x)      (ROTR32(x, 17) ^ ROTR32(x, 19) ^ (x >> 10))
-#define W0(in,i)   (U8TO32_BE(&in[i * 4]))
-#define W1(i)      (G1(w[i - 2]) + w[i - 7] + G0(w[i - 15]) + w[i - 16])
-#define STEP(i) \
-    t1 = S0(r[0]) + Maj(r[0], r[1], r[2]); \
-    t0 = r[7] + S1(r[4]) + Ch(r[4], r[5], r[6]) + sha256_constants[i] + w[i]; \
-    r[7] = r[6]; \
-    r[6] = r[5]; \
-    r[5] = r[4]; \
-    r[4] = r[3] + t0; \
-    r[3] = r[2]; \
-    r[2] = r[1]; \
-    r[1] = r[0]; \
-    r[0] = t0 + t1;
+#include "../core/sha256_transform.h"
 
 typedef struct sha256_hash_state_t {
     uint H[8];
@@ -82,28 +73,9 @@ typedef struct sha256_hash_state_t {
 } sha256_hash_state;
 
 static void sha256_blocks(sha256_hash_state *S, const uchar *in, uint blocks) {
-    uint r[8], w[64], t0, t1, i;
-
-    for(i = 0; i < 8; i++)
-      r[i] = S->H[i];
 
-    while(blocks--) {
-        for(i =  0; i < 16; i++) {
-            w[i] = W0(in, i);
-        }
-        for(i = 16; i < 64; i++) {
-            w[i] = W1(i);
-        }
-        for(i =  0; i < 64; i++) {
-            STEP(i);
-        }
-        for(i =  0; i <  8; i++) {
-            r[i] += S->H[i];
-            S->H[i] = r[i];
-        }
-        S->T += BLOCK_SIZE * 8;
-        in += BLOCK_SIZE;
-    }
+    sha256_transform(S->H, in, blocks);
+    S->T += (ullong)blocks * BLOCK_SIZE * 8;
 }
 
 static void neoscrypt_hash_init_sha256(sha256_hash_state *S) {
@@ -651,14 +623,12 @@ static void neoscrypt_chacha(uint *X, uint rounds) {
 #undef quarter
 }
 
-/* Fast 32-bit / 64-bit memcpy();
- * len must be a multiple of 32 bytes */
-static void neoscrypt_blkcpy(void *dstp, const void *srcp, uint len) {
-    size_t *dst = (size_t *) dstp;
-    size_t *src = (size_t *) srcp;
+/* Fast memcpy() of 32-bit words, which is how every block is typed;
+ * len must be a multiple of 16 bytes */
+static void neoscrypt_blkcpy(uint *dst, const uint *src, uint len) {
     uint i;
 
-    for(i = 0; i < (len / sizeof(size_t)); i += 4) {
+    for(i = 0; i < (len / sizeof(uint)); i += 4) {
         dst[i]     = src[i];
         dst[i + 1] = src[i + 1];
         dst[i + 2] = src[i + 2];
@@ -666,15 +636,13 @@ static void neoscrypt_blkcpy(void *dstp, const void *srcp, uint len) {
     }
 }
 
-/* Fast 32-bit / 64-bit block swapper;
- * len must be a multiple of 32 bytes */
-static void neoscrypt_blkswp(void *blkAp, void *blkBp, uint len) {
-    size_t *blkA = (size_t *) blkAp;
-    size_t *blkB = (size_t *) blkBp;
-    register size_t t0, t1, t2, t3;
+/* Fast block swapper of 32-bit words;
+ * len must be a multiple of 16 bytes */
+static void neoscrypt_blkswp(uint *blkA, uint *blkB, uint len) {
+    register uint t0, t1, t2, t3;
     uint i;
 
-    for(i = 0; i < (len / sizeof(size_t)); i += 4) {
+    for(i = 0; i < (len / sizeof(uint)); i += 4) {
         t0          = blkA[i];
         t1          = blkA[i + 1];
         t2          = blkA[i + 2];
@@ -690,14 +658,12 @@ static void neoscrypt_blkswp(void *blkAp, void *blkBp, uint len) {
     }
 }
 
-/* Fast 32-bit / 64-bit block XOR engine;
- * len must be a multiple of 32 bytes */
-static void neoscrypt_blkxor(void *dstp, const void *srcp, uint len) {
-    size_t *dst = (size_t *) dstp;
-    size_t *src = (size_t *) srcp;
+/* Fast block XOR engine of 32-bit words;
+ * len must be a multiple of 16 bytes */
+static void neoscrypt_blkxor(uint *dst, const uint *src, uint len) {
     uint i;
 
-    for(i = 0; i < (len / sizeof(size_t)); i += 4) {
+    for(i = 0; i < (len / sizeof(uint)); i += 4) {
         dst[i]     ^= src[i];
         dst[i + 1] ^= src[i + 1];
         dst[i + 2] ^= src[i + 2];
@@ -803,7 +769,7 @@ extern void blake2s_compress(blake2s_state *S);
 #else
 
 /* Buffer mixer (compressor) */
-static void blake2s_compress(blake2s_state *S) {
+static void blake2s_compress_generic(blake2s_state *S) {
     uint *v = (uint *) S->tempbuf;
     uint *m = (uint *) S->buf;
     register uint t0, t1, t2, t3;
@@ -2205,6 +2171,191 @@ static void blake2s_compress(blake2s_state *S) {
     S->h[7] ^= v[7] ^ v[15];
 }
 
+#ifdef CORE_CPU_X86
+
+/* BLAKE2s message schedule, each round ordered as the row-wise
+ * compressors load it: the first and second message words of the column
+ * step, then of the diagonal step */
+static const uchar blake2s_sigma_rows[10][16] = {
+    {  0,  2,  4,  6,  1,  3,  5,  7,  8, 10, 12, 14,  9, 11, 13, 15 },
+    { 14,  4,  9, 13, 10,  8, 15,  6,  1,  0, 11,  5, 12,  2,  7,  3 },
+    { 11, 12,  5, 15,  8,  0,  2, 13, 10,  3,  7,  9, 14,  6,  1,  4 },
+    {  7,  3, 13, 11,  9,  1, 12, 14,  2,  5,  4, 15,  6, 10,  0,  8 },
+    {  9,  5,  2, 10,  0,  7,  4, 15, 14, 11,  6,  3,  1, 12,  8, 13 },
+    {  2,  6,  0,  8, 12, 10, 11,  3,  4,  7, 15,  1, 13,  5, 14,  9 },
+    { 12,  1, 14,  4,  5, 15, 13, 10,  0,  6,  9,  8,  7,  3,  2, 11 },
+    { 13,  7, 12,  3, 11, 14,  1,  9,  5, 15,  8,  2,  0,  4,  6, 10 },
+    {  6, 14, 11,  0, 15,  9,  3,  8, 12, 13,  1, 10,  2,  7,  4,  5 },
+    { 10,  8,  7,  1,  2,  4,  6,  5, 15,  9,  3, 13, 11, 14, 12,  0 }
+};
+
+/* One state per 4 x 128-bit rows, the quarter-rounds of a step run
+ * side by side; rows 1 to 3 are rotated to reach the diagonals.  The
+ * includer supplies the four rotations */
+#define BLAKE2S_G(row0, row1, row2, row3, buf, ror16, ror12, ror8, ror7) \
+    row0 = _mm_add_epi32(_mm_add_epi32(row0, (buf)[0]), row1); \
+    row3 = ror16(_mm_xor_si128(row3, row0)); \
+    row2 = _mm_add_epi32(row2, row3); \
+    row1 = ror12(_mm_xor_si128(row1, row2)); \
+    row0 = _mm_add_epi32(_mm_add_epi32(row0, (buf)[1]), row1); \
+    row3 = ror8(_mm_xor_si128(row3, row0)); \
+    row2 = _mm_add_epi32(row2, row3); \
+    row1 = ror7(_mm_xor_si128(row1, row2));
+
+#define BLAKE2S_ROUND(row0, row1, row2, row3, buf, ror16, ror12, ror8, ror7) \
+    BLAKE2S_G(row0, row1, row2, row3, &(buf)[0], ror16, ror12, ror8, ror7) \
+    row1 = _mm_shuffle_epi32(row1, _MM_SHUFFLE(0, 3, 2, 1)); \
+    row2 = _mm_shuffle_epi32(row2, _MM_SHUFFLE(1, 0, 3, 2)); \
+    row3 = _mm_shuffle_epi32(row3, _MM_SHUFFLE(2, 1, 0, 3)); \
+    BLAKE2S_G(row0, row1, row2, row3, &(buf)[2], ror16, ror12, ror8, ror7) \
+    row1 = _mm_shuffle_epi32(row1, _MM_SHUFFLE(2, 1, 0, 3)); \
+    row2 = _mm_shuffle_epi32(row2, _MM_SHUFFLE(1, 0, 3, 2)); \
+    row3 = _mm_shuffle_epi32(row3, _MM_SHUFFLE(0, 3, 2, 1));
+
+/* The message words of round i, inserted one by one */
+#define BLAKE2S_LOAD(buf, m, i) \
+    for(j = 0; j < 4; j++) { \
+        const uchar *s = &blake2s_sigma_rows[i][4 * j]; \
+        buf[j] = _mm_insert_epi32(_mm_insert_epi32(_mm_insert_epi32( \
+          _mm_cvtsi32_si128((int) m[s[0]]), (int) m[s[1]], 1), \
+          (int) m[s[2]], 2), (int) m[s[3]], 3); \
+    }
+
+#define BLAKE2S_SSE41_ROR16(x) _mm_shuffle_epi8(x, rot16)
+#define BLAKE2S_SSE41_ROR8(x)  _mm_shuffle_epi8(x, rot8)
+#define BLAKE2S_SSE41_ROR12(x) \
+    _mm_or_si128(_mm_srli_epi32(x, 12), _mm_slli_epi32(x, 20))
+#define BLAKE2S_SSE41_ROR7(x) \
+    _mm_or_si128(_mm_srli_epi32(x, 7), _mm_slli_epi32(x, 25))
+
+/* SSE4.1: byte shuffles for the 16 and 8 bit rotations */
+NEOSCRYPT_TARGET_SSE41 static void blake2s_compress_sse41(blake2s_state *S) {
+    const __m128i rot16 = _mm_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5,
+      10, 11, 8, 9, 14, 15, 12, 13);
+    const __m128i rot8  = _mm_setr_epi8(1, 2, 3, 0, 5, 6, 7, 4,
+      9, 10, 11, 8, 13, 14, 15, 12);
+    const uint *m = (const uint *) S->buf;
+    __m128i row0, row1, row2, row3, h0, h1, buf[4];
+    uint i, j;
+
+    row0 = h0 = _mm_loadu_si128((const __m128i *) &S->h[0]);
+    row1 = h1 = _mm_loadu_si128((const __m128i *) &S->h[4]);
+    row2 = _mm_loadu_si128((const __m128i *) &blake2s_IV[0]);
+    row3 = _mm_xor_si128(_mm_loadu_si128((const __m128i *) &blake2s_IV[4]),
+      _mm_loadu_si128((const __m128i *) &S->t[0]));
+
+    for(i = 0; i < 10; i++) {
+        BLAKE2S_LOAD(buf, m, i)
+        BLAKE2S_ROUND(row0, row1, row2, row3, buf,
+          BLAKE2S_SSE41_ROR16, BLAKE2S_SSE41_ROR12,
+          BLAKE2S_SSE41_ROR8, BLAKE2S_SSE41_ROR7)
+    }
+
+    _mm_storeu_si128((__m128i *) &S->h[0],
+      _mm_xor_si128(h0, _mm_xor_si128(row0, row2)));
+    _mm_storeu_si128((__m128i *) &S->h[4],
+      _mm_xor_si128(h1, _mm_xor_si128(row1, row3)));
+}
+
+#define BLAKE2S_AVX512_ROR16(x) _mm_ror_epi32(x, 16)
+#define BLAKE2S_AVX512_ROR12(x) _mm_ror_epi32(x, 12)
+#define BLAKE2S_AVX512_ROR8(x)  _mm_ror_epi32(x, 8)
+#define BLAKE2S_AVX512_ROR7(x)  _mm_ror_epi32(x, 7)
+
+/* AVX-512VL: every rotation is a single vprord, which shortens the
+ * dependency chain a lone state is bound by */
+NEOSCRYPT_TARGET_AVX512 static void blake2s_compress_avx512(blake2s_state *S) {
+    const uint *m = (const uint *) S->buf;
+    __m128i row0, row1, row2, row3, h0, h1, buf[4];
+    uint i, j;
+
+    row0 = h0 = _mm_loadu_si128((const __m128i *) &S->h[0]);
+    row1 = h1 = _mm_loadu_si128((const __m128i *) &S->h[4]);
+    row2 = _mm_loadu_si128((const __m128i *) &blake2s_IV[0]);
+    row3 = _mm_xor_si128(_mm_loadu_si128((const __m128i *) &blake2s_IV[4]),
+      _mm_loadu_si128((const __m128i *) &S->t[0]));
+
+    for(i = 0; i < 10; i++) {
+        BLAKE2S_LOAD(buf, m, i)
+        BLAKE2S_ROUND(row0, row1, row2, row3, buf,
+          BLAKE2S_AVX512_ROR16, BLAKE2S_AVX512_ROR12,
+          BLAKE2S_AVX512_ROR8, BLAKE2S_AVX512_ROR7)
+    }
+
+    _mm_storeu_si128((__m128i *) &S->h[0],
+      _mm_xor_si128(h0, _mm_xor_si128(row0, row2)));
+    _mm_storeu_si128((__m128i *) &S->h[4],
+      _mm_xor_si128(h1, _mm_xor_si128(row1, row3)));
+}
+
+#undef BLAKE2S_G
+#undef BLAKE2S_ROUND
+#undef BLAKE2S_LOAD
+#undef BLAKE2S_SSE41_ROR16
+#undef BLAKE2S_SSE41_ROR12
+#undef BLAKE2S_SSE41_ROR8
+#undef BLAKE2S_SSE41_ROR7
+#undef BLAKE2S_AVX512_ROR16
+#undef BLAKE2S_AVX512_ROR12
+#undef BLAKE2S_AVX512_ROR8
+#undef BLAKE2S_AVX512_ROR7
+
+#endif /* CORE_CPU_X86 */
+
+struct blake2s_kernel {
+    void (*fn)(blake2s_state *S);
+    uint cpu;
+    const char *name;
+};
+
+/* Preferred first */
+static const struct blake2s_kernel blake2s_kernels[] = {
+#ifdef CORE_CPU_X86
+    { blake2s_compress_avx512, CPU_FEATURE_AVX512F | CPU_FEATURE_AVX512VL,
+      "avx512vl" },
+    { blake2s_compress_sse41, CPU_FEATURE_SSE41, "sse41" },
+#endif
+    { blake2s_compress_generic, 0, "scalar" },
+};
+
+#define BLAKE2S_NKERNELS (sizeof(blake2s_kernels) / sizeof(blake2s_kernels[0]))
+
+static const struct blake2s_kernel *blake2s_impl;
+
+static void blake2s_select(void) {
+    uint cpu = core_cpu_features();
+    uint i;
+
+    for(i = 0; (cpu & blake2s_kernels[i].cpu) != blake2s_kernels[i].cpu; i++);
+    /* Every thread resolves the same kernel, so the race is benign */
+    blake2s_impl = &blake2s_kernels[i];
+}
+
+static int neoscrypt_kdf_forced;
+
+static void blake2s_compress(blake2s_state *S) {
+
+    if(neoscrypt_kdf_forced != NEOSCRYPT_KDF_AUTO) {
+        blake2s_compress_generic(S);
+        return;
+    }
+    if(!blake2s_impl)
+      blake2s_select();
+    blake2s_impl->fn(S);
+}
+
+const char *neoscrypt_blake2s_backend(void) {
+
+    if(!blake2s_impl)
+      blake2s_select();
+    return(blake2s_impl->name);
+}
+
+void neoscrypt_set_kdf(int kdf) {
+
+    neoscrypt_kdf_forced = kdf;
+}
+
 #endif /* ASM */
 
 static void blake2s_update(blake2s_state *S, const uchar *input,
@@ -2277,8 +2428,6 @@ void neoscrypt_blake2s(const void *input, const uint input_size,
     neoscrypt_copy(output, S, output_size);
 }
 
-#ifndef OPT
-
 #define FASTKDF_BUFFER_SIZE 256U
 
 /* FastKDF, a fast buffered key derivation function:
@@ -2380,8 +2529,6 @@ void neoscrypt_fastkdf(const uchar *password, uint password_len,
 
 }
 
-#else
-
 #ifdef ASM
 
 extern void neoscrypt_fastkdf_opt(const uchar *password, const uchar *salt,
@@ -2481,8 +2628,6 @@ void neoscrypt_fastkdf_opt(const uchar *password, const uchar *salt,
 
 #endif /* ASM */
 
-#endif /* !(OPT) */
-
 
 #ifndef ASM
 
@@ -2558,6 +2703,207 @@ static void neoscrypt_blkmix(uint *X, uint *Y, uint r, uint mixmode) {
 }
 
 
+/* SMix for any N and r, the mixers picked by mixmode at run time */
+static void neoscrypt_core_generic(uint *X, uint *Z, uint *Y, uint *V,
+  uint N, uint r, uint dblmix, uint mixmode) {
+    uint i, j;
+
+    /* Process ChaCha 1st, Salsa 2nd and XOR them into FastKDF; otherwise Salsa only */
+
+    if(dblmix) {
+        /* blkcpy(Z, X) */
+        neoscrypt_blkcpy(&Z[0], &X[0], r * 2 * BLOCK_SIZE);
+
+        /* Z = SMix(Z) */
+        for(i = 0; i < N; i++) {
+            /* blkcpy(V, Z) */
+            neoscrypt_blkcpy(&V[i * (32 * r)], &Z[0], r * 2 * BLOCK_SIZE);
+            /* blkmix(Z, Y) */
+            neoscrypt_blkmix(&Z[0], &Y[0], r, (mixmode | 0x0100));
+        }
+
+        for(i = 0; i < N; i++) {
+            /* integerify(Z) mod N */
+            j = (32 * r) * (Z[16 * (2 * r - 1)] & (N - 1));
+            /* blkxor(Z, V) */
+            neoscrypt_blkxor(&Z[0], &V[j], r * 2 * BLOCK_SIZE);
+            /* blkmix(Z, Y) */
+            neoscrypt_blkmix(&Z[0], &Y[0], r, (mixmode | 0x0100));
+        }
+    }
+
+    /* X = SMix(X) */
+    for(i = 0; i < N; i++) {
+        /* blkcpy(V, X) */
+        neoscrypt_blkcpy(&V[i * (32 * r)], &X[0], r * 2 * BLOCK_SIZE);
+        /* blkmix(X, Y) */
+        neoscrypt_blkmix(&X[0], &Y[0], r, mixmode);
+    }
+    for(i = 0; i < N; i++) {
+        /* integerify(X) mod N */
+        j = (32 * r) * (X[16 * (2 * r - 1)] & (N - 1));
+        /* blkxor(X, V) */
+        neoscrypt_blkxor(&X[0], &V[j], r * 2 * BLOCK_SIZE);
+        /* blkmix(X, Y) */
+        neoscrypt_blkmix(&X[0], &Y[0], r, mixmode);
+    }
+
+    if(dblmix)
+      /* blkxor(X, Z) */
+      neoscrypt_blkxor(&X[0], &Z[0], r * 2 * BLOCK_SIZE);
+}
+
+#ifdef CORE_CPU_X86
+
+/* Salsa20 blocks to and from the shuffled order of the vector cores */
+static void neoscrypt_salsa_shuffle(uint *X, uint blocks) {
+    uint t[16], b, i;
+
+    for(b = 0; b < blocks; b++, X += 16) {
+        for(i = 0; i < 16; i++)
+          t[i] = X[(5 * i) & 15];
+        neoscrypt_copy(X, t, BLOCK_SIZE);
+    }
+}
+
+static void neoscrypt_salsa_unshuffle(uint *X, uint blocks) {
+    uint t[16], b, i;
+
+    for(b = 0; b < blocks; b++, X += 16) {
+        for(i = 0; i < 16; i++)
+          t[(5 * i) & 15] = X[i];
+        neoscrypt_copy(X, t, BLOCK_SIZE);
+    }
+}
+
+#endif /* CORE_CPU_X86 */
+
+/* SMix of the built-in profiles, specialised per instruction set */
+
+/* NeoScrypt(128, 2, 1) with Salsa20/20 and ChaCha20/20 */
+#define NS_CORE_N      128
+#define NS_CORE_R      2
+#define NS_CORE_DBLMIX 1
+#define NS_CORE_ROUNDS 20
+
+#ifdef CORE_CPU_X86
+#define NS_CORE_FN(name) neoscrypt_##name##_neoscrypt_avx512
+#define NS_CORE_TARGET   NEOSCRYPT_TARGET_AVX512
+#define NS_CORE_VEC      1
+#define VROTL(x, s)      _mm_rol_epi32(x, s)
+#include "neoscrypt_core.h"
+#undef NS_CORE_FN
+#undef NS_CORE_TARGET
+#undef NS_CORE_VEC
+#undef VROTL
+#endif
+
+#ifdef CORE_CPU_X86
+#define NS_CORE_FN(name) neoscrypt_##name##_neoscrypt_sse2
+#define NS_CORE_TARGET   NEOSCRYPT_TARGET_SSE2
+#define NS_CORE_VEC      1
+#define VROTL(x, s)      _mm_or_si128(_mm_slli_epi32(x, s), _mm_srli_epi32(x, 32 - (s)))
+#include "neoscrypt_core.h"
+#undef NS_CORE_FN
+#undef NS_CORE_TARGET
+#undef NS_CORE_VEC
+#undef VROTL
+#endif
+
+#define NS_CORE_FN(name) neoscrypt_##name##_neoscrypt_scalar
+#define NS_CORE_TARGET
+#define NS_CORE_VEC      0
+#include "neoscrypt_core.h"
+#undef NS_CORE_FN
+#undef NS_CORE_TARGET
+#undef NS_CORE_VEC
+
+#undef NS_CORE_N
+#undef NS_CORE_R
+#undef NS_CORE_DBLMIX
+#undef NS_CORE_ROUNDS
+
+/* Scrypt(1024, 1, 1) with Salsa20/8 */
+#define NS_CORE_N      1024
+#define NS_CORE_R      1
+#define NS_CORE_DBLMIX 0
+#define NS_CORE_ROUNDS 8
+
+#ifdef CORE_CPU_X86
+#define NS_CORE_FN(name) neoscrypt_##name##_scrypt_avx512
+#define NS_CORE_TARGET   NEOSCRYPT_TARGET_AVX512
+#define NS_CORE_VEC      1
+#define VROTL(x, s)      _mm_rol_epi32(x, s)
+#include "neoscrypt_core.h"
+#undef NS_CORE_FN
+#undef NS_CORE_TARGET
+#undef NS_CORE_VEC
+#undef VROTL
+#endif
+
+#ifdef CORE_CPU_X86
+#define NS_CORE_FN(name) neoscrypt_##name##_scrypt_sse2
+#define NS_CORE_TARGET   NEOSCRYPT_TARGET_SSE2
+#define NS_CORE_VEC      1
+#define VROTL(x, s)      _mm_or_si128(_mm_slli_epi32(x, s), _mm_srli_epi32(x, 32 - (s)))
+#include "neoscrypt_core.h"
+#undef NS_CORE_FN
+#undef NS_CORE_TARGET
+#undef NS_CORE_VEC
+#undef VROTL
+#endif
+
+#define NS_CORE_FN(name) neoscrypt_##name##_scrypt_scalar
+#define NS_CORE_TARGET
+#define NS_CORE_VEC      0
+#include "neoscrypt_core.h"
+#undef NS_CORE_FN
+#undef NS_CORE_TARGET
+#undef NS_CORE_VEC
+
+#undef NS_CORE_N
+#undef NS_CORE_R
+#undef NS_CORE_DBLMIX
+#undef NS_CORE_ROUNDS
+
+struct neoscrypt_cores {
+    void (*neoscrypt)(uint *X, uint *Z, uint *Y, uint *V);
+    void (*scrypt)(uint *X, uint *Z, uint *Y, uint *V);
+    uint cpu;
+    const char *name;
+};
+
+/* Preferred first */
+static const struct neoscrypt_cores neoscrypt_cores[] = {
+#ifdef CORE_CPU_X86
+    { neoscrypt_smix_neoscrypt_avx512, neoscrypt_smix_scrypt_avx512,
+      CPU_FEATURE_AVX512F | CPU_FEATURE_AVX512VL, "avx512vl" },
+    { neoscrypt_smix_neoscrypt_sse2, neoscrypt_smix_scrypt_sse2,
+      CPU_FEATURE_SSE2, "sse2" },
+#endif
+    { neoscrypt_smix_neoscrypt_scalar, neoscrypt_smix_scrypt_scalar,
+      0, "scalar" },
+};
+
+static const struct neoscrypt_cores *neoscrypt_core;
+
+static void neoscrypt_core_select(void) {
+    uint cpu = core_cpu_features();
+    uint i;
+
+    for(i = 0; (cpu & neoscrypt_cores[i].cpu) != neoscrypt_cores[i].cpu; i++);
+    /* Every thread resolves the same cores, so the race is benign */
+    neoscrypt_core = &neoscrypt_cores[i];
+}
+
+const char *neoscrypt_core_backend(void) {
+
+    if(!neoscrypt_core)
+      neoscrypt_core_select();
+    return(neoscrypt_core->name);
+}
+
+
 /* NeoScrypt core engine:
  * p = 1, salt = password;
  * Basic customisation (required):
@@ -2589,32 +2935,56 @@ static void neoscrypt_blkmix(uint *X, uint *Y, uint r, uint mixmode) {
  *     .....
  *     11110 = N of 2147483648;
  *   profile bits 30 to 13 are reserved */
-void neoscrypt_hash(const uchar *password, uchar *output, uint profile) {
-    const size_t stack_align = 0x40;
-    uint N = 128, r = 2, dblmix = 1, mixmode = 0x14;
-    uint kdf, i, j;
-    uint *X, *Y, *Z, *V;
+/* N and r of a profile */
+static void neoscrypt_params(uint profile, uint *N, uint *r) {
+
+    *N = 128;
+    *r = 2;
 
     if(profile & 0x1) {
-        N = 1024;        /* N = (1 << (Nfactor + 1)); */
-        r = 1;           /* r = (1 << rfactor); */
-        dblmix = 0;      /* Salsa only */
-        mixmode = 0x08;  /* 8 rounds */
+        *N = 1024;       /* N = (1 << (Nfactor + 1)); */
+        *r = 1;          /* r = (1 << rfactor); */
     }
 
     if(profile >> 31) {
-        N = (1 << (((profile >> 8) & 0x1F) + 1));
-        r = (1 << ((profile >> 5) & 0x7));
+        *N = (1U << (((profile >> 8) & 0x1F) + 1));
+        *r = (1U << ((profile >> 5) & 0x7));
+    }
+}
+
+/* Scratchpad size in bytes for a profile: X, Z, Y and V, which holds
+ * 2N blocks of X for the built-in double mix core as its ChaCha and Salsa
+ * SMix run in lockstep, N blocks otherwise (the generic SMix of extended
+ * profiles runs them one after the other); 0 if it does not fit in a
+ * size_t */
+size_t neoscrypt_scratch_size(uint profile) {
+    ullong blocks;
+    uint N, r;
+
+    neoscrypt_params(profile, &N, &r);
+    blocks = (ullong)N * ((!(profile & 0x1) && !(profile >> 31)) ? 2 : 1) + 3;
+    if(blocks > ((size_t)-1) / (r * 2 * BLOCK_SIZE))
+      return(0);
+    return((size_t)blocks * r * 2 * BLOCK_SIZE);
+}
+
+/* Hash into a caller provided scratchpad of neoscrypt_scratch_size(profile)
+ * bytes aligned to 64 */
+void neoscrypt_hash_sp(const uchar *password, uchar *output, uint profile,
+  void *scratchpad) {
+    uint N, r, dblmix = 1, mixmode = 0x14;
+    uint kdf;
+    uint *X, *Y, *Z, *V;
+
+    neoscrypt_params(profile, &N, &r);
+
+    if(profile & 0x1) {
+        dblmix = 0;      /* Salsa only */
+        mixmode = 0x08;  /* 8 rounds */
     }
 
-    // No VLAs with VC ;-(
-#ifndef _MSC_VER
-    uchar stack[(N + 3) * r * 2 * BLOCK_SIZE + stack_align];
-#else
-    uchar* stack = alloca((N + 3) * r * 2 * BLOCK_SIZE + stack_align);
-#endif
     /* X = r * 2 * BLOCK_SIZE */
-    X = (uint *) (((size_t)stack & ~(stack_align - 1)) + stack_align);
+    X = (uint *) scratchpad;
     /* Z is a copy of X for ChaCha */
     Z = &X[32 * r];
     /* Y is an X sized temporal space */
@@ -2629,12 +2999,18 @@ void neoscrypt_hash(const uchar *password, uchar *output, uint profile) {
 
         default:
         case(0x0):
-#ifdef OPT
-            neoscrypt_fastkdf_opt(password, password, (uchar *) X, 0);
-#else
+            /* The ring buffer FastKDF is laid out for r = 2 only */
+            if((r == 2) && (neoscrypt_kdf_forced != NEOSCRYPT_KDF_GENERIC)) {
+                neoscrypt_fastkdf_opt(password, password, (uchar *) X, 0);
+                break;
+            }
+            /* FastKDF fills at most FASTKDF_BUFFER_SIZE bytes; for r > 2
+             * the rest of X is defined as zero rather than left to whatever
+             * the reused scratchpad held */
+            if(r * 2 * BLOCK_SIZE > FASTKDF_BUFFER_SIZE)
+              neoscrypt_erase(X, r * 2 * BLOCK_SIZE);
             neoscrypt_fastkdf(password, 80, password, 80, 32,
               (uchar *) X, r * 2 * BLOCK_SIZE);
-#endif
             break;
 
 #ifdef SHA256
@@ -2653,61 +3029,27 @@ void neoscrypt_hash(const uchar *password, uchar *output, uint profile) {
 
     }
 
-    /* Process ChaCha 1st, Salsa 2nd and XOR them into FastKDF; otherwise Salsa only */
-
-    if(dblmix) {
-        /* blkcpy(Z, X) */
-        neoscrypt_blkcpy(&Z[0], &X[0], r * 2 * BLOCK_SIZE);
-
-        /* Z = SMix(Z) */
-        for(i = 0; i < N; i++) {
-            /* blkcpy(V, Z) */
-            neoscrypt_blkcpy(&V[i * (32 * r)], &Z[0], r * 2 * BLOCK_SIZE);
-            /* blkmix(Z, Y) */
-            neoscrypt_blkmix(&Z[0], &Y[0], r, (mixmode | 0x0100));
-        }
-
-        for(i = 0; i < N; i++) {
-            /* integerify(Z) mod N */
-            j = (32 * r) * (Z[16 * (2 * r - 1)] & (N - 1));
-            /* blkxor(Z, V) */
-            neoscrypt_blkxor(&Z[0], &V[j], r * 2 * BLOCK_SIZE);
-            /* blkmix(Z, Y) */
-            neoscrypt_blkmix(&Z[0], &Y[0], r, (mixmode | 0x0100));
-        }
-    }
-
-    /* X = SMix(X) */
-    for(i = 0; i < N; i++) {
-        /* blkcpy(V, X) */
-        neoscrypt_blkcpy(&V[i * (32 * r)], &X[0], r * 2 * BLOCK_SIZE);
-        /* blkmix(X, Y) */
-        neoscrypt_blkmix(&X[0], &Y[0], r, mixmode);
-    }
-    for(i = 0; i < N; i++) {
-        /* integerify(X) mod N */
-        j = (32 * r) * (X[16 * (2 * r - 1)] & (N - 1));
-        /* blkxor(X, V) */
-        neoscrypt_blkxor(&X[0], &V[j], r * 2 * BLOCK_SIZE);
-        /* blkmix(X, Y) */
-        neoscrypt_blkmix(&X[0], &Y[0], r, mixmode);
-    }
-
-    if(dblmix)
-      /* blkxor(X, Z) */
-      neoscrypt_blkxor(&X[0], &Z[0], r * 2 * BLOCK_SIZE);
+    /* X = SMix(X), specialised for the built-in profiles; extended ones
+     * take the generic SMix */
+    if(!neoscrypt_core)
+      neoscrypt_core_select();
+    if(profile >> 31)
+      neoscrypt_core_generic(X, Z, Y, V, N, r, dblmix, mixmode);
+    else if(dblmix)
+      neoscrypt_core->neoscrypt(X, Z, Y, V);
+    else
+      neoscrypt_core->scrypt(X, Z, Y, V);
 
     /* output = KDF(password, X) */
     switch(kdf) {
 
         default:
         case(0x0):
-#ifdef OPT
-            neoscrypt_fastkdf_opt(password, (uchar *) X, output, 1);
-#else
-            neoscrypt_fastkdf(password, 80, (uchar *) X,
-              r * 2 * BLOCK_SIZE, 32, output, 32);
-#endif
+            if((r == 2) && (neoscrypt_kdf_forced != NEOSCRYPT_KDF_GENERIC))
+              neoscrypt_fastkdf_opt(password, (uchar *) X, output, 1);
+            else
+              neoscrypt_fastkdf(password, 80, (uchar *) X,
+                r * 2 * BLOCK_SIZE, 32, output, 32);
             break;
 
 #ifdef SHA256
@@ -2728,546 +3070,41 @@ void neoscrypt_hash(const uchar *password, uchar *output, uint profile) {
 
 }
 
-#endif /* !(ASM) */
+/* Hash using scratch, which is grown to the profile's needs and kept for
+ * the next call; -1 if it can't be */
+int neoscrypt_hash_ctx(core_scratch *scratch, const uchar *password,
+  uchar *output, uint profile) {
+    size_t size = neoscrypt_scratch_size(profile);
+    void *scratchpad;
 
-
-#if defined(ASM) && defined(MINER_4WAY)
-
-extern void neoscrypt_xor_salsa_4way(uint *X, uint *X0, uint *Y, uint double_rounds);
-extern void neoscrypt_xor_chacha_4way(uint *Z, uint *Z0, uint *Y, uint double_rounds);
-
-#if (1)
-
-extern void neoscrypt_blkcpy(void *dstp, const void *srcp, uint len);
-extern void neoscrypt_blkswp(void *blkAp, void *blkBp, uint len);
-extern void neoscrypt_blkxor(void *dstp, const void *srcp, uint len);
-
-extern void neoscrypt_pack_4way(void *dstp, const void *srcp, uint len);
-extern void neoscrypt_unpack_4way(void *dstp, const void *srcp, uint len);
-extern void neoscrypt_xor_4way(void *dstp, const void *srcAp,
-  const void *srcBp, const void *srcCp, const void *srcDp, uint len);
-
-#else
-
-/* The following code is for reference only */
-
-static void neoscrypt_blkcpy(void *dstp, const void *srcp, uint len) {
-    size_t *dst = (size_t *) dstp;
-    size_t *src = (size_t *) srcp;
-    uint i;
-
-    for(i = 0; i < (len / sizeof(size_t)); i += 4) {
-        dst[i]     = src[i];
-        dst[i + 1] = src[i + 1];
-        dst[i + 2] = src[i + 2];
-        dst[i + 3] = src[i + 3];
-    }
-}
-
-static void neoscrypt_blkswp(void *blkAp, void *blkBp, uint len) {
-    size_t *blkA = (size_t *) blkAp;
-    size_t *blkB = (size_t *) blkBp;
-    register size_t t0, t1, t2, t3;
-    uint i;
-
-    for(i = 0; i < (len / sizeof(size_t)); i += 4) {
-        t0          = blkA[i];
-        t1          = blkA[i + 1];
-        t2          = blkA[i + 2];
-        t3          = blkA[i + 3];
-        blkA[i]     = blkB[i];
-        blkA[i + 1] = blkB[i + 1];
-        blkA[i + 2] = blkB[i + 2];
-        blkA[i + 3] = blkB[i + 3];
-        blkB[i]     = t0;
-        blkB[i + 1] = t1;
-        blkB[i + 2] = t2;
-        blkB[i + 3] = t3;
-    }
-}
-
-static void neoscrypt_blkxor(void *dstp, const void *srcp, uint len) {
-    size_t *dst = (size_t *) dstp;
-    size_t *src = (size_t *) srcp;
-    uint i;
-
-    for(i = 0; i < (len / sizeof(size_t)); i += 4) {
-        dst[i]     ^= src[i];
-        dst[i + 1] ^= src[i + 1];
-        dst[i + 2] ^= src[i + 2];
-        dst[i + 3] ^= src[i + 3];
-    }
-}
-
-
-static void neoscrypt_pack_4way(void *dstp, const void *srcp, uint len) {
-    uint *dst = (uint *) dstp;
-    uint *src = (uint *) srcp;
-    uint i, j;
-
-    len >>= 4;
-
-    for(i = 0, j = 0; j < len; i += 4, j++) {
-        dst[i]     = src[j];
-        dst[i + 1] = src[j + len];
-        dst[i + 2] = src[j + 2 * len];
-        dst[i + 3] = src[j + 3 * len];
-    }
-}
-
-static void neoscrypt_unpack_4way(void *dstp, const void *srcp, uint len) {
-    uint *dst = (uint *) dstp;
-    uint *src = (uint *) srcp;
-    uint i, j;
-
-    len >>= 4;
-
-    for(i = 0, j = 0; j < len; i += 4, j++) {
-        dst[j]           = src[i];
-        dst[j + len]     = src[i + 1];
-        dst[j + 2 * len] = src[i + 2];
-        dst[j + 3 * len] = src[i + 3];
-    }
-}
-
-static void neoscrypt_xor_4way(void *dstp, const void *srcAp,
-  const void *srcBp, const void *srcCp, const void *srcDp, uint len) {
-    uint *dst  = (uint *) dstp;
-    uint *srcA = (uint *) srcAp;
-    uint *srcB = (uint *) srcBp;
-    uint *srcC = (uint *) srcCp;
-    uint *srcD = (uint *) srcDp;
-    uint i;
-
-    for(i = 0; i < (len >> 2); i += 4) {
-        dst[i]     ^= srcA[i];
-        dst[i + 1] ^= srcB[i + 1];
-        dst[i + 2] ^= srcC[i + 2];
-        dst[i + 3] ^= srcD[i + 3];
-    }
-}
-
-#endif
-
-
-/* 4-way NeoScrypt(128, 2, 1) with Salsa20/20 and ChaCha20/20 */
-void neoscrypt_4way(const uchar *password, uchar *output, uchar *scratchpad) {
-    const uint N = 128, r = 2, double_rounds = 10;
-    uint *X, *Z, *V, *Y, *P;
-    uint i, j0, j1, j2, j3, k;
-
-    /* 2 * BLOCK_SIZE compacted to 128 below */;
-
-    /* Scratchpad size is 4 * ((N + 3) * r * 128 + 80) bytes */
-
-    X = (uint *) &scratchpad[0];
-    Z = &X[4 * 32 * r];
-    V = &X[4 * 64 * r];
-    /* Y is a temporary work space */
-    Y = &X[4 * (N + 2) * 32 * r];
-    /* P is a set of passwords 80 bytes each */
-    P = &X[4 * (N + 3) * 32 * r];
-
-    /* Load the password and increment nonces */
-    for(k = 0; k < 4; k++) {
-        neoscrypt_copy(&P[k * 20], password, 80);
-        P[(k + 1) * 20 - 1] += k;
-    }
-
-    neoscrypt_fastkdf_4way((uchar *) &P[0], (uchar *) &P[0], (uchar *) &Y[0],
-      (uchar *) &scratchpad[0], 0);
-
-    neoscrypt_pack_4way(&X[0], &Y[0], 4 * r * 128);
-
-    neoscrypt_blkcpy(&Z[0], &X[0], 4 * r * 128);
-
-    for(i = 0; i < N; i++) {
-        neoscrypt_blkcpy(&V[i * r * 128], &Z[0], 4 * r * 128);
-        neoscrypt_xor_chacha_4way(&Z[0], &Z[192], &Y[0], double_rounds);
-        neoscrypt_xor_chacha_4way(&Z[64], &Z[0], &Y[0], double_rounds);
-        neoscrypt_xor_chacha_4way(&Z[128], &Z[64], &Y[0], double_rounds);
-        neoscrypt_xor_chacha_4way(&Z[192], &Z[128], &Y[0], double_rounds);
-        neoscrypt_blkswp(&Z[64], &Z[128], r * 128);
-    }
-
-    for(i = 0; i < N; i++) {
-        j0 = (4 * r * 32) * (Z[64 * (2 * r - 1)] & (N - 1));
-        j1 = (4 * r * 32) * (Z[1 + (64 * (2 * r - 1))] & (N - 1));
-        j2 = (4 * r * 32) * (Z[2 + (64 * (2 * r - 1))] & (N - 1));
-        j3 = (4 * r * 32) * (Z[3 + (64 * (2 * r - 1))] & (N - 1));
-        neoscrypt_xor_4way(&Z[0],
-          &V[j0], &V[j1], &V[j2], &V[j3], 4 * r * 128);
-        neoscrypt_xor_chacha_4way(&Z[0], &Z[192], &Y[0], double_rounds);
-        neoscrypt_xor_chacha_4way(&Z[64], &Z[0], &Y[0], double_rounds);
-        neoscrypt_xor_chacha_4way(&Z[128], &Z[64], &Y[0], double_rounds);
-        neoscrypt_xor_chacha_4way(&Z[192], &Z[128], &Y[0], double_rounds);
-        neoscrypt_blkswp(&Z[64], &Z[128], 256);
-    }
-
-    for(i = 0; i < N; i++) {
-        neoscrypt_blkcpy(&V[i * r * 128], &X[0], 4 * r * 128);
-        neoscrypt_xor_salsa_4way(&X[0], &X[192], &Y[0], double_rounds);
-        neoscrypt_xor_salsa_4way(&X[64], &X[0], &Y[0], double_rounds);
-        neoscrypt_xor_salsa_4way(&X[128], &X[64], &Y[0], double_rounds);
-        neoscrypt_xor_salsa_4way(&X[192], &X[128], &Y[0], double_rounds);
-        neoscrypt_blkswp(&X[64], &X[128], r * 128);
-    }
-
-    for(i = 0; i < N; i++) {
-        j0 = (4 * r * 32) * (X[64 * (2 * r - 1)] & (N - 1));
-        j1 = (4 * r * 32) * (X[1 + (64 * (2 * r - 1))] & (N - 1));
-        j2 = (4 * r * 32) * (X[2 + (64 * (2 * r - 1))] & (N - 1));
-        j3 = (4 * r * 32) * (X[3 + (64 * (2 * r - 1))] & (N - 1));
-        neoscrypt_xor_4way(&X[0],
-          &V[j0], &V[j1], &V[j2], &V[j3], 4 * r * 128);
-        neoscrypt_xor_salsa_4way(&X[0], &X[192], &Y[0], double_rounds);
-        neoscrypt_xor_salsa_4way(&X[64], &X[0], &Y[0], double_rounds);
-        neoscrypt_xor_salsa_4way(&X[128], &X[64], &Y[0], double_rounds);
-        neoscrypt_xor_salsa_4way(&X[192], &X[128], &Y[0], double_rounds);
-        neoscrypt_blkswp(&X[64], &X[128], r * 128);
-    }
-
-    neoscrypt_blkxor(&X[0], &Z[0], 4 * r * 128);
-
-    neoscrypt_unpack_4way(&Y[0], &X[0], 4 * r * 128);
-
-    neoscrypt_fastkdf_4way((uchar *) &P[0], (uchar *) &Y[0], (uchar *) &output[0],
-      (uchar *) &scratchpad[0], 1);
-}
-
-#ifdef SHA256
-/* 4-way Scrypt(1024, 1, 1) with Salsa20/8 */
-void scrypt_4way(const uchar *password, uchar *output, uchar *scratchpad) {
-    const uint N = 1024, r = 1, double_rounds = 4;
-    uint *X, *V, *Y, *P;
-    uint i, j0, j1, j2, j3, k;
-
-    /* Scratchpad size is 4 * ((N + 2) * r * 128 + 80) bytes */
-
-    X = (uint *) &scratchpad[0];
-    V = &X[4 * 32 * r];
-    Y = &X[4 * (N + 1) * 32 * r];
-    P = &X[4 * (N + 2) * 32 * r];
-
-    for(k = 0; k < 4; k++) {
-        neoscrypt_copy(&P[k * 20], password, 80);
-        P[(k + 1) * 20 - 1] += k;
-    }
-
-    for(k = 0; k < 4; k++)
-      neoscrypt_pbkdf2_sha256((uchar *) &P[k * 20], 80,
-        (uchar *) &P[k * 20], 80, 1,
-        (uchar *) &Y[k * r * 32], r * 128);
-
-    neoscrypt_pack_4way(&X[0], &Y[0], 4 * r * 128);
-
-    for(i = 0; i < N; i++) {
-        neoscrypt_blkcpy(&V[i * r * 128], &X[0], 4 * r * 128);
-        neoscrypt_xor_salsa_4way(&X[0], &X[64], &Y[0], double_rounds);
-        neoscrypt_xor_salsa_4way(&X[64], &X[0], &Y[0], double_rounds);
-    }
-
-    for(i = 0; i < N; i++) {
-        j0 = (4 * r * 32) * (X[64 * (2 * r - 1)] & (N - 1));
-        j1 = (4 * r * 32) * (X[1 + (64 * (2 * r - 1))] & (N - 1));
-        j2 = (4 * r * 32) * (X[2 + (64 * (2 * r - 1))] & (N - 1));
-        j3 = (4 * r * 32) * (X[3 + (64 * (2 * r - 1))] & (N - 1));
-        neoscrypt_xor_4way(&X[0],
-          &V[j0], &V[j1], &V[j2], &V[j3], 4 * r * 128);
-        neoscrypt_xor_salsa_4way(&X[0], &X[64], &Y[0], double_rounds);
-        neoscrypt_xor_salsa_4way(&X[64], &X[0], &Y[0], double_rounds);
-    }
-
-    neoscrypt_unpack_4way(&Y[0], &X[0], 4 * r * 128);
-
-    for(k = 0; k < 4; k++)
-      neoscrypt_pbkdf2_sha256((uchar *) &P[k * 20], 80,
-        (uchar *) &Y[k * r * 32], r * 128, 1,
-        (uchar *) &output[k * 32], 32);
+    if(!scratch || !size || !(scratchpad = core_scratch_get(scratch, size)))
+      return(-1);
+    neoscrypt_hash_sp(password, output, profile, scratchpad);
+    return(0);
 }
-#endif /* SHA256 */
-
-
-extern void blake2s_compress_4way(void *T);
 
-/* 4-way initialisation vector with a parameter block XOR'ed in */
-static const uint blake2s_IV_P_XOR_4way[32] = {
-    0x6B08C647, 0x6B08C647, 0x6B08C647, 0x6B08C647,
-    0xBB67AE85, 0xBB67AE85, 0xBB67AE85, 0xBB67AE85,
-    0x3C6EF372, 0x3C6EF372, 0x3C6EF372, 0x3C6EF372,
-    0xA54FF53A, 0xA54FF53A, 0xA54FF53A, 0xA54FF53A,
-    0x510E527F, 0x510E527F, 0x510E527F, 0x510E527F,
-    0x9B05688C, 0x9B05688C, 0x9B05688C, 0x9B05688C,
-    0x1F83D9AB, 0x1F83D9AB, 0x1F83D9AB, 0x1F83D9AB,
-    0x5BE0CD19, 0x5BE0CD19, 0x5BE0CD19, 0x5BE0CD19
-};
-
-/* 4-way BLAKE2s implementation */
-void neoscrypt_blake2s_4way(const uchar *input, const uchar *key, uchar *output) {
-    const size_t stack_align = 0x40;
-    uint *T;
-
-    /* Align and set up the buffer in stack */
-    uchar stack[704 + stack_align];
-    T = (uint *) (((size_t)stack & ~(stack_align - 1)) + stack_align);
+/* Hash using the calling thread's scratch area */
+void neoscrypt_hash(const uchar *password, uchar *output, uint profile) {
 
-    /* Initialise */
-    neoscrypt_copy(&T[0], blake2s_IV_P_XOR_4way, 128);
-    neoscrypt_erase(&T[32], 64);
-
-    /* Update keys */
-    neoscrypt_pack_4way(&T[48], &key[0], 128);
-    neoscrypt_erase(&T[80], 128);
-
-    /* Compress IVs using keys */
-    T[32] = 64;
-    T[33] = 64;
-    T[34] = 64;
-    T[35] = 64;
-    blake2s_compress_4way(&T[0]);
-
-    /* Update inputs */
-    neoscrypt_pack_4way(&T[48], &input[0], 256);
-
-    /* Compress using inputs */
-    T[32] = 128;
-    T[33] = 128;
-    T[34] = 128;
-    T[35] = 128;
-    T[40] = ~0U;
-    T[41] = ~0U;
-    T[42] = ~0U;
-    T[43] = ~0U;
-    blake2s_compress_4way(&T[0]);
-
-    neoscrypt_unpack_4way(&output[0], &T[0], 128);
+    if(neoscrypt_hash_ctx(core_scratch_thread(), password, output, profile))
+      abort();
 }
 
+/* Both FastKDF passes of the default profile with SMix left out, as
+ * selected by neoscrypt_set_kdf(); for timing the KDF on its own */
+void neoscrypt_fastkdf_only(const uchar *password, uchar *output) {
+    uint X[64];
 
-/* 4-way FastKDF with BLAKE2s integrated */
-void neoscrypt_fastkdf_4way(const uchar *password, const uchar *salt,
-  uchar *output, uchar *scratchpad, uint mode) {
-    uint bufptr_a = 0, bufptr_b = 0, bufptr_c = 0, bufptr_d = 0;
-    uint output_len, i, j;
-    uint *T;
-    uchar *Aa, *Ab, *Ac, *Ad;
-    uchar *Ba, *Bb, *Bc, *Bd;
-
-    T = (uint *) &scratchpad[0];
-    Aa = (uchar *) &T[176];
-    Ab = (uchar *) &T[256];
-    Ac = (uchar *) &T[336];
-    Ad = (uchar *) &T[416];
-    Ba = (uchar *) &T[496];
-    Bb = (uchar *) &T[568];
-    Bc = (uchar *) &T[640];
-    Bd = (uchar *) &T[712];
-
-    neoscrypt_copy(&Aa[0],   &password[0], 80);
-    neoscrypt_copy(&Aa[80],  &password[0], 80);
-    neoscrypt_copy(&Aa[160], &password[0], 80);
-    neoscrypt_copy(&Aa[240], &password[0], 16);
-    neoscrypt_copy(&Aa[256], &password[0], 64);
-    neoscrypt_copy(&Ab[0],   &password[80], 80);
-    neoscrypt_copy(&Ab[80],  &password[80], 80);
-    neoscrypt_copy(&Ab[160], &password[80], 80);
-    neoscrypt_copy(&Ab[240], &password[80], 16);
-    neoscrypt_copy(&Ab[256], &password[80], 64);
-    neoscrypt_copy(&Ac[0],   &password[160], 80);
-    neoscrypt_copy(&Ac[80],  &password[160], 80);
-    neoscrypt_copy(&Ac[160], &password[160], 80);
-    neoscrypt_copy(&Ac[240], &password[160], 16);
-    neoscrypt_copy(&Ac[256], &password[160], 64);
-    neoscrypt_copy(&Ad[0],   &password[240], 80);
-    neoscrypt_copy(&Ad[80],  &password[240], 80);
-    neoscrypt_copy(&Ad[160], &password[240], 80);
-    neoscrypt_copy(&Ad[240], &password[240], 16);
-    neoscrypt_copy(&Ad[256], &password[240], 64);
-
-    if(!mode) {
-        output_len = 256;
-        neoscrypt_copy(&Ba[0],   &salt[0], 80);
-        neoscrypt_copy(&Ba[80],  &salt[0], 80);
-        neoscrypt_copy(&Ba[160], &salt[0], 80);
-        neoscrypt_copy(&Ba[240], &salt[0], 16);
-        neoscrypt_copy(&Ba[256], &salt[0], 32);
-        neoscrypt_copy(&Bb[0],   &salt[80], 80);
-        neoscrypt_copy(&Bb[80],  &salt[80], 80);
-        neoscrypt_copy(&Bb[160], &salt[80], 80);
-        neoscrypt_copy(&Bb[240], &salt[80], 16);
-        neoscrypt_copy(&Bb[256], &salt[80], 32);
-        neoscrypt_copy(&Bc[0],   &salt[160], 80);
-        neoscrypt_copy(&Bc[80],  &salt[160], 80);
-        neoscrypt_copy(&Bc[160], &salt[160], 80);
-        neoscrypt_copy(&Bc[240], &salt[160], 16);
-        neoscrypt_copy(&Bc[256], &salt[160], 32);
-        neoscrypt_copy(&Bd[0],   &salt[240], 80);
-        neoscrypt_copy(&Bd[80],  &salt[240], 80);
-        neoscrypt_copy(&Bd[160], &salt[240], 80);
-        neoscrypt_copy(&Bd[240], &salt[240], 16);
-        neoscrypt_copy(&Bd[256], &salt[240], 32);
+    if(neoscrypt_kdf_forced != NEOSCRYPT_KDF_GENERIC) {
+        neoscrypt_fastkdf_opt(password, password, (uchar *) X, 0);
+        neoscrypt_fastkdf_opt(password, (uchar *) X, output, 1);
     } else {
-        output_len = 32;
-        neoscrypt_copy(&Ba[0],   &salt[0], 256);
-        neoscrypt_copy(&Ba[256], &salt[0], 32);
-        neoscrypt_copy(&Bb[0],   &salt[256], 256);
-        neoscrypt_copy(&Bb[256], &salt[256], 32);
-        neoscrypt_copy(&Bc[0],   &salt[512], 256);
-        neoscrypt_copy(&Bc[256], &salt[512], 32);
-        neoscrypt_copy(&Bd[0],   &salt[768], 256);
-        neoscrypt_copy(&Bd[256], &salt[768], 32);
+        neoscrypt_fastkdf(password, 80, password, 80, 32, (uchar *) X, 256);
+        neoscrypt_fastkdf(password, 80, (uchar *) X, 256, 32, output, 32);
     }
-
-    for(i = 0; i < 32; i++) {
-
-        /* BLAKE2s: initialise */
-        neoscrypt_copy(&T[0], blake2s_IV_P_XOR_4way, 128);
-        neoscrypt_erase(&T[32], 64);
-
-        /* BLAKE2s: update keys */
-        for(j = 0; j < 32; j += 8) {
-            T[j + 48] = *((uint *) &Ba[bufptr_a + j]);
-            T[j + 49] = *((uint *) &Bb[bufptr_b + j]);
-            T[j + 50] = *((uint *) &Bc[bufptr_c + j]);
-            T[j + 51] = *((uint *) &Bd[bufptr_d + j]);
-            T[j + 52] = *((uint *) &Ba[bufptr_a + j + 4]);
-            T[j + 53] = *((uint *) &Bb[bufptr_b + j + 4]);
-            T[j + 54] = *((uint *) &Bc[bufptr_c + j + 4]);
-            T[j + 55] = *((uint *) &Bd[bufptr_d + j + 4]);
-        }
-        neoscrypt_erase(&T[80], 128);
-
-        /* BLAKE2s: compress IVs using keys */
-        T[32] = 64;
-        T[33] = 64;
-        T[34] = 64;
-        T[35] = 64;
-        blake2s_compress_4way(&T[0]);
-
-        /* BLAKE2s: update inputs */
-        for(j = 0; j < 64; j += 8) {
-            T[j + 48] = *((uint *) &Aa[bufptr_a + j]);
-            T[j + 49] = *((uint *) &Ab[bufptr_b + j]);
-            T[j + 50] = *((uint *) &Ac[bufptr_c + j]);
-            T[j + 51] = *((uint *) &Ad[bufptr_d + j]);
-            T[j + 52] = *((uint *) &Aa[bufptr_a + j + 4]);
-            T[j + 53] = *((uint *) &Ab[bufptr_b + j + 4]);
-            T[j + 54] = *((uint *) &Ac[bufptr_c + j + 4]);
-            T[j + 55] = *((uint *) &Ad[bufptr_d + j + 4]);
-        }
-
-        /* BLAKE2s: compress using inputs */
-        T[32] = 128;
-        T[33] = 128;
-        T[34] = 128;
-        T[35] = 128;
-        T[40] = ~0U;
-        T[41] = ~0U;
-        T[42] = ~0U;
-        T[43] = ~0U;
-        blake2s_compress_4way(&T[0]);
-
-        bufptr_a = 0;
-        bufptr_b = 0;
-        bufptr_c = 0;
-        bufptr_d = 0;
-        for(j = 0; j < 32; j += 4) {
-            bufptr_a += T[j];
-            bufptr_a += (T[j] >> 8);
-            bufptr_a += (T[j] >> 16);
-            bufptr_a += (T[j] >> 24);
-            bufptr_b += T[j + 1];
-            bufptr_b += (T[j + 1] >> 8);
-            bufptr_b += (T[j + 1] >> 16);
-            bufptr_b += (T[j + 1] >> 24);
-            bufptr_c += T[j + 2];
-            bufptr_c += (T[j + 2] >> 8);
-            bufptr_c += (T[j + 2] >> 16);
-            bufptr_c += (T[j + 2] >> 24);
-            bufptr_d += T[j + 3];
-            bufptr_d += (T[j + 3] >> 8);
-            bufptr_d += (T[j + 3] >> 16);
-            bufptr_d += (T[j + 3] >> 24);
-        }
-        bufptr_a &= 0xFF;
-        bufptr_b &= 0xFF;
-        bufptr_c &= 0xFF;
-        bufptr_d &= 0xFF;
-
-        for(j = 0; j < 32; j += 8) {
-            *((uint *) &Ba[bufptr_a + j]) ^= T[j];
-            *((uint *) &Bb[bufptr_b + j]) ^= T[j + 1];
-            *((uint *) &Bc[bufptr_c + j]) ^= T[j + 2];
-            *((uint *) &Bd[bufptr_d + j]) ^= T[j + 3];
-            *((uint *) &Ba[bufptr_a + j + 4]) ^= T[j + 4];
-            *((uint *) &Bb[bufptr_b + j + 4]) ^= T[j + 5];
-            *((uint *) &Bc[bufptr_c + j + 4]) ^= T[j + 6];
-            *((uint *) &Bd[bufptr_d + j + 4]) ^= T[j + 7];
-        }
-
-        if(bufptr_a < 32)
-          neoscrypt_copy(&Ba[256 + bufptr_a], &Ba[bufptr_a], 32 - bufptr_a);
-        else if(bufptr_a > 224)
-          neoscrypt_copy(&Ba[0], &Ba[256], bufptr_a - 224);
-        if(bufptr_b < 32)
-          neoscrypt_copy(&Bb[256 + bufptr_b], &Bb[bufptr_b], 32 - bufptr_b);
-        else if(bufptr_b > 224)
-          neoscrypt_copy(&Bb[0], &Bb[256], bufptr_b - 224);
-        if(bufptr_c < 32)
-          neoscrypt_copy(&Bc[256 + bufptr_c], &Bc[bufptr_c], 32 - bufptr_c);
-        else if(bufptr_c > 224)
-          neoscrypt_copy(&Bc[0], &Bc[256], bufptr_c - 224);
-        if(bufptr_d < 32)
-          neoscrypt_copy(&Bd[256 + bufptr_d], &Bd[bufptr_d], 32 - bufptr_d);
-        else if(bufptr_d > 224)
-          neoscrypt_copy(&Bd[0], &Bd[256], bufptr_d - 224);
-
-    }
-
-    i = 256 - bufptr_a;
-    if(i >= output_len) {
-        neoscrypt_xor(&Ba[bufptr_a], &Aa[0], output_len);
-        neoscrypt_copy(&output[0], &Ba[bufptr_a], output_len);
-    } else {
-        neoscrypt_xor(&Ba[bufptr_a], &Aa[0], i);
-        neoscrypt_xor(&Ba[0], &Aa[i], output_len - i);
-        neoscrypt_copy(&output[0], &Ba[bufptr_a], i);
-        neoscrypt_copy(&output[i], &Ba[0], output_len - i);
-    }
-    i = 256 - bufptr_b;
-    if(i >= output_len) {
-        neoscrypt_xor(&Bb[bufptr_b], &Ab[0], output_len);
-        neoscrypt_copy(&output[output_len], &Bb[bufptr_b], output_len);
-    } else {
-        neoscrypt_xor(&Bb[bufptr_b], &Ab[0], i);
-        neoscrypt_xor(&Bb[0], &Ab[i], output_len - i);
-        neoscrypt_copy(&output[output_len], &Bb[bufptr_b], i);
-        neoscrypt_copy(&output[output_len + i], &Bb[0], output_len - i);
-    }
-    i = 256 - bufptr_c;
-    if(i >= output_len) {
-        neoscrypt_xor(&Bc[bufptr_c], &Ac[0], output_len);
-        neoscrypt_copy(&output[2 * output_len], &Bc[bufptr_c], output_len);
-    } else {
-        neoscrypt_xor(&Bc[bufptr_c], &Ac[0], i);
-        neoscrypt_xor(&Bc[0], &Ac[i], output_len - i);
-        neoscrypt_copy(&output[2 * output_len], &Bc[bufptr_c], i);
-        neoscrypt_copy(&output[2 * output_len + i], &Bc[0], output_len - i);
-    }
-    i = 256 - bufptr_d;
-    if(i >= output_len) {
-        neoscrypt_xor(&Bd[bufptr_d], &Ad[0], output_len);
-        neoscrypt_copy(&output[3 * output_len], &Bd[bufptr_d], output_len);
-    } else {
-        neoscrypt_xor(&Bd[bufptr_d], &Ad[0], i);
-        neoscrypt_xor(&Bd[0], &Ad[i], output_len - i);
-        neoscrypt_copy(&output[3 * output_len], &Bd[bufptr_d], i);
-        neoscrypt_copy(&output[3 * output_len + i], &Bd[0], output_len - i);
-    }
-
 }
 
-#endif /* (ASM) && (MINER_4WAY) */
+#endif /* !(ASM) */
 
 #ifndef ASM
 uint cpu_vec_exts() {
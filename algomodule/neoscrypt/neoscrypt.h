@@ -1,3 +1,7 @@
+#include <stddef.h>
+
+#include "../core/scratch.h"
+
 #if (__cplusplus)
 extern "C" {
 #endif
@@ -5,6 +9,17 @@ extern "C" {
 void neoscrypt_hash(const unsigned char *password, unsigned char *output,
   unsigned int profile);
 
+/* The scratchpad is kept in a core_scratch area, grown to the largest
+ * profile hashed through it; neoscrypt_hash() uses the calling thread's.
+ * The _ctx functions return -1 if the area can't be grown */
+int neoscrypt_hash_ctx(core_scratch *scratch, const unsigned char *password,
+  unsigned char *output, unsigned int profile);
+
+size_t neoscrypt_scratch_size(unsigned int profile);
+
+void neoscrypt_hash_sp(const unsigned char *password, unsigned char *output,
+  unsigned int profile, void *scratchpad);
+
 void neoscrypt_blake2s(const void *input, const unsigned int input_size,
   const void *key, const unsigned char key_size,
   void *output, const unsigned char output_size);
@@ -13,22 +28,43 @@ void neoscrypt_copy(void *dstp, const void *srcp, unsigned int len);
 void neoscrypt_erase(void *dstp, unsigned int len);
 void neoscrypt_xor(void *dstp, const void *srcp, unsigned int len);
 
-#if defined(ASM) && defined(MINER_4WAY)
-void neoscrypt_4way(const unsigned char *password, unsigned char *output,
-  unsigned char *scratchpad);
+/* FastKDF used by the default profile: the ring buffer FastKDF on the
+ * fastest BLAKE2s compressor the CPU supports, the same FastKDF on the
+ * scalar compressor, or the generic buffered FastKDF on the scalar
+ * compressor.  Overriding it is process-wide and meant for benchmarking */
+#define NEOSCRYPT_KDF_AUTO    0
+#define NEOSCRYPT_KDF_OPT     1
+#define NEOSCRYPT_KDF_GENERIC 2
 
-#ifdef SHA256
-void scrypt_4way(const unsigned char *password, unsigned char *output,
-  unsigned char *scratchpad);
-#endif
+void neoscrypt_set_kdf(int kdf);
 
-void neoscrypt_blake2s_4way(const unsigned char *input,
-  const unsigned char *key, unsigned char *output);
+/* Both FastKDF passes of the default profile without SMix */
+void neoscrypt_fastkdf_only(const unsigned char *password,
+  unsigned char *output);
 
-void neoscrypt_fastkdf_4way(const unsigned char *password,
-  const unsigned char *salt, unsigned char *output, unsigned char *scratchpad,
-  const unsigned int mode);
-#endif
+/* Name of the SMix cores the built-in profiles (0x0 and the Scrypt
+ * compatible 0x1 and 0x3) are specialised into: "avx512vl", "sse2" or
+ * "scalar"; extended profiles run the generic SMix */
+const char *neoscrypt_core_backend(void);
+
+/* Name of the selected BLAKE2s compressor: "avx512vl", "sse41" or "scalar" */
+const char *neoscrypt_blake2s_backend(void);
+
+/* Multi-hash NeoScrypt (neoscrypt_4way.c): hashes count passwords of 80
+ * bytes each, back to back, into count 32-byte outputs.  The default
+ * profile runs on the widest SSE2, AVX2 or AVX-512 kernel the CPU
+ * supports, up to neoscrypt_lanes() hashes at a time; other profiles
+ * fall back to neoscrypt_hash() one by one */
+void neoscrypt_hash_many(const unsigned char *input, unsigned char *output,
+  unsigned int profile, size_t count);
+
+int neoscrypt_hash_many_ctx(core_scratch *scratch, const unsigned char *input,
+  unsigned char *output, unsigned int profile, size_t count);
+
+unsigned int neoscrypt_lanes(void);
+
+/* Name of the selected multi-hash kernel, e.g. "sse2x4" or "avx2x8" */
+const char *neoscrypt_many_backend(void);
 
 unsigned int cpu_vec_exts(void);
 
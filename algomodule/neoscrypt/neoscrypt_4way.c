@@ -0,0 +1,343 @@
+/*
+ * Copyright (c) 2014-2016 John Doering <ghostlander@phoenixcoin.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/* Multi-hash NeoScrypt: the 4-way miner code path rebuilt on compiler
+ * intrinsics and selected at run time, SSE2 for 4 hashes at once, AVX2
+ * for 8 and AVX-512 for 16 */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "../core/cpu.h"
+#include "../core/scratch.h"
+#include "neoscrypt.h"
+
+#ifdef CORE_CPU_X86
+#include <immintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#define NS_TARGET_SSE2   __attribute__((target("sse2")))
+#define NS_TARGET_AVX2   __attribute__((target("avx2")))
+#define NS_TARGET_AVX512 __attribute__((target("avx512f")))
+#else
+#define NS_TARGET_SSE2
+#define NS_TARGET_AVX2
+#define NS_TARGET_AVX512
+#endif
+#endif
+
+/* NeoScrypt(128, 2, 1) with Salsa20/20 and ChaCha20/20 */
+#define NS_N  128
+#define NS_R  2
+#define NS_DOUBLE_ROUNDS 10
+
+/* Scratchpad of one pass over lanes hashes: X, Z, Y and V of
+ * (N + 3) * r * 128 bytes each, then the FastKDF buffers (640 bytes)
+ * and the unpacked SMix output (256 bytes) */
+#define NS_SCRATCH_SIZE(lanes) \
+    ((lanes) * ((NS_N + 3) * NS_R * 2 * BLOCK_SIZE + 640 + 256))
+
+#ifdef CORE_CPU_X86
+
+static const uint neoscrypt_blake2s_IV[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+    0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+/* Initialisation vector with a parameter block XOR'ed in */
+static const uint neoscrypt_blake2s_IV_P_XOR[8] = {
+    0x6B08C647, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+    0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+static const uchar neoscrypt_blake2s_sigma[10][16] = {
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+    { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 },
+    { 11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4 },
+    {  7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8 },
+    {  9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13 },
+    {  2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9 },
+    { 12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11 },
+    { 13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10 },
+    {  6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5 },
+    { 10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13,  0 }
+};
+
+/* Pack lanes hashes of words 32-bit words each into vertical order */
+static void neoscrypt_pack(uint *dst, const uint *src, uint words,
+  uint lanes) {
+    uint k, l;
+
+    for(l = 0; l < lanes; l++)
+      for(k = 0; k < words; k++)
+        dst[k * lanes + l] = src[l * words + k];
+}
+
+static void neoscrypt_unpack(uint *dst, const uint *src, uint words,
+  uint lanes) {
+    uint k, l;
+
+    for(l = 0; l < lanes; l++)
+      for(k = 0; k < words; k++)
+        dst[l * words + k] = src[k * lanes + l];
+}
+
+/* SSE2: 4 hashes */
+
+NS_TARGET_SSE2 static __m128i neoscrypt_gather_sse2(const void *base,
+  __m128i idx, uint scale) {
+    const uchar *b = (const uchar *) base;
+    uint o[4], x[4], l;
+
+    _mm_storeu_si128((__m128i *) o, idx);
+    for(l = 0; l < 4; l++)
+      memcpy(&x[l], &b[o[l] * scale], 4);
+    return(_mm_loadu_si128((const __m128i *) x));
+}
+
+#define NS_FN(name)       name##_sse2
+#define NS_TARGET         NS_TARGET_SSE2
+#define NS_W              4
+#define VEC               __m128i
+#define VZERO             _mm_setzero_si128()
+#define VSET1(x)          _mm_set1_epi32((int) (x))
+#define VLANES            _mm_set_epi32(3, 2, 1, 0)
+#define VADD              _mm_add_epi32
+#define VXOR              _mm_xor_si128
+#define VAND              _mm_and_si128
+#define VROTL(x, s)       _mm_or_si128(_mm_slli_epi32(x, s), _mm_srli_epi32(x, 32 - (s)))
+#define VSRL              _mm_srli_epi32
+#define VSLL(x, n)        _mm_sll_epi32(x, _mm_cvtsi32_si128(n))
+#define VSTORE(p, v)      _mm_storeu_si128((__m128i *) (p), v)
+#define VGATHER8(b, i)    neoscrypt_gather_sse2(b, i, 1)
+#define VGATHER32(b, i)   neoscrypt_gather_sse2(b, i, 4)
+#include "neoscrypt_kernel.h"
+#undef NS_FN
+#undef NS_TARGET
+#undef NS_W
+#undef VEC
+#undef VZERO
+#undef VSET1
+#undef VLANES
+#undef VADD
+#undef VXOR
+#undef VAND
+#undef VROTL
+#undef VSRL
+#undef VSLL
+#undef VSTORE
+#undef VGATHER8
+#undef VGATHER32
+
+/* AVX2: 8 hashes */
+
+#define NS_FN(name)       name##_avx2
+#define NS_TARGET         NS_TARGET_AVX2
+#define NS_W              8
+#define VEC               __m256i
+#define VZERO             _mm256_setzero_si256()
+#define VSET1(x)          _mm256_set1_epi32((int) (x))
+#define VLANES            _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0)
+#define VADD              _mm256_add_epi32
+#define VXOR              _mm256_xor_si256
+#define VAND              _mm256_and_si256
+#define VROTL(x, s)       _mm256_or_si256(_mm256_slli_epi32(x, s), _mm256_srli_epi32(x, 32 - (s)))
+#define VSRL              _mm256_srli_epi32
+#define VSLL(x, n)        _mm256_sll_epi32(x, _mm_cvtsi32_si128(n))
+#define VSTORE(p, v)      _mm256_storeu_si256((__m256i *) (p), v)
+#define VGATHER8(b, i)    _mm256_i32gather_epi32((const int *) (b), i, 1)
+#define VGATHER32(b, i)   _mm256_i32gather_epi32((const int *) (b), i, 4)
+#include "neoscrypt_kernel.h"
+#undef NS_FN
+#undef NS_TARGET
+#undef NS_W
+#undef VEC
+#undef VZERO
+#undef VSET1
+#undef VLANES
+#undef VADD
+#undef VXOR
+#undef VAND
+#undef VROTL
+#undef VSRL
+#undef VSLL
+#undef VSTORE
+#undef VGATHER8
+#undef VGATHER32
+
+/* AVX-512: 16 hashes */
+
+#define NS_FN(name)       name##_avx512
+#define NS_TARGET         NS_TARGET_AVX512
+#define NS_W              16
+#define VEC               __m512i
+#define VZERO             _mm512_setzero_si512()
+#define VSET1(x)          _mm512_set1_epi32((int) (x))
+#define VLANES            _mm512_set_epi32(15, 14, 13, 12, 11, 10, 9, 8, \
+                            7, 6, 5, 4, 3, 2, 1, 0)
+#define VADD              _mm512_add_epi32
+#define VXOR              _mm512_xor_si512
+#define VAND              _mm512_and_si512
+#define VROTL             _mm512_rol_epi32
+#define VSRL              _mm512_srli_epi32
+#define VSLL(x, n)        _mm512_sll_epi32(x, _mm_cvtsi32_si128(n))
+#define VSTORE(p, v)      _mm512_storeu_si512((void *) (p), v)
+#define VGATHER8(b, i)    _mm512_i32gather_epi32(i, (const void *) (b), 1)
+#define VGATHER32(b, i)   _mm512_i32gather_epi32(i, (const void *) (b), 4)
+#include "neoscrypt_kernel.h"
+#undef NS_FN
+#undef NS_TARGET
+#undef NS_W
+#undef VEC
+#undef VZERO
+#undef VSET1
+#undef VLANES
+#undef VADD
+#undef VXOR
+#undef VAND
+#undef VROTL
+#undef VSRL
+#undef VSLL
+#undef VSTORE
+#undef VGATHER8
+#undef VGATHER32
+
+#endif /* CORE_CPU_X86 */
+
+
+/* Dispatch */
+
+typedef void (*neoscrypt_lanes_fn)(const uchar *, uchar *, void *);
+
+struct neoscrypt_kernel {
+    neoscrypt_lanes_fn fn;
+    uint lanes;
+    uint cpu;
+    const char *name;
+};
+
+static void neoscrypt_hash_lanes_scalar(const uchar *input, uchar *output,
+  void *scratchpad) {
+
+    neoscrypt_hash_sp(input, output, 0, scratchpad);
+}
+
+/* Widest first; the first kernel the CPU supports is the preferred one */
+static const struct neoscrypt_kernel neoscrypt_kernels[] = {
+#ifdef CORE_CPU_X86
+    { neoscrypt_hash_lanes_avx512, 16, CPU_FEATURE_AVX512F, "avx512x16" },
+    { neoscrypt_hash_lanes_avx2, 8, CPU_FEATURE_AVX2, "avx2x8" },
+    { neoscrypt_hash_lanes_sse2, 4, CPU_FEATURE_SSE2, "sse2x4" },
+#endif
+    { neoscrypt_hash_lanes_scalar, 1, 0, "scalar" },
+};
+
+#define NEOSCRYPT_NKERNELS \
+    (sizeof(neoscrypt_kernels) / sizeof(neoscrypt_kernels[0]))
+
+/* Supported kernels, widest first, ending with the scalar one */
+static const struct neoscrypt_kernel *neoscrypt_impl[NEOSCRYPT_NKERNELS];
+static uint neoscrypt_nimpl;
+
+static void neoscrypt_select(void) {
+    uint cpu = core_cpu_features();
+    uint i, n = 0;
+
+    for(i = 0; i < NEOSCRYPT_NKERNELS; i++)
+      if((cpu & neoscrypt_kernels[i].cpu) == neoscrypt_kernels[i].cpu)
+        neoscrypt_impl[n++] = &neoscrypt_kernels[i];
+    /* Every thread resolves the same table, so the race is benign */
+    neoscrypt_nimpl = n;
+}
+
+/* The multi-hash kernels implement the default profile only:
+ * NeoScrypt(128, 2, 1) with FastKDF-BLAKE2s.  Any other KDF goes through
+ * neoscrypt_hash(), which alone knows which of them neoscrypt.c was
+ * configured with */
+static int neoscrypt_profile_lanes(uint profile) {
+    uint kdf = (profile >> 1) & 0xF;
+
+    if((profile & 0x1) || (profile >> 31) || kdf)
+      return(0);
+    return(1);
+}
+
+uint neoscrypt_lanes(void) {
+
+    if(!neoscrypt_nimpl)
+      neoscrypt_select();
+    return(neoscrypt_impl[0]->lanes);
+}
+
+const char *neoscrypt_many_backend(void) {
+
+    if(!neoscrypt_nimpl)
+      neoscrypt_select();
+    return(neoscrypt_impl[0]->name);
+}
+
+int neoscrypt_hash_many_ctx(core_scratch *scratch, const uchar *input,
+  uchar *output, uint profile, size_t count) {
+    const struct neoscrypt_kernel *k;
+    void *scratchpad;
+    size_t size;
+    uint i;
+
+    if(!neoscrypt_profile_lanes(profile)) {
+        for(; count; count--, input += 80, output += 32)
+          if(neoscrypt_hash_ctx(scratch, input, output, profile))
+            return(-1);
+        return(0);
+    }
+
+    if(!neoscrypt_nimpl)
+      neoscrypt_select();
+
+    size = MAX(NS_SCRATCH_SIZE(neoscrypt_impl[0]->lanes),
+      neoscrypt_scratch_size(profile));
+    if(!scratch || !(scratchpad = core_scratch_get(scratch, size)))
+      return(-1);
+
+    /* Widest kernel that fits what is left, down to one hash */
+    for(i = 0; count; count -= k->lanes) {
+        while(neoscrypt_impl[i]->lanes > count)
+          i++;
+        k = neoscrypt_impl[i];
+        k->fn(input, output, scratchpad);
+        input  += k->lanes * 80;
+        output += k->lanes * 32;
+    }
+
+    return(0);
+}
+
+void neoscrypt_hash_many(const uchar *input, uchar *output, uint profile,
+  size_t count) {
+
+    if(neoscrypt_hash_many_ctx(core_scratch_thread(), input, output, profile,
+      count))
+      abort();
+}
@@ -0,0 +1,250 @@
+/*
+ * NeoScrypt SMix specialised for one profile and instruction set, included
+ * by neoscrypt.c once per pair.  N, r and the mixers are fixed at compile
+ * time, so the block loops unroll and no mixmode is tested per block.
+ * With the double mix, the ChaCha20 and the Salsa20 SMix run in lockstep
+ * on V areas of their own instead of one after the other: the two
+ * independent mixers interleave, which is what keeps the vector units of
+ * a core busy.
+ *
+ * Vector instances hold a 64-byte block in four 128-bit rows.  ChaCha20
+ * uses them as they are.  Salsa20 blocks are kept in the shuffled
+ * (diagonal) order of Percival's SSE2 scrypt while in SMix, row q holding
+ * words 5 * (4q + e) mod 16, so its rounds need whole-row rotates only;
+ * word 0, which integerify reads, stays in place.
+ *
+ * The includer defines:
+ *   NS_CORE_FN(name)       name of a generated function
+ *   NS_CORE_TARGET         function attribute enabling the instruction set
+ *   NS_CORE_N, NS_CORE_R   N and r of the profile
+ *   NS_CORE_DBLMIX         1 to XOR a ChaCha20 SMix into the Salsa20 one,
+ *                          0 for Salsa20 only
+ *   NS_CORE_ROUNDS         rounds of each mixer
+ *   NS_CORE_VEC            0 for the scalar mixers, 1 for 128-bit rows;
+ *                          vector instances also define VROTL(x, s)
+ */
+
+#define NS_CORE_WORDS (32 * NS_CORE_R)
+#define NS_CORE_BLOCKS (2 * NS_CORE_R)
+
+#if NS_CORE_VEC
+
+#define NS_CORE_SALSA(x0, x1, x2, x3) \
+    x1 = _mm_xor_si128(x1, VROTL(_mm_add_epi32(x0, x3),  7)); \
+    x2 = _mm_xor_si128(x2, VROTL(_mm_add_epi32(x1, x0),  9)); \
+    x3 = _mm_xor_si128(x3, VROTL(_mm_add_epi32(x2, x1), 13)); \
+    x0 = _mm_xor_si128(x0, VROTL(_mm_add_epi32(x3, x2), 18)); \
+    x1 = _mm_shuffle_epi32(x1, 0x93); \
+    x2 = _mm_shuffle_epi32(x2, 0x4E); \
+    x3 = _mm_shuffle_epi32(x3, 0x39); \
+    x3 = _mm_xor_si128(x3, VROTL(_mm_add_epi32(x0, x1),  7)); \
+    x2 = _mm_xor_si128(x2, VROTL(_mm_add_epi32(x3, x0),  9)); \
+    x1 = _mm_xor_si128(x1, VROTL(_mm_add_epi32(x2, x3), 13)); \
+    x0 = _mm_xor_si128(x0, VROTL(_mm_add_epi32(x1, x2), 18)); \
+    x1 = _mm_shuffle_epi32(x1, 0x39); \
+    x2 = _mm_shuffle_epi32(x2, 0x4E); \
+    x3 = _mm_shuffle_epi32(x3, 0x93);
+
+#define NS_CORE_CHACHA_QUARTERS(a, b, c, d) \
+    a = _mm_add_epi32(a, b); d = VROTL(_mm_xor_si128(d, a), 16); \
+    c = _mm_add_epi32(c, d); b = VROTL(_mm_xor_si128(b, c), 12); \
+    a = _mm_add_epi32(a, b); d = VROTL(_mm_xor_si128(d, a),  8); \
+    c = _mm_add_epi32(c, d); b = VROTL(_mm_xor_si128(b, c),  7);
+
+#define NS_CORE_CHACHA(a, b, c, d) \
+    NS_CORE_CHACHA_QUARTERS(a, b, c, d) \
+    b = _mm_shuffle_epi32(b, 0x39); \
+    c = _mm_shuffle_epi32(c, 0x4E); \
+    d = _mm_shuffle_epi32(d, 0x93); \
+    NS_CORE_CHACHA_QUARTERS(a, b, c, d) \
+    b = _mm_shuffle_epi32(b, 0x93); \
+    c = _mm_shuffle_epi32(c, 0x4E); \
+    d = _mm_shuffle_epi32(d, 0x39);
+
+/* B_i ^= Vj_i for every block if Vj, then the chained XOR and mixing of
+ * BlockMix, leaving the blocks in B in mixing order: Salsa20 on Bs and,
+ * with the double mix, ChaCha20 on Bc alongside */
+NS_CORE_TARGET static void NS_CORE_FN(mix)(uint *Bs, const uint *Vjs,
+  uint *Bc, const uint *Vjc) {
+    __m128i *S = (__m128i *) Bs, *C = (__m128i *) Bc;
+    const __m128i *VS = (const __m128i *) Vjs, *VC = (const __m128i *) Vjc;
+    __m128i s0, s1, s2, s3;
+#if NS_CORE_DBLMIX
+    __m128i c0, c1, c2, c3;
+#endif
+    uint b, k, i;
+
+    k = 4 * (NS_CORE_BLOCKS - 1);
+    s0 = S[k]; s1 = S[k + 1]; s2 = S[k + 2]; s3 = S[k + 3];
+    if(VS) {
+        s0 = _mm_xor_si128(s0, VS[k]);     s1 = _mm_xor_si128(s1, VS[k + 1]);
+        s2 = _mm_xor_si128(s2, VS[k + 2]); s3 = _mm_xor_si128(s3, VS[k + 3]);
+    }
+#if NS_CORE_DBLMIX
+    c0 = C[k]; c1 = C[k + 1]; c2 = C[k + 2]; c3 = C[k + 3];
+    if(VC) {
+        c0 = _mm_xor_si128(c0, VC[k]);     c1 = _mm_xor_si128(c1, VC[k + 1]);
+        c2 = _mm_xor_si128(c2, VC[k + 2]); c3 = _mm_xor_si128(c3, VC[k + 3]);
+    }
+#else
+    (void) C;
+    (void) VC;
+#endif
+
+    for(b = 0; b < NS_CORE_BLOCKS; b++) {
+        k = 4 * b;
+        if(VS) {
+            S[k]     = s0 = _mm_xor_si128(s0, _mm_xor_si128(S[k], VS[k]));
+            S[k + 1] = s1 = _mm_xor_si128(s1, _mm_xor_si128(S[k + 1], VS[k + 1]));
+            S[k + 2] = s2 = _mm_xor_si128(s2, _mm_xor_si128(S[k + 2], VS[k + 2]));
+            S[k + 3] = s3 = _mm_xor_si128(s3, _mm_xor_si128(S[k + 3], VS[k + 3]));
+        } else {
+            S[k]     = s0 = _mm_xor_si128(s0, S[k]);
+            S[k + 1] = s1 = _mm_xor_si128(s1, S[k + 1]);
+            S[k + 2] = s2 = _mm_xor_si128(s2, S[k + 2]);
+            S[k + 3] = s3 = _mm_xor_si128(s3, S[k + 3]);
+        }
+#if NS_CORE_DBLMIX
+        if(VC) {
+            C[k]     = c0 = _mm_xor_si128(c0, _mm_xor_si128(C[k], VC[k]));
+            C[k + 1] = c1 = _mm_xor_si128(c1, _mm_xor_si128(C[k + 1], VC[k + 1]));
+            C[k + 2] = c2 = _mm_xor_si128(c2, _mm_xor_si128(C[k + 2], VC[k + 2]));
+            C[k + 3] = c3 = _mm_xor_si128(c3, _mm_xor_si128(C[k + 3], VC[k + 3]));
+        } else {
+            C[k]     = c0 = _mm_xor_si128(c0, C[k]);
+            C[k + 1] = c1 = _mm_xor_si128(c1, C[k + 1]);
+            C[k + 2] = c2 = _mm_xor_si128(c2, C[k + 2]);
+            C[k + 3] = c3 = _mm_xor_si128(c3, C[k + 3]);
+        }
+#endif
+
+        for(i = 0; i < NS_CORE_ROUNDS; i += 2) {
+            NS_CORE_SALSA(s0, s1, s2, s3)
+#if NS_CORE_DBLMIX
+            NS_CORE_CHACHA(c0, c1, c2, c3)
+#endif
+        }
+
+        S[k]     = s0 = _mm_add_epi32(s0, S[k]);
+        S[k + 1] = s1 = _mm_add_epi32(s1, S[k + 1]);
+        S[k + 2] = s2 = _mm_add_epi32(s2, S[k + 2]);
+        S[k + 3] = s3 = _mm_add_epi32(s3, S[k + 3]);
+#if NS_CORE_DBLMIX
+        C[k]     = c0 = _mm_add_epi32(c0, C[k]);
+        C[k + 1] = c1 = _mm_add_epi32(c1, C[k + 1]);
+        C[k + 2] = c2 = _mm_add_epi32(c2, C[k + 2]);
+        C[k + 3] = c3 = _mm_add_epi32(c3, C[k + 3]);
+#endif
+    }
+}
+
+#undef NS_CORE_SALSA
+#undef NS_CORE_CHACHA_QUARTERS
+#undef NS_CORE_CHACHA
+
+#else /* !(NS_CORE_VEC) */
+
+/* B_i ^= Vj_i for every block if Vj, then the chained XOR and mixing of
+ * BlockMix, leaving the blocks in B in mixing order: Salsa20 on Bs and,
+ * with the double mix, ChaCha20 on Bc */
+static void NS_CORE_FN(mix)(uint *Bs, const uint *Vjs, uint *Bc,
+  const uint *Vjc) {
+    uint b;
+
+    if(Vjs)
+      neoscrypt_blkxor(&Bs[0], &Vjs[0], NS_CORE_WORDS * 4);
+    neoscrypt_blkxor(&Bs[0], &Bs[16 * (NS_CORE_BLOCKS - 1)], BLOCK_SIZE);
+    neoscrypt_salsa(&Bs[0], NS_CORE_ROUNDS);
+    for(b = 1; b < NS_CORE_BLOCKS; b++) {
+        neoscrypt_blkxor(&Bs[16 * b], &Bs[16 * (b - 1)], BLOCK_SIZE);
+        neoscrypt_salsa(&Bs[16 * b], NS_CORE_ROUNDS);
+    }
+
+#if NS_CORE_DBLMIX
+    if(Vjc)
+      neoscrypt_blkxor(&Bc[0], &Vjc[0], NS_CORE_WORDS * 4);
+    neoscrypt_blkxor(&Bc[0], &Bc[16 * (NS_CORE_BLOCKS - 1)], BLOCK_SIZE);
+    neoscrypt_chacha(&Bc[0], NS_CORE_ROUNDS);
+    for(b = 1; b < NS_CORE_BLOCKS; b++) {
+        neoscrypt_blkxor(&Bc[16 * b], &Bc[16 * (b - 1)], BLOCK_SIZE);
+        neoscrypt_chacha(&Bc[16 * b], NS_CORE_ROUNDS);
+    }
+#else
+    (void) Bc;
+    (void) Vjc;
+#endif
+}
+
+#endif /* NS_CORE_VEC */
+
+/* Reorders the blocks of B from mixing order to BlockMix output order:
+ * even blocks first, odd blocks second */
+NS_CORE_TARGET static void NS_CORE_FN(order)(uint *B, uint *Y) {
+    uint b;
+
+    if(NS_CORE_R == 2) {
+        neoscrypt_blkswp(&B[16], &B[32], BLOCK_SIZE);
+    } else if(NS_CORE_R > 2) {
+        neoscrypt_blkcpy(&Y[0], &B[0], NS_CORE_WORDS * 4);
+        for(b = 0; b < NS_CORE_R; b++) {
+            neoscrypt_blkcpy(&B[16 * b], &Y[16 * 2 * b], BLOCK_SIZE);
+            neoscrypt_blkcpy(&B[16 * (b + NS_CORE_R)], &Y[16 * (2 * b + 1)],
+              BLOCK_SIZE);
+        }
+    }
+}
+
+/* X = SMix_Salsa(X), XORed with SMix_ChaCha(X) computed in Z for the
+ * double mix; Y is X sized temporal space, V holds N copies of X and,
+ * for the double mix, another N of Z after them */
+NS_CORE_TARGET static void NS_CORE_FN(smix)(uint *X, uint *Z, uint *Y,
+  uint *V) {
+#if NS_CORE_DBLMIX
+    uint *Vz = &V[NS_CORE_N * NS_CORE_WORDS];
+#endif
+    uint i, j;
+
+#if NS_CORE_DBLMIX
+    neoscrypt_blkcpy(&Z[0], &X[0], NS_CORE_WORDS * 4);
+#else
+    Z = NULL;
+#endif
+#if NS_CORE_VEC
+    neoscrypt_salsa_shuffle(X, NS_CORE_BLOCKS);
+#endif
+
+    for(i = 0; i < NS_CORE_N; i++) {
+        neoscrypt_blkcpy(&V[i * NS_CORE_WORDS], &X[0], NS_CORE_WORDS * 4);
+#if NS_CORE_DBLMIX
+        neoscrypt_blkcpy(&Vz[i * NS_CORE_WORDS], &Z[0], NS_CORE_WORDS * 4);
+#endif
+        NS_CORE_FN(mix)(X, NULL, Z, NULL);
+        NS_CORE_FN(order)(X, Y);
+#if NS_CORE_DBLMIX
+        NS_CORE_FN(order)(Z, Y);
+#endif
+    }
+
+    for(i = 0; i < NS_CORE_N; i++) {
+        /* integerify(X) mod N */
+        j = NS_CORE_WORDS * (X[16 * (NS_CORE_BLOCKS - 1)] & (NS_CORE_N - 1));
+#if NS_CORE_DBLMIX
+        NS_CORE_FN(mix)(X, &V[j], Z, &Vz[NS_CORE_WORDS *
+          (Z[16 * (NS_CORE_BLOCKS - 1)] & (NS_CORE_N - 1))]);
+        NS_CORE_FN(order)(Z, Y);
+#else
+        NS_CORE_FN(mix)(X, &V[j], NULL, NULL);
+#endif
+        NS_CORE_FN(order)(X, Y);
+    }
+
+#if NS_CORE_VEC
+    neoscrypt_salsa_unshuffle(X, NS_CORE_BLOCKS);
+#endif
+#if NS_CORE_DBLMIX
+    neoscrypt_blkxor(&X[0], &Z[0], NS_CORE_WORDS * 4);
+#endif
+}
+
+#undef NS_CORE_BLOCKS
+#undef NS_CORE_WORDS
@@ -0,0 +1,307 @@
+/*
+ * Multi-hash NeoScrypt template, included by neoscrypt_4way.c once per
+ * instruction set.  NS_W hashes are interleaved word by word as in the
+ * original 4-way miner code: vector k holds word k of every hash, so
+ * Salsa20, ChaCha20 and BLAKE2s run on whole vectors without shuffles.
+ * Only the V_j reads and the FastKDF buffer reads, which differ per hash,
+ * are gathered.
+ *
+ * The includer defines NS_N, NS_R and NS_DOUBLE_ROUNDS of the profile,
+ * neoscrypt_pack() and neoscrypt_unpack(), and:
+ *   NS_FN(name)        name of a generated function for this instruction set
+ *   NS_TARGET          function attribute enabling the instruction set
+ *   NS_W               hashes per vector
+ *   VEC, VZERO, VSET1, VLANES, VADD, VXOR, VAND, VROTL, VSRL, VSLL
+ *                      vector type and 32-bit lane operations; VLANES is
+ *                      (0, 1, ... NS_W - 1), VSLL takes a run-time count
+ *   VSTORE(p, v)       unaligned store of NS_W words
+ *   VGATHER8(b, i)     32-bit words at byte offsets i from b
+ *   VGATHER32(b, i)    32-bit words at word offsets i from b
+ */
+
+/* X ^= X0; X = Salsa20(X) */
+NS_TARGET static void NS_FN(neoscrypt_xor_salsa)(VEC *X, const VEC *X0,
+  uint double_rounds) {
+    VEC x[16], t;
+    uint i;
+
+    for(i = 0; i < 16; i++)
+      x[i] = X[i] = VXOR(X[i], X0[i]);
+
+#define quarter(a, b, c, d) \
+    t = VADD(x[a], x[d]); x[b] = VXOR(x[b], VROTL(t,  7)); \
+    t = VADD(x[b], x[a]); x[c] = VXOR(x[c], VROTL(t,  9)); \
+    t = VADD(x[c], x[b]); x[d] = VXOR(x[d], VROTL(t, 13)); \
+    t = VADD(x[d], x[c]); x[a] = VXOR(x[a], VROTL(t, 18));
+
+    for(; double_rounds; double_rounds--) {
+        quarter( 0,  4,  8, 12);
+        quarter( 5,  9, 13,  1);
+        quarter(10, 14,  2,  6);
+        quarter(15,  3,  7, 11);
+        quarter( 0,  1,  2,  3);
+        quarter( 5,  6,  7,  4);
+        quarter(10, 11,  8,  9);
+        quarter(15, 12, 13, 14);
+    }
+
+#undef quarter
+
+    for(i = 0; i < 16; i++)
+      X[i] = VADD(X[i], x[i]);
+}
+
+/* X ^= X0; X = ChaCha20(X) */
+NS_TARGET static void NS_FN(neoscrypt_xor_chacha)(VEC *X, const VEC *X0,
+  uint double_rounds) {
+    VEC x[16];
+    uint i;
+
+    for(i = 0; i < 16; i++)
+      x[i] = X[i] = VXOR(X[i], X0[i]);
+
+#define quarter(a, b, c, d) \
+    x[a] = VADD(x[a], x[b]); x[d] = VROTL(VXOR(x[d], x[a]), 16); \
+    x[c] = VADD(x[c], x[d]); x[b] = VROTL(VXOR(x[b], x[c]), 12); \
+    x[a] = VADD(x[a], x[b]); x[d] = VROTL(VXOR(x[d], x[a]),  8); \
+    x[c] = VADD(x[c], x[d]); x[b] = VROTL(VXOR(x[b], x[c]),  7);
+
+    for(; double_rounds; double_rounds--) {
+        quarter( 0,  4,  8, 12);
+        quarter( 1,  5,  9, 13);
+        quarter( 2,  6, 10, 14);
+        quarter( 3,  7, 11, 15);
+        quarter( 0,  5, 10, 15);
+        quarter( 1,  6, 11, 12);
+        quarter( 2,  7,  8, 13);
+        quarter( 3,  4,  9, 14);
+    }
+
+#undef quarter
+
+    for(i = 0; i < 16; i++)
+      X[i] = VADD(X[i], x[i]);
+}
+
+/* Block mixer over 2 * r blocks of 16 vectors; Y is as large as X */
+NS_TARGET static void NS_FN(neoscrypt_blkmix)(VEC *X, VEC *Y, uint r,
+  uint double_rounds, uint mixer) {
+    uint i, k;
+
+    for(i = 0; i < 2 * r; i++) {
+        const VEC *prev = &X[16 * (i ? i - 1 : 2 * r - 1)];
+
+        if(mixer)
+          NS_FN(neoscrypt_xor_chacha)(&X[16 * i], prev, double_rounds);
+        else
+          NS_FN(neoscrypt_xor_salsa)(&X[16 * i], prev, double_rounds);
+    }
+
+    if(r == 1)
+      return;
+
+    /* X = (Y0, Y2 ... Y2r-2, Y1, Y3 ... Y2r-1) */
+    for(k = 0; k < 32 * r; k++)
+      Y[k] = X[k];
+    for(i = 0; i < r; i++)
+      for(k = 0; k < 16; k++) {
+          X[16 * i + k]       = Y[16 * (2 * i) + k];
+          X[16 * (i + r) + k] = Y[16 * (2 * i + 1) + k];
+      }
+}
+
+/* X = SMix(X) with V of N * 32 * r vectors */
+NS_TARGET static void NS_FN(neoscrypt_smix)(VEC *X, VEC *V, VEC *Y,
+  uint N, uint r, uint double_rounds, uint mixer) {
+    const uint words = 32 * r;
+    VEC idx, step;
+    uint i, k, shift;
+
+    for(i = 0; i < N; i++) {
+        for(k = 0; k < words; k++)
+          V[i * words + k] = X[k];
+        NS_FN(neoscrypt_blkmix)(X, Y, r, double_rounds, mixer);
+    }
+
+    /* Word offset of V_j in lane l: (j * words * NS_W) + l */
+    for(shift = 0; (1U << shift) < words * NS_W; shift++);
+    step = VSET1(NS_W);
+
+    for(i = 0; i < N; i++) {
+        /* integerify(X) mod N */
+        idx = VAND(X[16 * (2 * r - 1)], VSET1(N - 1));
+        idx = VADD(VSLL(idx, shift), VLANES);
+        /* blkxor(X, V) */
+        for(k = 0; k < words; k++) {
+            X[k] = VXOR(X[k], VGATHER32(V, idx));
+            idx = VADD(idx, step);
+        }
+        NS_FN(neoscrypt_blkmix)(X, Y, r, double_rounds, mixer);
+    }
+}
+
+/* BLAKE2s compressor: h absorbs the 64-byte block m at counter t, flag f */
+NS_TARGET static void NS_FN(neoscrypt_blake2s_compress)(VEC *h,
+  const VEC *m, uint t, uint f) {
+    VEC v[16];
+    const uchar *s;
+    uint i;
+
+    for(i = 0; i < 8; i++)
+      v[i] = h[i];
+    v[8]  = VSET1(neoscrypt_blake2s_IV[0]);
+    v[9]  = VSET1(neoscrypt_blake2s_IV[1]);
+    v[10] = VSET1(neoscrypt_blake2s_IV[2]);
+    v[11] = VSET1(neoscrypt_blake2s_IV[3]);
+    v[12] = VSET1(neoscrypt_blake2s_IV[4] ^ t);
+    v[13] = VSET1(neoscrypt_blake2s_IV[5]);
+    v[14] = VSET1(neoscrypt_blake2s_IV[6] ^ f);
+    v[15] = VSET1(neoscrypt_blake2s_IV[7]);
+
+#define G(a, b, c, d, x, y) \
+    v[a] = VADD(VADD(v[a], v[b]), m[x]); v[d] = VROTL(VXOR(v[d], v[a]), 16); \
+    v[c] = VADD(v[c], v[d]);             v[b] = VROTL(VXOR(v[b], v[c]), 20); \
+    v[a] = VADD(VADD(v[a], v[b]), m[y]); v[d] = VROTL(VXOR(v[d], v[a]), 24); \
+    v[c] = VADD(v[c], v[d]);             v[b] = VROTL(VXOR(v[b], v[c]), 25);
+
+    for(i = 0; i < 10; i++) {
+        s = neoscrypt_blake2s_sigma[i];
+        G(0, 4,  8, 12, s[0],  s[1]);
+        G(1, 5,  9, 13, s[2],  s[3]);
+        G(2, 6, 10, 14, s[4],  s[5]);
+        G(3, 7, 11, 15, s[6],  s[7]);
+        G(0, 5, 10, 15, s[8],  s[9]);
+        G(1, 6, 11, 12, s[10], s[11]);
+        G(2, 7,  8, 13, s[12], s[13]);
+        G(3, 4,  9, 14, s[14], s[15]);
+    }
+
+#undef G
+
+    for(i = 0; i < 8; i++)
+      h[i] = VXOR(h[i], VXOR(v[i], v[i + 8]));
+}
+
+/* FastKDF with BLAKE2s integrated, see neoscrypt_fastkdf_opt():
+ * password holds NS_W passwords of 80 bytes back to back, salt NS_W salts
+ * of 80 (mode 0) or 256 (mode 1) bytes; output receives NS_W results of
+ * 256 (mode 0) or 32 (mode 1) bytes; buf is NS_W * 640 bytes */
+NS_TARGET static void NS_FN(neoscrypt_fastkdf)(const uchar *password,
+  const uchar *salt, uchar *output, uchar *buf, uint mode) {
+    const uint salt_len = mode ? 256 : 80, output_len = mode ? 32 : 256;
+    uint bufptr[NS_W], hw[8 * NS_W];
+    uchar *A = buf, *B = &buf[NS_W * 320], *Al, *Bl;
+    const uchar *pw, *sl;
+    VEC h[8], m[16], bp, base, sum;
+    uint i, j, l, w;
+
+    for(l = 0; l < NS_W; l++) {
+        Al = &A[l * 320];
+        Bl = &B[l * 320];
+        pw = &password[l * 80];
+        sl = &salt[l * salt_len];
+        memcpy(&Al[0],   pw, 80);
+        memcpy(&Al[80],  pw, 80);
+        memcpy(&Al[160], pw, 80);
+        memcpy(&Al[240], pw, 16);
+        memcpy(&Al[256], pw, 64);
+        if(!mode) {
+            memcpy(&Bl[0],   sl, 80);
+            memcpy(&Bl[80],  sl, 80);
+            memcpy(&Bl[160], sl, 80);
+            memcpy(&Bl[240], sl, 16);
+        } else {
+            memcpy(&Bl[0], sl, 256);
+        }
+        memcpy(&Bl[256], sl, 32);
+    }
+
+    bp = VZERO;
+
+    for(i = 0; i < 32; i++) {
+
+        /* Byte offset of every lane's bufptr, lanes 320 bytes apart */
+        base = VADD(bp, VADD(VSLL(VLANES, 8), VSLL(VLANES, 6)));
+
+        /* BLAKE2s: initialise */
+        for(w = 0; w < 8; w++)
+          h[w] = VSET1(neoscrypt_blake2s_IV_P_XOR[w]);
+
+        /* BLAKE2s: compress IVs using keys */
+        for(w = 0; w < 8; w++)
+          m[w] = VGATHER8(B, VADD(base, VSET1(4 * w)));
+        for(w = 8; w < 16; w++)
+          m[w] = VZERO;
+        NS_FN(neoscrypt_blake2s_compress)(h, m, 64, 0);
+
+        /* BLAKE2s: compress again using inputs */
+        for(w = 0; w < 16; w++)
+          m[w] = VGATHER8(A, VADD(base, VSET1(4 * w)));
+        NS_FN(neoscrypt_blake2s_compress)(h, m, 128, ~0U);
+
+        /* bufptr = sum of the output bytes mod 256 */
+        sum = VZERO;
+        for(w = 0; w < 8; w++) {
+            VSTORE(&hw[w * NS_W], h[w]);
+            sum = VADD(sum, VADD(VADD(h[w], VSRL(h[w], 8)),
+              VADD(VSRL(h[w], 16), VSRL(h[w], 24))));
+        }
+        bp = VAND(sum, VSET1(0xFF));
+        VSTORE(bufptr, bp);
+
+        for(l = 0; l < NS_W; l++) {
+            Bl = &B[l * 320];
+            for(w = 0; w < 8; w++) {
+                uint x;
+
+                memcpy(&x, &Bl[bufptr[l] + 4 * w], 4);
+                x ^= hw[w * NS_W + l];
+                memcpy(&Bl[bufptr[l] + 4 * w], &x, 4);
+            }
+            if(bufptr[l] < 32)
+              memcpy(&Bl[256 + bufptr[l]], &Bl[bufptr[l]], 32 - bufptr[l]);
+            else if(bufptr[l] > 224)
+              memcpy(&Bl[0], &Bl[256], bufptr[l] - 224);
+        }
+    }
+
+    for(l = 0; l < NS_W; l++) {
+        Al = &A[l * 320];
+        Bl = &B[l * 320];
+        i = 256 - bufptr[l];
+        if(i >= output_len) {
+            for(j = 0; j < output_len; j++)
+              output[l * output_len + j] = Bl[bufptr[l] + j] ^ Al[j];
+        } else {
+            for(j = 0; j < i; j++)
+              output[l * output_len + j] = Bl[bufptr[l] + j] ^ Al[j];
+            for(; j < output_len; j++)
+              output[l * output_len + j] = Bl[j - i] ^ Al[j];
+        }
+    }
+}
+
+/* One pass over NS_W hashes of 80 bytes each, see neoscrypt_hash() */
+NS_TARGET static void NS_FN(neoscrypt_hash_lanes)(const uchar *input,
+  uchar *output, void *scratchpad) {
+    VEC *X = (VEC *) scratchpad, *Z = &X[32 * NS_R], *Y = &X[64 * NS_R];
+    VEC *V = &X[96 * NS_R];
+    uchar *kdf = (uchar *) &V[32 * NS_R * NS_N], *T = &kdf[NS_W * 640];
+    uint k;
+
+    /* X = KDF(password, salt) */
+    NS_FN(neoscrypt_fastkdf)(input, input, T, kdf, 0);
+    neoscrypt_pack((uint *) X, (const uint *) T, 32 * NS_R, NS_W);
+
+    /* Process ChaCha 1st, Salsa 2nd and XOR them into FastKDF */
+    for(k = 0; k < 32 * NS_R; k++)
+      Z[k] = X[k];
+    NS_FN(neoscrypt_smix)(Z, V, Y, NS_N, NS_R, NS_DOUBLE_ROUNDS, 1);
+    NS_FN(neoscrypt_smix)(X, V, Y, NS_N, NS_R, NS_DOUBLE_ROUNDS, 0);
+    for(k = 0; k < 32 * NS_R; k++)
+      X[k] = VXOR(X[k], Z[k]);
+
+    /* output = KDF(password, X) */
+    neoscrypt_unpack((uint *) T, (const uint *) X, 32 * NS_R, NS_W);
+    NS_FN(neoscrypt_fastkdf)(input, T, output, kdf, 1);
+}
@@ -4,9 +4,32 @@ from libc.string cimport memcpy
 
 cdef extern from "quark/quark.h":
 	extern void quark_hash(const char* input, char* output, uint32_t input_len);
+	extern void quark_hash_many(const char* input, char* output, uint32_t input_len, uint32_t count) nogil;
 
 def _quark_hash(hash):
 	cdef char output[32];
 	cdef uint32_t input_len = len(hash);
 	quark_hash(hash, output, input_len);
-	return output[:32];
\ No newline at end of file
+	return output[:32];
+
+def _quark_hash_many(hashes):
+	hashes = list(hashes);
+	cdef uint32_t count = len(hashes);
+	if count == 0:
+		return [];
+	cdef uint32_t input_len = len(hashes[0]);
+	for h in hashes:
+		if len(h) != input_len:
+			raise ValueError("all inputs must have the same length");
+	cdef bytes data = b''.join(hashes);
+	cdef const char* input = data;
+	cdef char* output = <char*>malloc(count * 32);
+	if not output:
+		raise MemoryError();
+	try:
+		with nogil:
+			quark_hash_many(input, output, input_len, count);
+		result = output[:count * 32];
+	finally:
+		free(output);
+	return [result[i * 32:(i + 1) * 32] for i in range(count)];
@@ -207,4 +207,108 @@ void quark_hash(const char* input, char* output, uint32_t len)
 
 }
 
+/*
+ * Batched Quark.
+ *
+ * The nine Quark stages are run stage-major over a batch of lanes instead of
+ * lane-major: every primitive is applied to all lanes that need it before the
+ * next stage starts.  At the three data-dependent stages the live lanes are
+ * compacted into two index lists (bit 3 of the first hash word set / clear)
+ * so that each candidate primitive only sees a dense sub-batch.  A multi-lane
+ * implementation of a primitive can therefore be dropped into the matching
+ * quark_batch_* stage without touching the control flow below.
+ */
+
+#define QUARK_BATCH_LANES 64
+
+typedef uint32_t quark_lane[16];
+
+#define QUARK_BATCH_STAGE(name, ctx_type, init, update, close) \
+static void quark_batch_##name(quark_lane *in, quark_lane *out, \
+    const uint8_t *idx, uint32_t n) \
+{ \
+    ctx_type ctx; \
+    uint32_t i; \
+\
+    for (i = 0; i < n; i++) \
+    { \
+        init(&ctx); \
+        update(&ctx, in[idx[i]], 64); \
+        close(&ctx, out[idx[i]]); \
+    } \
+}
+
+QUARK_BATCH_STAGE(blake,   sph_blake512_context,   sph_blake512_init,   sph_blake512,   sph_blake512_close)
+QUARK_BATCH_STAGE(bmw,     sph_bmw512_context,     sph_bmw512_init,     sph_bmw512,     sph_bmw512_close)
+QUARK_BATCH_STAGE(groestl, sph_groestl512_context, sph_groestl512_init, sph_groestl512, sph_groestl512_close)
+QUARK_BATCH_STAGE(jh,      sph_jh512_context,      sph_jh512_init,      sph_jh512,      sph_jh512_close)
+QUARK_BATCH_STAGE(keccak,  sph_keccak512_context,  sph_keccak512_init,  sph_keccak512,  sph_keccak512_close)
+QUARK_BATCH_STAGE(skein,   sph_skein512_context,   sph_skein512_init,   sph_skein512,   sph_skein512_close)
+
+/* Partition lanes 0..n-1 by the Quark branch bit. */
+static void quark_batch_split(quark_lane *h, uint32_t n,
+    uint8_t *set, uint32_t *nset, uint8_t *clear, uint32_t *nclear)
+{
+    uint32_t i, s = 0, c = 0;
+
+    for (i = 0; i < n; i++)
+    {
+        if (h[i][0] & 8)
+            set[s++] = (uint8_t)i;
+        else
+            clear[c++] = (uint8_t)i;
+    }
+
+    *nset = s;
+    *nclear = c;
+}
+
+void quark_hash_many(const char* input, char* output, uint32_t len, uint32_t count)
+{
+    quark_lane hashA[QUARK_BATCH_LANES], hashB[QUARK_BATCH_LANES];
+    uint8_t all[QUARK_BATCH_LANES], set[QUARK_BATCH_LANES], clear[QUARK_BATCH_LANES];
+    sph_blake512_context ctx_blake;
+    uint32_t i, n, nset, nclear;
+
+    for (i = 0; i < QUARK_BATCH_LANES; i++)
+        all[i] = (uint8_t)i;
+
+    while (count)
+    {
+        n = count < QUARK_BATCH_LANES ? count : QUARK_BATCH_LANES;
+
+        for (i = 0; i < n; i++)
+        {
+            sph_blake512_init(&ctx_blake);
+            sph_blake512(&ctx_blake, input + (size_t)i * len, len);
+            sph_blake512_close(&ctx_blake, hashA[i]);    //0
+        }
+
+        quark_batch_bmw(hashA, hashB, all, n);           //1
+
+        quark_batch_split(hashB, n, set, &nset, clear, &nclear);
+        quark_batch_groestl(hashB, hashA, set, nset);    //2
+        quark_batch_skein(hashB, hashA, clear, nclear);
 
+        quark_batch_groestl(hashA, hashB, all, n);       //3
+        quark_batch_jh(hashB, hashA, all, n);            //4
+
+        quark_batch_split(hashA, n, set, &nset, clear, &nclear);
+        quark_batch_blake(hashA, hashB, set, nset);      //5
+        quark_batch_bmw(hashA, hashB, clear, nclear);
+
+        quark_batch_keccak(hashB, hashA, all, n);        //6
+        quark_batch_skein(hashA, hashB, all, n);         //7
+
+        quark_batch_split(hashB, n, set, &nset, clear, &nclear);
+        quark_batch_keccak(hashB, hashA, set, nset);     //8
+        quark_batch_jh(hashB, hashA, clear, nclear);
+
+        for (i = 0; i < n; i++)
+            memcpy(output + (size_t)i * 32, hashA[i], 32);
+
+        input += (size_t)n * len;
+        output += (size_t)n * 32;
+        count -= n;
+    }
+}
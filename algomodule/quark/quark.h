@@ -9,6 +9,10 @@ extern "C" {
 
 void quark_hash(const char* input, char* output, uint32_t len);
 
+/* Hashes count inputs of len bytes each, stored back to back; writes count
+   32-byte digests back to back into output. */
+void quark_hash_many(const char* input, char* output, uint32_t len, uint32_t count);
+
 #ifdef __cplusplus
 }
 #endif
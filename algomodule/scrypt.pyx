@@ -2,11 +2,260 @@ from libc.stdint cimport uint32_t, int64_t, uint8_t, uint64_t
 from libc.stdlib cimport malloc, free
 from libc.string cimport memcpy
 
+cdef extern from "core/scratch.h":
+	ctypedef struct core_scratch:
+		size_t size;
+		int backing;
+	enum:
+		CORE_SCRATCH_HUGE
+		CORE_SCRATCH_HEAP
+		CORE_SCRATCH_THP
+		CORE_SCRATCH_HUGETLB
+	extern void core_scratch_init(core_scratch* s, int flags);
+	extern void core_scratch_free(core_scratch* s);
+	extern core_scratch* core_scratch_thread() nogil;
+
 cdef extern from "scrypt/scrypt.h":
-	extern void scrypt_1024_1_1_256(const char* input, char* output);
+	ctypedef struct scrypt_header:
+		pass
+	extern int scrypt_1024_1_1_256_ctx(core_scratch* scratch, const char* input, char* output) nogil;
+	extern int scrypt_1024_1_1_256_many_ctx(core_scratch* scratch, const char* input, char* output, uint32_t count) nogil;
+	extern void scrypt_1024_1_1_256_prepare(scrypt_header* ctx, const char* header);
+	extern int scrypt_1024_1_1_256_nonces_ctx(core_scratch* scratch, const scrypt_header* ctx, const uint32_t* nonces, char* output, uint32_t count) nogil;
+
+cdef extern from "scrypt/scryptn.h":
+	extern int scrypt_N_R_1_256_ctx(core_scratch* scratch, const char* input, char* output, uint32_t N, uint32_t R, uint32_t len) nogil;
+	extern int scrypt_N_R_1_256_many_ctx(core_scratch* scratch, const char* input, char* output, uint32_t N, uint32_t R, uint32_t len, uint32_t count) nogil;
+
+cdef extern from "scrypt/smix.h":
+	extern const char* scrypt_smix_backend();
+	extern const char* scrypt_smix_many_backend();
+	enum:
+		SCRYPT_SMIX_AUTO
+		SCRYPT_SMIX_LOCKSTEP
+		SCRYPT_SMIX_PREFETCH
+		SCRYPT_SMIX_PIPELINE
+	extern void scrypt_smix_set_strategy(int strategy);
+
+
+cdef _scrypt_1024(core_scratch* scratch, hash):
+	cdef char output[32];
+	cdef int ret;
+	if len(hash) < 80:
+		raise ValueError("input must be at least 80 bytes");
+	cdef const char* input = hash;
+	with nogil:
+		if scratch == NULL:
+			scratch = core_scratch_thread();
+		ret = scrypt_1024_1_1_256_ctx(scratch, input, output);
+	if ret:
+		raise MemoryError();
+	return output[:32];
+
+cdef _scrypt_1024_many(core_scratch* scratch, hashes):
+	hashes = list(hashes);
+	cdef uint32_t count = len(hashes);
+	cdef int ret;
+	if count == 0:
+		return [];
+	for h in hashes:
+		if len(h) != 80:
+			raise ValueError("all inputs must be 80 bytes");
+	cdef bytes data = b''.join(hashes);
+	cdef const char* input = data;
+	cdef char* output = <char*>malloc(count * 32);
+	if not output:
+		raise MemoryError();
+	try:
+		with nogil:
+			if scratch == NULL:
+				scratch = core_scratch_thread();
+			ret = scrypt_1024_1_1_256_many_ctx(scratch, input, output, count);
+		if ret:
+			raise MemoryError();
+		result = output[:count * 32];
+	finally:
+		free(output);
+	return [result[i * 32:(i + 1) * 32] for i in range(count)];
+
+cdef _scrypt_1024_nonces(core_scratch* scratch, header, nonces):
+	if len(header) < 76:
+		raise ValueError("header must be at least 76 bytes");
+	nonces = list(nonces);
+	cdef uint32_t count = len(nonces);
+	cdef int ret;
+	if count == 0:
+		return [];
+	cdef scrypt_header ctx;
+	cdef bytes data = bytes(header[:76]) + bytes(4);
+	scrypt_1024_1_1_256_prepare(&ctx, data);
+	cdef uint32_t* n = <uint32_t*>malloc(count * sizeof(uint32_t));
+	if not n:
+		raise MemoryError();
+	cdef char* output = <char*>malloc(count * 32);
+	if not output:
+		free(n);
+		raise MemoryError();
+	try:
+		for i in range(count):
+			n[i] = nonces[i];
+		with nogil:
+			if scratch == NULL:
+				scratch = core_scratch_thread();
+			ret = scrypt_1024_1_1_256_nonces_ctx(scratch, &ctx, n, output, count);
+		if ret:
+			raise MemoryError();
+		result = output[:count * 32];
+	finally:
+		free(output);
+		free(n);
+	return [result[i * 32:(i + 1) * 32] for i in range(count)];
+
+cdef _check_nr(N, r):
+	if N < 2 or N > 0x80000000 or N & (N - 1):
+		raise ValueError("N must be a power of 2 between 2 and 2**31");
+	if r < 1 or r > 0x10000 or r * N > 0x40000000:
+		raise ValueError("r must be between 1 and 2**16 and r * N at most 2**30");
+
+cdef _scrypt_n(core_scratch* scratch, hash, N, r):
+	_check_nr(N, r);
+	cdef char output[32];
+	cdef int ret;
+	cdef uint32_t n = N, rr = r, input_len = len(hash);
+	cdef const char* input = hash;
+	with nogil:
+		if scratch == NULL:
+			scratch = core_scratch_thread();
+		ret = scrypt_N_R_1_256_ctx(scratch, input, output, n, rr, input_len);
+	if ret:
+		raise MemoryError();
+	return output[:32];
+
+cdef _scrypt_n_many(core_scratch* scratch, hashes, N, r):
+	_check_nr(N, r);
+	hashes = list(hashes);
+	cdef uint32_t count = len(hashes);
+	cdef int ret;
+	if count == 0:
+		return [];
+	cdef uint32_t n = N, rr = r, input_len = len(hashes[0]);
+	for h in hashes:
+		if len(h) != input_len:
+			raise ValueError("all inputs must have the same length");
+	cdef bytes data = b''.join(hashes);
+	cdef const char* input = data;
+	cdef char* output = <char*>malloc(count * 32);
+	if not output:
+		raise MemoryError();
+	try:
+		with nogil:
+			if scratch == NULL:
+				scratch = core_scratch_thread();
+			ret = scrypt_N_R_1_256_many_ctx(scratch, input, output, n, rr, input_len, count);
+		if ret:
+			raise MemoryError();
+		result = output[:count * 32];
+	finally:
+		free(output);
+	return [result[i * 32:(i + 1) * 32] for i in range(count)];
 
 
 def _ltc_scrypt(hash):
-	cdef char output[32];	
-	scrypt_1024_1_1_256(hash, output);
-	return output[:32];	
\ No newline at end of file
+	return _scrypt_1024(NULL, hash);
+
+def _ltc_scrypt_many(hashes):
+	return _scrypt_1024_many(NULL, hashes);
+
+def _ltc_scrypt_nonces(header, nonces):
+	return _scrypt_1024_nonces(NULL, header, nonces);
+
+def _scryptn_hash(hash, N, r=1):
+	return _scrypt_n(NULL, hash, N, r);
+
+def _scryptn_hash_many(hashes, N, r=1):
+	return _scrypt_n_many(NULL, hashes, N, r);
+
+def backend():
+	return (scrypt_smix_backend().decode(), scrypt_smix_many_backend().decode());
+
+_smix_strategies = {
+	'auto': SCRYPT_SMIX_AUTO,
+	'lockstep': SCRYPT_SMIX_LOCKSTEP,
+	'prefetch': SCRYPT_SMIX_PREFETCH,
+	'pipeline': SCRYPT_SMIX_PIPELINE,
+};
+
+def set_smix_strategy(name):
+	"""Force how SMix reads V ('lockstep', 'prefetch', 'pipeline') or go back to 'auto'."""
+	if name not in _smix_strategies:
+		raise ValueError("unknown smix strategy %r" % (name,));
+	scrypt_smix_set_strategy(_smix_strategies[name]);
+
+cdef class ScryptContext:
+	"""Owns a scrypt scratchpad that is reused by every hash run through it.
+
+	The module-level functions use a per-thread scratchpad instead.  A
+	context is not shared between threads: calling it while another thread
+	is inside it raises RuntimeError.
+	"""
+	cdef core_scratch scratch
+	cdef bint busy
+
+	def __cinit__(self, huge_pages=False):
+		core_scratch_init(&self.scratch, CORE_SCRATCH_HUGE if huge_pages else 0);
+		self.busy = False;
+
+	def __dealloc__(self):
+		core_scratch_free(&self.scratch);
+
+	cdef _enter(self):
+		if self.busy:
+			raise RuntimeError("ScryptContext is in use by another thread");
+		self.busy = True;
+
+	def hash(self, header):
+		self._enter();
+		try:
+			return _scrypt_1024(&self.scratch, header);
+		finally:
+			self.busy = False;
+
+	def hash_many(self, headers):
+		self._enter();
+		try:
+			return _scrypt_1024_many(&self.scratch, headers);
+		finally:
+			self.busy = False;
+
+	def hash_nonces(self, header, nonces):
+		self._enter();
+		try:
+			return _scrypt_1024_nonces(&self.scratch, header, nonces);
+		finally:
+			self.busy = False;
+
+	def hash_n(self, data, N, r=1):
+		self._enter();
+		try:
+			return _scrypt_n(&self.scratch, data, N, r);
+		finally:
+			self.busy = False;
+
+	def hash_n_many(self, inputs, N, r=1):
+		self._enter();
+		try:
+			return _scrypt_n_many(&self.scratch, inputs, N, r);
+		finally:
+			self.busy = False;
+
+	@property
+	def size(self):
+		return self.scratch.size;
+
+	@property
+	def backing(self):
+		if self.scratch.backing == CORE_SCRATCH_HUGETLB:
+			return 'hugetlb';
+		if self.scratch.backing == CORE_SCRATCH_THP:
+			return 'thp';
+		return 'heap';
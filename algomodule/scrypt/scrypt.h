@@ -1,12 +1,36 @@
 #ifndef SCRYPT_H
 #define SCRYPT_H
+#include <stdint.h>
+#include "../core/scratch.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/*
+ * An 80-byte block header prepared once for a nonce sweep: nonce-independent
+ * SHA-256 work is cached and only the nonce (little-endian, bytes 76..79)
+ * changes per hash.
+ */
+typedef struct scrypt_header {
+	uint32_t midstate[8];
+	uint8_t header[80];
+} scrypt_header;
+
+/*
+ * The plain entry points hash in the calling thread's scratch area
+ * (core_scratch_thread()) and abort if it cannot be allocated; the _ctx
+ * variants use the caller's scratch area and return -1 instead.
+ */
 extern void scrypt_1024_1_1_256(const char* input, char* output);
+extern int scrypt_1024_1_1_256_ctx(core_scratch* scratch, const char* input, char* output);
 extern void scrypt_1024_1_1_256_sp(const char* input, char* output, char* scratchpad);
+extern void scrypt_1024_1_1_256_many(const char* input, char* output, uint32_t count);
+extern int scrypt_1024_1_1_256_many_ctx(core_scratch* scratch, const char* input, char* output, uint32_t count);
+extern void scrypt_1024_1_1_256_prepare(scrypt_header* ctx, const char* header);
+extern void scrypt_1024_1_1_256_sp_nonce(const scrypt_header* ctx, uint32_t nonce, char* output, char* scratchpad);
+extern void scrypt_1024_1_1_256_nonces(const scrypt_header* ctx, const uint32_t* nonces, char* output, uint32_t count);
+extern int scrypt_1024_1_1_256_nonces_ctx(core_scratch* scratch, const scrypt_header* ctx, const uint32_t* nonces, char* output, uint32_t count);
 #define  scrypt_scratchpad_size 131583;
 
 #ifdef __cplusplus
@@ -33,186 +33,8 @@
 
 #include "scryptn.h"
 #include "../core/sha256.h"
-
-static void blkcpy(void *, void *, size_t);
-static void blkxor(void *, void *, size_t);
-static void salsa20_8(uint32_t[16]);
-static void blockmix_salsa8(uint32_t *, uint32_t *, uint32_t *, size_t);
-static uint64_t integerify(void *, size_t);
-static void smix(uint8_t *, size_t, uint64_t, uint32_t *, uint32_t *);
-
-static void
-blkcpy(void * dest, void * src, size_t len)
-{
-	size_t * D = dest;
-	size_t * S = src;
-	size_t L = len / sizeof(size_t);
-	size_t i;
-
-	for (i = 0; i < L; i++)
-		D[i] = S[i];
-}
-
-static void
-blkxor(void * dest, void * src, size_t len)
-{
-	size_t * D = dest;
-	size_t * S = src;
-	size_t L = len / sizeof(size_t);
-	size_t i;
-
-	for (i = 0; i < L; i++)
-		D[i] ^= S[i];
-}
-
-/**
- * salsa20_8(B):
- * Apply the salsa20/8 core to the provided block.
- */
-static void
-salsa20_8(uint32_t B[16])
-{
-	uint32_t x[16];
-	size_t i;
-
-	blkcpy(x, B, 64);
-	for (i = 0; i < 8; i += 2) {
-#define R(a,b) (((a) << (b)) | ((a) >> (32 - (b))))
-		/* Operate on columns. */
-		x[ 4] ^= R(x[ 0]+x[12], 7);  x[ 8] ^= R(x[ 4]+x[ 0], 9);
-		x[12] ^= R(x[ 8]+x[ 4],13);  x[ 0] ^= R(x[12]+x[ 8],18);
-
-		x[ 9] ^= R(x[ 5]+x[ 1], 7);  x[13] ^= R(x[ 9]+x[ 5], 9);
-		x[ 1] ^= R(x[13]+x[ 9],13);  x[ 5] ^= R(x[ 1]+x[13],18);
-
-		x[14] ^= R(x[10]+x[ 6], 7);  x[ 2] ^= R(x[14]+x[10], 9);
-		x[ 6] ^= R(x[ 2]+x[14],13);  x[10] ^= R(x[ 6]+x[ 2],18);
-
-		x[ 3] ^= R(x[15]+x[11], 7);  x[ 7] ^= R(x[ 3]+x[15], 9);
-		x[11] ^= R(x[ 7]+x[ 3],13);  x[15] ^= R(x[11]+x[ 7],18);
-
-		/* Operate on rows. */
-		x[ 1] ^= R(x[ 0]+x[ 3], 7);  x[ 2] ^= R(x[ 1]+x[ 0], 9);
-		x[ 3] ^= R(x[ 2]+x[ 1],13);  x[ 0] ^= R(x[ 3]+x[ 2],18);
-
-		x[ 6] ^= R(x[ 5]+x[ 4], 7);  x[ 7] ^= R(x[ 6]+x[ 5], 9);
-		x[ 4] ^= R(x[ 7]+x[ 6],13);  x[ 5] ^= R(x[ 4]+x[ 7],18);
-
-		x[11] ^= R(x[10]+x[ 9], 7);  x[ 8] ^= R(x[11]+x[10], 9);
-		x[ 9] ^= R(x[ 8]+x[11],13);  x[10] ^= R(x[ 9]+x[ 8],18);
-
-		x[12] ^= R(x[15]+x[14], 7);  x[13] ^= R(x[12]+x[15], 9);
-		x[14] ^= R(x[13]+x[12],13);  x[15] ^= R(x[14]+x[13],18);
-#undef R
-	}
-	for (i = 0; i < 16; i++)
-		B[i] += x[i];
-}
-
-/**
- * blockmix_salsa8(Bin, Bout, X, r):
- * Compute Bout = BlockMix_{salsa20/8, r}(Bin).  The input Bin must be 128r
- * bytes in length; the output Bout must also be the same size.  The
- * temporary space X must be 64 bytes.
- */
-static void
-blockmix_salsa8(uint32_t * Bin, uint32_t * Bout, uint32_t * X, size_t r)
-{
-	size_t i;
-
-	/* 1: X <-- B_{2r - 1} */
-	blkcpy(X, &Bin[(2 * r - 1) * 16], 64);
-
-	/* 2: for i = 0 to 2r - 1 do */
-	for (i = 0; i < 2 * r; i += 2) {
-		/* 3: X <-- H(X \xor B_i) */
-		blkxor(X, &Bin[i * 16], 64);
-		salsa20_8(X);
-
-		/* 4: Y_i <-- X */
-		/* 6: B' <-- (Y_0, Y_2 ... Y_{2r-2}, Y_1, Y_3 ... Y_{2r-1}) */
-		blkcpy(&Bout[i * 8], X, 64);
-
-		/* 3: X <-- H(X \xor B_i) */
-		blkxor(X, &Bin[i * 16 + 16], 64);
-		salsa20_8(X);
-
-		/* 4: Y_i <-- X */
-		/* 6: B' <-- (Y_0, Y_2 ... Y_{2r-2}, Y_1, Y_3 ... Y_{2r-1}) */
-		blkcpy(&Bout[i * 8 + r * 16], X, 64);
-	}
-}
-
-/**
- * integerify(B, r):
- * Return the result of parsing B_{2r-1} as a little-endian integer.
- */
-static uint64_t
-integerify(void * B, size_t r)
-{
-	uint32_t * X = (void *)((uintptr_t)(B) + (2 * r - 1) * 64);
-
-	return (((uint64_t)(X[1]) << 32) + X[0]);
-}
-
-/**
- * smix(B, r, N, V, XY):
- * Compute B = SMix_r(B, N).  The input B must be 128r bytes in length;
- * the temporary storage V must be 128rN bytes in length; the temporary
- * storage XY must be 256r + 64 bytes in length.  The value N must be a
- * power of 2 greater than 1.  The arrays B, V, and XY must be aligned to a
- * multiple of 64 bytes.
- */
-static void
-smix(uint8_t * B, size_t r, uint64_t N, uint32_t * V, uint32_t * XY)
-{
-	uint32_t * X = XY;
-	uint32_t * Y = &XY[32 * r];
-	uint32_t * Z = &XY[64 * r];
-	uint64_t i;
-	uint64_t j;
-	size_t k;
-
-	/* 1: X <-- B */
-	for (k = 0; k < 32 * r; k++)
-		X[k] = le32dec(&B[4 * k]);
-
-	/* 2: for i = 0 to N - 1 do */
-	for (i = 0; i < N; i += 2) {
-		/* 3: V_i <-- X */
-		blkcpy(&V[i * (32 * r)], X, 128 * r);
-
-		/* 4: X <-- H(X) */
-		blockmix_salsa8(X, Y, Z, r);
-
-		/* 3: V_i <-- X */
-		blkcpy(&V[(i + 1) * (32 * r)], Y, 128 * r);
-
-		/* 4: X <-- H(X) */
-		blockmix_salsa8(Y, X, Z, r);
-	}
-
-	/* 6: for i = 0 to N - 1 do */
-	for (i = 0; i < N; i += 2) {
-		/* 7: j <-- Integerify(X) mod N */
-		j = integerify(X, r) & (N - 1);
-
-		/* 8: X <-- H(X \xor V_j) */
-		blkxor(X, &V[j * (32 * r)], 128 * r);
-		blockmix_salsa8(X, Y, Z, r);
-
-		/* 7: j <-- Integerify(X) mod N */
-		j = integerify(Y, r) & (N - 1);
-
-		/* 8: X <-- H(X \xor V_j) */
-		blkxor(Y, &V[j * (32 * r)], 128 * r);
-		blockmix_salsa8(Y, X, Z, r);
-	}
-
-	/* 10: B' <-- X */
-	for (k = 0; k < 32 * r; k++)
-		le32enc(&B[4 * k], X[k]);
-}
+#include "../core/sha256_mb.h"
+#include "smix.h"
 
 /* cpu and memory intensive function to transform a 80 byte buffer into a 32 byte output
    scratchpad size needs to be at least 63 + (128 * r * p) + (256 * r + 64) + (128 * r * N) bytes
@@ -222,11 +44,12 @@ void scrypt_N_R_1_256_sp(const char* input, char* output, char* scratchpad, uint
 	uint8_t * B;
 	uint32_t * V;
 	uint32_t * XY;
-	uint32_t i;
+	size_t i;
 
 	//const uint32_t N = 1024;
-	uint32_t r=R;
-	const uint32_t p = 1;
+	/* size_t so that the offsets and lengths below cannot wrap */
+	size_t r=R;
+	const size_t p = 1;
 
 	B = (uint8_t *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
 	XY = (uint32_t *)(B + (128 * r * p));
@@ -238,21 +61,69 @@ void scrypt_N_R_1_256_sp(const char* input, char* output, char* scratchpad, uint
 	/* 2: for i = 0 to p - 1 do */
 	for (i = 0; i < p; i++) {
 		/* 3: B_i <-- MF(B_i, N) */
-		smix(&B[i * 128 * r], r, N, V, XY);
+		scrypt_smix(&B[i * 128 * r], r, N, V, XY);
 	}
 
 	/* 5: DK <-- PBKDF2(P, B, 1, dkLen) */
 	PBKDF2_SHA256((const uint8_t*)input, len, B, p * 128 * r, 1, (uint8_t*)output, 32);
 }
 
-void scrypt_N_R_1_256(const char* input, char* output, uint32_t N, uint32_t R, uint32_t len)
+/* Hash into scratch, which is grown on first use; -1 if it can't be. */
+int scrypt_N_R_1_256_ctx(core_scratch* scratch, const char* input, char* output, uint32_t N, uint32_t R, uint32_t len)
 {
-	//char scratchpad[131583];
-    char *scratchpad;
-    
-    // align on 4 byte boundary
-    scratchpad = (char*)malloc(128*N*R + (128*R)+(256*R)+64+64);
+	char *scratchpad;
+
+	if (!scratch || !(scratchpad = core_scratch_get(scratch, (size_t)128*N*R + (size_t)128*R + (size_t)256*R + 64)))
+		return -1;
 	scrypt_N_R_1_256_sp(input, output, scratchpad, N, R, len);
-    free(scratchpad);
+	return 0;
+}
+
+void scrypt_N_R_1_256(const char* input, char* output, uint32_t N, uint32_t R, uint32_t len)
+{
+	if (scrypt_N_R_1_256_ctx(core_scratch_thread(), input, output, N, R, len))
+		abort();
+}
+
+/*
+ * count inputs of len bytes at input, 32-byte hashes to output, as
+ * scrypt_1024_1_1_256_many does for N = 1024: PBKDF2 on the multi-buffer
+ * SHA-256 and scrypt_smix_lanes() interleaved smix lanes.
+ */
+int scrypt_N_R_1_256_many_ctx(core_scratch* scratch, const char* input, char* output, uint32_t N, uint32_t R, uint32_t len, uint32_t count)
+{
+	const uint8_t * P[SHA256_MB_LANES];
+	uint8_t * Bp[SHA256_MB_LANES];
+	uint8_t * O[SHA256_MB_LANES];
+	uint8_t * B;
+	uint32_t * V;
+	uint32_t * XY;
+	size_t lanes = scrypt_smix_lanes();
+	size_t r = R;
+	uint32_t i, m;
+
+	if (!scratch || !(B = core_scratch_get(scratch, SHA256_MB_LANES * 128 * r + (lanes * 256 * r + 64) + lanes * 128 * r * N)))
+		return -1;
+	XY = (uint32_t *)(B + SHA256_MB_LANES * 128 * r);
+	V = (uint32_t *)(B + SHA256_MB_LANES * 128 * r + (lanes * 256 * r + 64));
+
+	for (; count; count -= m, input += (size_t)len * m, output += 32 * m) {
+		m = (count < SHA256_MB_LANES) ? count : SHA256_MB_LANES;
+		for (i = 0; i < m; i++) {
+			P[i] = (const uint8_t *)input + (size_t)len * i;
+			Bp[i] = B + 128 * r * i;
+			O[i] = (uint8_t *)output + 32 * i;
+		}
+
+		pbkdf2_sha256_mb(P, len, P, len, Bp, 128 * r, m);
+		scrypt_smix_many(Bp, m, r, N, V, XY);
+		pbkdf2_sha256_mb(P, len, (const uint8_t * const *)Bp, 128 * r, O, 32, m);
+	}
+	return 0;
 }
 
+void scrypt_N_R_1_256_many(const char* input, char* output, uint32_t N, uint32_t R, uint32_t len, uint32_t count)
+{
+	if (scrypt_N_R_1_256_many_ctx(core_scratch_thread(), input, output, N, R, len, count))
+		abort();
+}
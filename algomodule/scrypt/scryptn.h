@@ -1,11 +1,16 @@
 #ifndef SCRYPTN_H
 #define SCRYPTN_H
 #include <stdint.h>
+#include "../core/scratch.h"
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* Uses the calling thread's scratch area; aborts if it cannot be allocated. */
 void scrypt_N_R_1_256(const char* input, char* output, uint32_t N, uint32_t R, uint32_t len);
+int scrypt_N_R_1_256_ctx(core_scratch* scratch, const char* input, char* output, uint32_t N, uint32_t R, uint32_t len);
+void scrypt_N_R_1_256_many(const char* input, char* output, uint32_t N, uint32_t R, uint32_t len, uint32_t count);
+int scrypt_N_R_1_256_many_ctx(core_scratch* scratch, const char* input, char* output, uint32_t N, uint32_t R, uint32_t len, uint32_t count);
 void scrypt_N_R_1_256_sp(const char* input, char* output, char* scratchpad, uint32_t N, uint32_t R, uint32_t len);
 //const int scrypt_scratchpad_size = 131583;
 
@@ -0,0 +1,543 @@
+/*-
+ * Copyright 2009 Colin Percival, 2011 ArtForz
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * This file was originally written by Colin Percival as part of the Tarsnap
+ * online backup system.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "../core/cpu.h"
+#include "smix.h"
+
+#ifdef CORE_CPU_X86
+#include <immintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#define SMIX_TARGET_SSE2	__attribute__((target("sse2")))
+#define SMIX_TARGET_AVX2	__attribute__((target("avx2")))
+#define SMIX_TARGET_AVX512	__attribute__((target("avx512f")))
+#else
+#define SMIX_TARGET_SSE2
+#define SMIX_TARGET_AVX2
+#define SMIX_TARGET_AVX512
+#endif
+#endif
+
+static __inline uint32_t
+le32dec(const void *pp)
+{
+	const uint8_t *p = (uint8_t const *)pp;
+
+	return ((uint32_t)(p[0]) + ((uint32_t)(p[1]) << 8) +
+	    ((uint32_t)(p[2]) << 16) + ((uint32_t)(p[3]) << 24));
+}
+
+static __inline void
+le32enc(void *pp, uint32_t x)
+{
+	uint8_t * p = (uint8_t *)pp;
+
+	p[0] = x & 0xff;
+	p[1] = (x >> 8) & 0xff;
+	p[2] = (x >> 16) & 0xff;
+	p[3] = (x >> 24) & 0xff;
+}
+
+/* Scalar */
+
+static void blkcpy(void *, void *, size_t);
+static void blkxor(void *, void *, size_t);
+static void salsa20_8(uint32_t[16]);
+static void blockmix_salsa8(uint32_t *, uint32_t *, uint32_t *, size_t);
+static uint64_t integerify(void *, size_t);
+
+static void
+blkcpy(void * dest, void * src, size_t len)
+{
+	uint32_t * D = dest;
+	uint32_t * S = src;
+	size_t L = len / sizeof(uint32_t);
+	size_t i;
+
+	for (i = 0; i < L; i++)
+		D[i] = S[i];
+}
+
+static void
+blkxor(void * dest, void * src, size_t len)
+{
+	uint32_t * D = dest;
+	uint32_t * S = src;
+	size_t L = len / sizeof(uint32_t);
+	size_t i;
+
+	for (i = 0; i < L; i++)
+		D[i] ^= S[i];
+}
+
+/**
+ * salsa20_8(B):
+ * Apply the salsa20/8 core to the provided block.
+ */
+static void
+salsa20_8(uint32_t B[16])
+{
+	uint32_t x[16];
+	size_t i;
+
+	blkcpy(x, B, 64);
+	for (i = 0; i < 8; i += 2) {
+#define R(a,b) (((a) << (b)) | ((a) >> (32 - (b))))
+		/* Operate on columns. */
+		x[ 4] ^= R(x[ 0]+x[12], 7);  x[ 8] ^= R(x[ 4]+x[ 0], 9);
+		x[12] ^= R(x[ 8]+x[ 4],13);  x[ 0] ^= R(x[12]+x[ 8],18);
+
+		x[ 9] ^= R(x[ 5]+x[ 1], 7);  x[13] ^= R(x[ 9]+x[ 5], 9);
+		x[ 1] ^= R(x[13]+x[ 9],13);  x[ 5] ^= R(x[ 1]+x[13],18);
+
+		x[14] ^= R(x[10]+x[ 6], 7);  x[ 2] ^= R(x[14]+x[10], 9);
+		x[ 6] ^= R(x[ 2]+x[14],13);  x[10] ^= R(x[ 6]+x[ 2],18);
+
+		x[ 3] ^= R(x[15]+x[11], 7);  x[ 7] ^= R(x[ 3]+x[15], 9);
+		x[11] ^= R(x[ 7]+x[ 3],13);  x[15] ^= R(x[11]+x[ 7],18);
+
+		/* Operate on rows. */
+		x[ 1] ^= R(x[ 0]+x[ 3], 7);  x[ 2] ^= R(x[ 1]+x[ 0], 9);
+		x[ 3] ^= R(x[ 2]+x[ 1],13);  x[ 0] ^= R(x[ 3]+x[ 2],18);
+
+		x[ 6] ^= R(x[ 5]+x[ 4], 7);  x[ 7] ^= R(x[ 6]+x[ 5], 9);
+		x[ 4] ^= R(x[ 7]+x[ 6],13);  x[ 5] ^= R(x[ 4]+x[ 7],18);
+
+		x[11] ^= R(x[10]+x[ 9], 7);  x[ 8] ^= R(x[11]+x[10], 9);
+		x[ 9] ^= R(x[ 8]+x[11],13);  x[10] ^= R(x[ 9]+x[ 8],18);
+
+		x[12] ^= R(x[15]+x[14], 7);  x[13] ^= R(x[12]+x[15], 9);
+		x[14] ^= R(x[13]+x[12],13);  x[15] ^= R(x[14]+x[13],18);
+#undef R
+	}
+	for (i = 0; i < 16; i++)
+		B[i] += x[i];
+}
+
+/**
+ * blockmix_salsa8(Bin, Bout, X, r):
+ * Compute Bout = BlockMix_{salsa20/8, r}(Bin).  The input Bin must be 128r
+ * bytes in length; the output Bout must also be the same size.  The
+ * temporary space X must be 64 bytes.
+ */
+static void
+blockmix_salsa8(uint32_t * Bin, uint32_t * Bout, uint32_t * X, size_t r)
+{
+	size_t i;
+
+	/* 1: X <-- B_{2r - 1} */
+	blkcpy(X, &Bin[(2 * r - 1) * 16], 64);
+
+	/* 2: for i = 0 to 2r - 1 do */
+	for (i = 0; i < 2 * r; i += 2) {
+		/* 3: X <-- H(X \xor B_i) */
+		blkxor(X, &Bin[i * 16], 64);
+		salsa20_8(X);
+
+		/* 4: Y_i <-- X */
+		/* 6: B' <-- (Y_0, Y_2 ... Y_{2r-2}, Y_1, Y_3 ... Y_{2r-1}) */
+		blkcpy(&Bout[i * 8], X, 64);
+
+		/* 3: X <-- H(X \xor B_i) */
+		blkxor(X, &Bin[i * 16 + 16], 64);
+		salsa20_8(X);
+
+		/* 4: Y_i <-- X */
+		/* 6: B' <-- (Y_0, Y_2 ... Y_{2r-2}, Y_1, Y_3 ... Y_{2r-1}) */
+		blkcpy(&Bout[i * 8 + r * 16], X, 64);
+	}
+}
+
+/**
+ * integerify(B, r):
+ * Return the result of parsing B_{2r-1} as a little-endian integer.
+ */
+static uint64_t
+integerify(void * B, size_t r)
+{
+	uint32_t * X = (void *)((uintptr_t)(B) + (2 * r - 1) * 64);
+
+	return (((uint64_t)(X[1]) << 32) + X[0]);
+}
+
+/* Portable SMix; see scrypt_smix() in smix.h for the contract. */
+static void
+smix_scalar(uint8_t * B, size_t r, uint64_t N, uint32_t * V, uint32_t * XY)
+{
+	uint32_t * X = XY;
+	uint32_t * Y = &XY[32 * r];
+	uint32_t * Z = &XY[64 * r];
+	uint64_t i;
+	uint64_t j;
+	size_t k;
+
+	/* 1: X <-- B */
+	for (k = 0; k < 32 * r; k++)
+		X[k] = le32dec(&B[4 * k]);
+
+	/* 2: for i = 0 to N - 1 do */
+	for (i = 0; i < N; i += 2) {
+		/* 3: V_i <-- X */
+		blkcpy(&V[i * (32 * r)], X, 128 * r);
+
+		/* 4: X <-- H(X) */
+		blockmix_salsa8(X, Y, Z, r);
+
+		/* 3: V_i <-- X */
+		blkcpy(&V[(i + 1) * (32 * r)], Y, 128 * r);
+
+		/* 4: X <-- H(X) */
+		blockmix_salsa8(Y, X, Z, r);
+	}
+
+	/* 6: for i = 0 to N - 1 do */
+	for (i = 0; i < N; i += 2) {
+		/* 7: j <-- Integerify(X) mod N */
+		j = integerify(X, r) & (N - 1);
+
+		/* 8: X <-- H(X \xor V_j) */
+		blkxor(X, &V[j * (32 * r)], 128 * r);
+		blockmix_salsa8(X, Y, Z, r);
+
+		/* 7: j <-- Integerify(X) mod N */
+		j = integerify(Y, r) & (N - 1);
+
+		/* 8: X <-- H(X \xor V_j) */
+		blkxor(Y, &V[j * (32 * r)], 128 * r);
+		blockmix_salsa8(Y, X, Z, r);
+	}
+
+	/* 10: B' <-- X */
+	for (k = 0; k < 32 * r; k++)
+		le32enc(&B[4 * k], X[k]);
+}
+
+#ifdef CORE_CPU_X86
+
+/* SSE2: one hash per vector */
+
+#define VEC		__m128i
+#define VADD		_mm_add_epi32
+#define VXOR		_mm_xor_si128
+#define VROTL(x, s)	_mm_or_si128(_mm_slli_epi32(x, s), _mm_srli_epi32(x, 32 - (s)))
+#define VSHUF		_mm_shuffle_epi32
+#define VLOAD_LANES(p, off)						\
+	_mm_load_si128((const __m128i *)((p)[0] + (off)))
+#define VSTORE_LANES(p, off, v)						\
+	_mm_store_si128((__m128i *)((p)[0] + (off)), v)
+#define SMIX_TARGET	SMIX_TARGET_SSE2
+#define SMIX_W		1
+
+#define SMIX_G		1
+#define SMIX_FN		smix_sse2
+#define SMIX_BLOCKMIX1	blockmix_salsa8_sse2
+#define SMIX_BLOCKMIX	blockmix_salsa8_sse2
+#include "smix_kernel.h"
+#undef SMIX_G
+#undef SMIX_FN
+#undef SMIX_BLOCKMIX
+#undef SMIX_BLOCKMIX1
+
+#define SMIX_G		2
+#define SMIX_FN		smix_sse2x2
+#define SMIX_BLOCKMIX1	blockmix_salsa8_sse2
+#define SMIX_BLOCKMIX	blockmix_salsa8_sse2x2
+#include "smix_kernel.h"
+#undef SMIX_G
+#undef SMIX_FN
+#undef SMIX_BLOCKMIX
+#undef SMIX_BLOCKMIX1
+
+#undef VEC
+#undef VADD
+#undef VXOR
+#undef VROTL
+#undef VSHUF
+#undef VLOAD_LANES
+#undef VSTORE_LANES
+#undef SMIX_TARGET
+#undef SMIX_W
+
+/* AVX2: two hashes per vector, one in each 128-bit half */
+
+#define VEC		__m256i
+#define VADD		_mm256_add_epi32
+#define VXOR		_mm256_xor_si256
+#define VROTL(x, s)	_mm256_or_si256(_mm256_slli_epi32(x, s), _mm256_srli_epi32(x, 32 - (s)))
+#define VSHUF		_mm256_shuffle_epi32
+#define VLOAD_LANES(p, off)						\
+	_mm256_inserti128_si256(_mm256_castsi128_si256(			\
+	    _mm_load_si128((const __m128i *)((p)[0] + (off)))),	\
+	    _mm_load_si128((const __m128i *)((p)[1] + (off))), 1)
+#define VSTORE_LANES(p, off, v) do {					\
+	_mm_store_si128((__m128i *)((p)[0] + (off)),			\
+	    _mm256_castsi256_si128(v));					\
+	_mm_store_si128((__m128i *)((p)[1] + (off)),			\
+	    _mm256_extracti128_si256(v, 1));				\
+} while (0)
+#define SMIX_TARGET	SMIX_TARGET_AVX2
+#define SMIX_W		2
+
+#define SMIX_G		1
+#define SMIX_FN		smix_avx2x2
+#define SMIX_BLOCKMIX1	blockmix_salsa8_avx2x2
+#define SMIX_BLOCKMIX	blockmix_salsa8_avx2x2
+#include "smix_kernel.h"
+#undef SMIX_G
+#undef SMIX_FN
+#undef SMIX_BLOCKMIX
+#undef SMIX_BLOCKMIX1
+
+#define SMIX_G		2
+#define SMIX_FN		smix_avx2x4
+#define SMIX_BLOCKMIX1	blockmix_salsa8_avx2x2
+#define SMIX_BLOCKMIX	blockmix_salsa8_avx2x4
+#include "smix_kernel.h"
+#undef SMIX_G
+#undef SMIX_FN
+#undef SMIX_BLOCKMIX
+#undef SMIX_BLOCKMIX1
+
+#undef VEC
+#undef VADD
+#undef VXOR
+#undef VROTL
+#undef VSHUF
+#undef VLOAD_LANES
+#undef VSTORE_LANES
+#undef SMIX_TARGET
+#undef SMIX_W
+
+/* AVX-512: four hashes per vector, one in each 128-bit lane */
+
+#define VEC		__m512i
+#define VADD		_mm512_add_epi32
+#define VXOR		_mm512_xor_si512
+#define VROTL		_mm512_rol_epi32
+#define VSHUF(x, imm)	_mm512_shuffle_epi32(x, (_MM_PERM_ENUM)(imm))
+#define VLOAD_LANES(p, off)						\
+	_mm512_inserti32x4(_mm512_inserti32x4(_mm512_inserti32x4(	\
+	    _mm512_castsi128_si512(					\
+	    _mm_load_si128((const __m128i *)((p)[0] + (off)))),	\
+	    _mm_load_si128((const __m128i *)((p)[1] + (off))), 1),	\
+	    _mm_load_si128((const __m128i *)((p)[2] + (off))), 2),	\
+	    _mm_load_si128((const __m128i *)((p)[3] + (off))), 3)
+#define VSTORE_LANES(p, off, v) do {					\
+	_mm_store_si128((__m128i *)((p)[0] + (off)),			\
+	    _mm512_castsi512_si128(v));					\
+	_mm_store_si128((__m128i *)((p)[1] + (off)),			\
+	    _mm512_extracti32x4_epi32(v, 1));				\
+	_mm_store_si128((__m128i *)((p)[2] + (off)),			\
+	    _mm512_extracti32x4_epi32(v, 2));				\
+	_mm_store_si128((__m128i *)((p)[3] + (off)),			\
+	    _mm512_extracti32x4_epi32(v, 3));				\
+} while (0)
+#define SMIX_TARGET	SMIX_TARGET_AVX512
+#define SMIX_W		4
+
+#define SMIX_G		1
+#define SMIX_FN		smix_avx512x4
+#define SMIX_BLOCKMIX1	blockmix_salsa8_avx512x4
+#define SMIX_BLOCKMIX	blockmix_salsa8_avx512x4
+#include "smix_kernel.h"
+#undef SMIX_G
+#undef SMIX_FN
+#undef SMIX_BLOCKMIX
+#undef SMIX_BLOCKMIX1
+
+#define SMIX_G		2
+#define SMIX_FN		smix_avx512x8
+#define SMIX_BLOCKMIX1	blockmix_salsa8_avx512x4
+#define SMIX_BLOCKMIX	blockmix_salsa8_avx512x8
+#include "smix_kernel.h"
+#undef SMIX_G
+#undef SMIX_FN
+#undef SMIX_BLOCKMIX
+#undef SMIX_BLOCKMIX1
+
+#undef VEC
+#undef VADD
+#undef VXOR
+#undef VROTL
+#undef VSHUF
+#undef VLOAD_LANES
+#undef VSTORE_LANES
+#undef SMIX_TARGET
+#undef SMIX_W
+
+#endif /* CORE_CPU_X86 */
+
+/* Dispatch */
+
+/*
+ * Combined V (all lanes of a pass) above which the random V_j reads mostly
+ * miss the last-level cache and staggering the vectors to overlap those
+ * misses beats lockstep.  Measured crossover on a large-L3 Xeon: lockstep
+ * is ~9% ahead at 16 MiB, the pipeline 10-18% ahead from 32 MiB up.
+ */
+#define SMIX_PIPELINE_BYTES	(16 * 1024 * 1024)
+
+static int smix_forced;
+
+static int
+smix_strategy(size_t lanes, size_t r, uint64_t N)
+{
+
+	if (smix_forced != SCRYPT_SMIX_AUTO)
+		return smix_forced;
+	if (lanes * 128 * r * N <= SMIX_PIPELINE_BYTES)
+		return SCRYPT_SMIX_LOCKSTEP;
+	return SCRYPT_SMIX_PIPELINE;
+}
+
+typedef void (*smix_many_fn)(uint8_t * const *, size_t, uint64_t,
+    uint32_t * const *, uint32_t *, int);
+
+struct smix_kernel {
+	smix_many_fn fn;
+	size_t lanes;
+	unsigned int cpu;
+	const char *name;
+};
+
+static void
+smix_many_scalar(uint8_t * const * B, size_t r, uint64_t N,
+    uint32_t * const * V, uint32_t * XY, int strategy)
+{
+
+	smix_scalar(B[0], r, N, V[0], XY);
+}
+
+/* Widest first; the first kernel the CPU supports is the preferred one. */
+static const struct smix_kernel smix_kernels[] = {
+#ifdef CORE_CPU_X86
+	{ smix_avx512x8, 8, CPU_FEATURE_AVX512F, "avx512x8" },
+	{ smix_avx512x4, 4, CPU_FEATURE_AVX512F, "avx512x4" },
+	{ smix_avx2x4, 4, CPU_FEATURE_AVX2, "avx2x4" },
+	{ smix_avx2x2, 2, CPU_FEATURE_AVX2, "avx2x2" },
+	{ smix_sse2x2, 2, CPU_FEATURE_SSE2, "sse2x2" },
+	{ smix_sse2, 1, CPU_FEATURE_SSE2, "sse2" },
+#endif
+	{ smix_many_scalar, 1, 0, "scalar" },
+};
+
+#define SMIX_NKERNELS	(sizeof(smix_kernels) / sizeof(smix_kernels[0]))
+
+/* Supported kernels, widest first, ending with a single-lane one. */
+static const struct smix_kernel *smix_impl[SMIX_NKERNELS];
+static size_t smix_nimpl;
+
+/* Preferred single-lane kernel. */
+static const struct smix_kernel *smix_single;
+
+static void
+smix_select(void)
+{
+	unsigned int cpu = core_cpu_features();
+
+	const struct smix_kernel *single = NULL;
+	size_t i, n = 0;
+
+	for (i = 0; i < SMIX_NKERNELS; i++)
+		if ((cpu & smix_kernels[i].cpu) == smix_kernels[i].cpu) {
+			smix_impl[n++] = &smix_kernels[i];
+			if (!single && smix_kernels[i].lanes == 1)
+				single = &smix_kernels[i];
+		}
+	/* Every thread resolves the same table, so the race is benign. */
+	smix_single = single;
+	smix_nimpl = n;
+}
+
+void
+scrypt_smix(uint8_t * B, size_t r, uint64_t N, uint32_t * V, uint32_t * XY)
+{
+
+	if (!smix_nimpl)
+		smix_select();
+	smix_single->fn(&B, r, N, &V, XY, smix_strategy(1, r, N));
+}
+
+size_t
+scrypt_smix_lanes(void)
+{
+
+	if (!smix_nimpl)
+		smix_select();
+	return smix_impl[0]->lanes;
+}
+
+void
+scrypt_smix_many(uint8_t * const * B, size_t n, size_t r, uint64_t N,
+    uint32_t * V, uint32_t * XY)
+{
+	uint32_t * Vl[SCRYPT_SMIX_MAX_LANES];
+	const struct smix_kernel *k;
+	size_t i, l;
+
+	if (!smix_nimpl)
+		smix_select();
+	for (l = 0; l < SCRYPT_SMIX_MAX_LANES; l++)
+		Vl[l] = V + l * (32 * r) * N;
+
+	/* Widest kernel that fits what is left, down to one lane. */
+	for (i = 0; n; n -= k->lanes, B += k->lanes) {
+		while (smix_impl[i]->lanes > n)
+			i++;
+		k = smix_impl[i];
+		k->fn(B, r, N, Vl, XY, smix_strategy(k->lanes, r, N));
+	}
+}
+
+const char *
+scrypt_smix_backend(void)
+{
+
+	if (!smix_nimpl)
+		smix_select();
+	return smix_single->name;
+}
+
+const char *
+scrypt_smix_many_backend(void)
+{
+
+	if (!smix_nimpl)
+		smix_select();
+	return smix_impl[0]->name;
+}
+
+void
+scrypt_smix_set_strategy(int strategy)
+{
+
+	smix_forced = strategy;
+}
@@ -0,0 +1,73 @@
+#ifndef SMIX_H
+#define SMIX_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Shared scrypt SMix backend.  The Salsa20/8 implementation (scalar, SSE2,
+ * AVX2 or AVX-512) is picked from core_cpu_features() on first call.
+ */
+
+/* Most hashes a single scrypt_smix_many() pass runs side by side. */
+#define SCRYPT_SMIX_MAX_LANES 8
+
+/**
+ * scrypt_smix(B, r, N, V, XY):
+ * Compute B = SMix_r(B, N).  The input B must be 128r bytes in length;
+ * the temporary storage V must be 128rN bytes in length; the temporary
+ * storage XY must be 256r + 64 bytes in length.  The value N must be a
+ * power of 2 greater than 1 and at most 2^32.  The arrays B, V, and XY
+ * must be aligned to a multiple of 64 bytes.
+ */
+void scrypt_smix(uint8_t *B, size_t r, uint64_t N, uint32_t *V,
+    uint32_t *XY);
+
+/*
+ * Hashes the selected multi-hash kernel interleaves, at most
+ * SCRYPT_SMIX_MAX_LANES.  scrypt_smix_many() needs V and XY sized for this
+ * many lanes.
+ */
+size_t scrypt_smix_lanes(void);
+
+/*
+ * B[i] = SMix_r(B[i], N) for i < n.  V must be lanes * 128rN bytes and XY
+ * lanes * 256r + 64 bytes, with lanes = scrypt_smix_lanes(); both must be
+ * aligned to 64 bytes.  B[i] need not be aligned.  The widest kernel that
+ * fits the remaining hashes runs each pass.
+ */
+void scrypt_smix_many(uint8_t *const *B, size_t n, size_t r, uint64_t N,
+    uint32_t *V, uint32_t *XY);
+
+/*
+ * How the second SMix loop reads V_j: vectors in lockstep without
+ * prefetching, in lockstep with every lane's V_j prefetched before BlockMix,
+ * or staggered so one vector's prefetch overlaps the others' BlockMix.
+ * SCRYPT_SMIX_AUTO runs lockstep until the combined V of a pass outgrows
+ * what the last-level cache can hold for one core, and the staggered
+ * pipeline beyond that.
+ */
+#define SCRYPT_SMIX_AUTO	0
+#define SCRYPT_SMIX_LOCKSTEP	1
+#define SCRYPT_SMIX_PREFETCH	2
+#define SCRYPT_SMIX_PIPELINE	3
+
+/* Override the strategy process-wide; meant for benchmarking. */
+void scrypt_smix_set_strategy(int strategy);
+
+/*
+ * Name of the selected kernels: "scalar", "sse2", and for the multi-hash
+ * path the instruction set and lane count, e.g. "avx2x4" or "avx512x8".
+ */
+const char *scrypt_smix_backend(void);
+const char *scrypt_smix_many_backend(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,233 @@
+/*
+ * Vector SMix template, included by smix.c once per instruction set.  Each
+ * hash's 64-byte Salsa20 state occupies one 128-bit row per quarter, stored
+ * in the shuffled (diagonal) order of Percival's SSE2 code: row q of a
+ * block holds words 5 * (4q + e) mod 16, so the column and row rounds only
+ * need whole-row rotates.  Wider vectors carry the same row for SMIX_W
+ * hashes in their 128-bit lanes, and SMIX_G such vectors are run in
+ * lockstep to hide the Salsa20 dependency chain.
+ *
+ * The includer defines:
+ *   SMIX_FN, SMIX_BLOCKMIX	names of the generated functions
+ *   SMIX_BLOCKMIX1		the SMIX_G = 1 BlockMix of the same instruction
+ *				set, used to stagger vectors
+ *   SMIX_TARGET		function attribute enabling the instruction set
+ *   SMIX_W, SMIX_G		hashes per vector, vectors in lockstep
+ *   VEC, VADD, VXOR, VROTL, VSHUF	vector type and 32-bit lane operations
+ *   VLOAD_LANES(p, off), VSTORE_LANES(p, off, v)
+ *				word offset off of the SMIX_W per-hash
+ *				regions p[0 .. SMIX_W - 1], 16-byte aligned
+ */
+
+#define SMIX_LANES	(SMIX_W * SMIX_G)
+
+/* X[a] ^= (X[b] + X[c]) <<< s, for every vector in the group. */
+#define SALSA(a, b, c, s)						\
+	for (g = 0; g < SMIX_G; g++)					\
+		X[g][a] = VXOR(X[g][a], VROTL(VADD(X[g][b], X[g][c]), s))
+
+/**
+ * Bout = BlockMix_{salsa20/8, r}(Bin ^ V_j), where V_j is skipped when Vj
+ * is NULL.  Bin and Bout hold SMIX_G runs of 8r vectors.
+ */
+SMIX_TARGET static void
+SMIX_BLOCKMIX(const VEC * Bin, VEC * Bout, const uint32_t * const * Vj,
+    size_t r)
+{
+	VEC X[SMIX_G][4], S[SMIX_G][4], T;
+	size_t rows = 8 * r, last = (2 * r - 1) * 4;
+	size_t b, g, q, o;
+	int i;
+
+	/* 1: X <-- B_{2r - 1} */
+	for (g = 0; g < SMIX_G; g++)
+		for (q = 0; q < 4; q++) {
+			X[g][q] = Bin[g * rows + last + q];
+			if (Vj)
+				X[g][q] = VXOR(X[g][q],
+				    VLOAD_LANES(&Vj[g * SMIX_W], (last + q) * 4));
+		}
+
+	/* 2: for i = 0 to 2r - 1 do */
+	for (b = 0; b < 2 * r; b++) {
+		/* 3: X <-- H(X \xor B_i) */
+		for (g = 0; g < SMIX_G; g++)
+			for (q = 0; q < 4; q++) {
+				T = Bin[g * rows + b * 4 + q];
+				if (Vj)
+					T = VXOR(T, VLOAD_LANES(&Vj[g * SMIX_W],
+					    (b * 4 + q) * 4));
+				X[g][q] = VXOR(X[g][q], T);
+				S[g][q] = X[g][q];
+			}
+		for (i = 0; i < 8; i += 2) {
+			/* Operate on columns. */
+			SALSA(1, 0, 3, 7);
+			SALSA(2, 1, 0, 9);
+			SALSA(3, 2, 1, 13);
+			SALSA(0, 3, 2, 18);
+
+			/* Rearrange data. */
+			for (g = 0; g < SMIX_G; g++) {
+				X[g][1] = VSHUF(X[g][1], 0x93);
+				X[g][2] = VSHUF(X[g][2], 0x4E);
+				X[g][3] = VSHUF(X[g][3], 0x39);
+			}
+
+			/* Operate on rows. */
+			SALSA(3, 0, 1, 7);
+			SALSA(2, 3, 0, 9);
+			SALSA(1, 2, 3, 13);
+			SALSA(0, 1, 2, 18);
+
+			/* Rearrange data. */
+			for (g = 0; g < SMIX_G; g++) {
+				X[g][1] = VSHUF(X[g][1], 0x39);
+				X[g][2] = VSHUF(X[g][2], 0x4E);
+				X[g][3] = VSHUF(X[g][3], 0x93);
+			}
+		}
+
+		/* 4: Y_i <-- X */
+		/* 6: B' <-- (Y_0, Y_2 ... Y_{2r-2}, Y_1, Y_3 ... Y_{2r-1}) */
+		o = ((b & 1) ? r + b / 2 : b / 2) * 4;
+		for (g = 0; g < SMIX_G; g++)
+			for (q = 0; q < 4; q++) {
+				X[g][q] = VADD(X[g][q], S[g][q]);
+				Bout[g * rows + o + q] = X[g][q];
+			}
+	}
+}
+
+/**
+ * B[l] = SMix_r(B[l], N) for the SMIX_LANES hashes l; V[l] is the 128rN
+ * byte region of hash l.  XY holds 256r * SMIX_LANES bytes.  strategy
+ * is one of the SCRYPT_SMIX_* V-read strategies from smix.h.
+ */
+SMIX_TARGET static void
+SMIX_FN(uint8_t * const * B, size_t r, uint64_t N, uint32_t * const * V,
+    uint32_t * XY, int strategy)
+{
+	VEC * X = (VEC *)XY;
+	VEC * Y = X + SMIX_G * 8 * r;
+	const uint32_t * Vj[SMIX_LANES];
+	uint32_t * Vi[SMIX_LANES];
+	size_t rows = 8 * r, words = 32 * r;
+	size_t l, k, g, w, pos;
+	uint32_t * x;
+	uint64_t i;
+
+	/* 1: X <-- B */
+	for (l = 0; l < SMIX_LANES; l++) {
+		g = l / SMIX_W;
+		w = l % SMIX_W;
+		for (k = 0; k < words; k++) {
+			pos = k % 16;
+			x = (uint32_t *)&X[g * rows + (k / 16) * 4 + pos / 4];
+			x[w * 4 + pos % 4] = le32dec(&B[l][4 *
+			    ((k & ~(size_t)15) + (pos * 5) % 16)]);
+		}
+	}
+
+	/* 2: for i = 0 to N - 1 do */
+	for (i = 0; i < N; i += 2) {
+		/* 3: V_i <-- X */
+		for (l = 0; l < SMIX_LANES; l++)
+			Vi[l] = V[l] + i * words;
+		for (g = 0; g < SMIX_G; g++)
+			for (k = 0; k < rows; k++)
+				VSTORE_LANES(&Vi[g * SMIX_W], k * 4,
+				    X[g * rows + k]);
+
+		/* 4: X <-- H(X) */
+		SMIX_BLOCKMIX(X, Y, NULL, r);
+
+		/* 3: V_i <-- X */
+		for (l = 0; l < SMIX_LANES; l++)
+			Vi[l] += words;
+		for (g = 0; g < SMIX_G; g++)
+			for (k = 0; k < rows; k++)
+				VSTORE_LANES(&Vi[g * SMIX_W], k * 4,
+				    Y[g * rows + k]);
+
+		/* 4: X <-- H(X) */
+		SMIX_BLOCKMIX(Y, X, NULL, r);
+	}
+
+	/*
+	 * Integerify only needs word 0 of B_{2r-1}, which the shuffle leaves
+	 * in place; N <= 2^32 makes the high word irrelevant.
+	 */
+#define INTEGERIFY(Z, l)						\
+	((const uint32_t *)&(Z)[((l) / SMIX_W) * rows + (2 * r - 1) * 4])\
+	    [((l) % SMIX_W) * 4]
+
+	/* 7: j <-- Integerify(X) mod N, for lanes l0 .. l1 - 1 */
+#define SMIX_NEXT_J(Z, l0, l1) do {					\
+	for (l = (l0); l < (l1); l++) {					\
+		Vj[l] = V[l] + (INTEGERIFY(Z, l) & (N - 1)) * words;	\
+		if (strategy != SCRYPT_SMIX_LOCKSTEP)			\
+			for (k = 0; k < words; k += 16)			\
+				_mm_prefetch((const char *)(Vj[l] + k),	\
+				    _MM_HINT_T0);			\
+	}								\
+} while (0)
+
+	if (SMIX_G > 1 && strategy == SCRYPT_SMIX_PIPELINE) {
+		/*
+		 * Stagger the vectors instead of running them in lockstep: a
+		 * vector's next V_j is prefetched as soon as its BlockMix ends,
+		 * and the other vectors' BlockMix runs before it is read.
+		 */
+		SMIX_NEXT_J(X, 0, SMIX_LANES);
+
+		/* 6: for i = 0 to N - 1 do */
+		for (i = 0; i < N; i += 2) {
+			/* 8: X <-- H(X \xor V_j) */
+			for (g = 0; g < SMIX_G; g++) {
+				SMIX_BLOCKMIX1(X + g * rows, Y + g * rows,
+				    &Vj[g * SMIX_W], r);
+				SMIX_NEXT_J(Y, g * SMIX_W, (g + 1) * SMIX_W);
+			}
+
+			/* 8: X <-- H(X \xor V_j) */
+			for (g = 0; g < SMIX_G; g++) {
+				SMIX_BLOCKMIX1(Y + g * rows, X + g * rows,
+				    &Vj[g * SMIX_W], r);
+				SMIX_NEXT_J(X, g * SMIX_W, (g + 1) * SMIX_W);
+			}
+		}
+	} else {
+		/* 6: for i = 0 to N - 1 do */
+		for (i = 0; i < N; i += 2) {
+			/* 7: j <-- Integerify(X) mod N */
+			SMIX_NEXT_J(X, 0, SMIX_LANES);
+
+			/* 8: X <-- H(X \xor V_j) */
+			SMIX_BLOCKMIX(X, Y, Vj, r);
+
+			/* 7: j <-- Integerify(X) mod N */
+			SMIX_NEXT_J(Y, 0, SMIX_LANES);
+
+			/* 8: X <-- H(X \xor V_j) */
+			SMIX_BLOCKMIX(Y, X, Vj, r);
+		}
+	}
+#undef SMIX_NEXT_J
+#undef INTEGERIFY
+
+	/* 10: B' <-- X */
+	for (l = 0; l < SMIX_LANES; l++) {
+		g = l / SMIX_W;
+		w = l % SMIX_W;
+		for (k = 0; k < words; k++) {
+			pos = k % 16;
+			x = (uint32_t *)&X[g * rows + (k / 16) * 4 + pos / 4];
+			le32enc(&B[l][4 * ((k & ~(size_t)15) + (pos * 5) % 16)],
+			    x[w * 4 + pos % 4]);
+		}
+	}
+}
+
+#undef SALSA
+#undef SMIX_LANES
@@ -0,0 +1,41 @@
+from libc.stdint cimport uint32_t, int64_t, uint8_t, uint64_t
+from libc.stdlib cimport malloc, free
+from libc.string cimport memcpy
+
+cdef extern from "core/sha256_mb.h":
+	extern void sha256d_many(const unsigned char* input, size_t input_len, size_t count, unsigned char* output) nogil;
+
+cdef extern from "core/sha256_transform.h":
+	extern const char* sha256_transform_backend();
+	extern const char* sha256_transform_mb_backend();
+
+def _sha256d_hash(hash):
+	cdef unsigned char output[32];
+	cdef const unsigned char* input = hash;
+	sha256d_many(input, len(hash), 1, output);
+	return output[:32];
+
+def _sha256d_hash_many(hashes):
+	hashes = list(hashes);
+	cdef uint32_t count = len(hashes);
+	if count == 0:
+		return [];
+	cdef uint32_t input_len = len(hashes[0]);
+	for h in hashes:
+		if len(h) != input_len:
+			raise ValueError("all inputs must have the same length");
+	cdef bytes data = b''.join(hashes);
+	cdef const unsigned char* input = data;
+	cdef unsigned char* output = <unsigned char*>malloc(count * 32);
+	if not output:
+		raise MemoryError();
+	try:
+		with nogil:
+			sha256d_many(input, input_len, count, output);
+		result = output[:count * 32];
+	finally:
+		free(output);
+	return [result[i * 32:(i + 1) * 32] for i in range(count)];
+
+def backend():
+	return (sha256_transform_backend().decode(), sha256_transform_mb_backend().decode());
@@ -4,9 +4,46 @@ from libc.string cimport memcpy
 
 cdef extern from "shavite3/shavite3.h":
 	extern void shavite3_hash(const char* input, char* output, uint32_t input_len);
+	ctypedef struct shavite3_context:
+		pass
+	extern void shavite3_init(shavite3_context* ctx);
+	extern void shavite3_update(shavite3_context* ctx, const void* input, size_t len);
+	extern void shavite3_digest(const shavite3_context* ctx, char* output);
 
 def _shavite3_hash(hash):
 	cdef char output[32];
 	cdef uint32_t input_len = len(hash);
 	shavite3_hash(hash, output, input_len);
-	return output[:32];
\ No newline at end of file
+	return output[:32];
+
+cdef class Shavite3Hash:
+	cdef shavite3_context ctx
+
+	name = 'shavite3'
+	digest_size = 32
+
+	def __cinit__(self):
+		shavite3_init(&self.ctx);
+
+	def update(self, const unsigned char[::1] data):
+		if data.shape[0] > 0:
+			shavite3_update(&self.ctx, &data[0], data.shape[0]);
+
+	def copy(self):
+		cdef Shavite3Hash other = Shavite3Hash.__new__(Shavite3Hash);
+		other.ctx = self.ctx;
+		return other;
+
+	def digest(self):
+		cdef char output[32];
+		shavite3_digest(&self.ctx, output);
+		return output[:32];
+
+	def hexdigest(self):
+		return self.digest().hex();
+
+def new(data=None):
+	h = Shavite3Hash();
+	if data is not None:
+		h.update(data);
+	return h;
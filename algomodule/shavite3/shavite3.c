@@ -22,3 +22,26 @@ void shavite3_hash(const char* input, char* output, uint32_t len)
     memcpy(output, &hash2, 32);
 }
 
+void shavite3_init(shavite3_context* ctx)
+{
+    sph_shavite512_init(ctx);
+}
+
+void shavite3_update(shavite3_context* ctx, const void* input, size_t len)
+{
+    sph_shavite512(ctx, input, len);
+}
+
+/* Finalises a copy of the context, so ctx may keep absorbing data. */
+void shavite3_digest(const shavite3_context* ctx, char* output)
+{
+    char hash1[64];
+    char hash2[64];
+
+    shavite3_context ctx_shavite = *ctx;
+    sph_shavite512_close(&ctx_shavite, (void*) &hash1);
+
+    sph_shavite512(&ctx_shavite, (const void*) &hash1, 64);
+    sph_shavite512_close(&ctx_shavite, (void*) &hash2);
+    memcpy(output, &hash2, 32);
+}
@@ -5,10 +5,21 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include "../sha3/sph_shavite.h"
+
 void shavite3_hash(const char* input, char* output, uint32_t len);
 
+/* Incremental interface.  The context is a plain sph struct, so it can be
+   copied by assignment to fork a partially absorbed message. */
+typedef sph_shavite512_context shavite3_context;
+
+void shavite3_init(shavite3_context* ctx);
+void shavite3_update(shavite3_context* ctx, const void* input, size_t len);
+void shavite3_digest(const shavite3_context* ctx, char* output);
+
 #ifdef __cplusplus
 }
 #endif
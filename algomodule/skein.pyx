@@ -4,9 +4,69 @@ from libc.string cimport memcpy
 
 cdef extern from "skein/skein.h":
 	extern void skein_hash(const char* input, char* output, uint32_t input_len);
+	extern void skein_hash_many(const char* input, char* output, uint32_t input_len, uint32_t count) nogil;
+	ctypedef struct skein_context:
+		pass
+	extern void skein_init(skein_context* ctx);
+	extern void skein_update(skein_context* ctx, const void* input, size_t len);
+	extern void skein_digest(const skein_context* ctx, char* output);
 
 def _skein_hash(hash):
 	cdef char output[32];
 	cdef uint32_t input_len = len(hash);
 	skein_hash(hash, output, input_len);
-	return output[:32];
\ No newline at end of file
+	return output[:32];
+
+def _skein_hash_many(hashes):
+	hashes = list(hashes);
+	cdef uint32_t count = len(hashes);
+	if count == 0:
+		return [];
+	cdef uint32_t input_len = len(hashes[0]);
+	for h in hashes:
+		if len(h) != input_len:
+			raise ValueError("all inputs must have the same length");
+	cdef bytes data = b''.join(hashes);
+	cdef const char* input = data;
+	cdef char* output = <char*>malloc(count * 32);
+	if not output:
+		raise MemoryError();
+	try:
+		with nogil:
+			skein_hash_many(input, output, input_len, count);
+		result = output[:count * 32];
+	finally:
+		free(output);
+	return [result[i * 32:(i + 1) * 32] for i in range(count)];
+
+cdef class SkeinHash:
+	cdef skein_context ctx
+
+	name = 'skein'
+	digest_size = 32
+
+	def __cinit__(self):
+		skein_init(&self.ctx);
+
+	def update(self, const unsigned char[::1] data):
+		if data.shape[0] > 0:
+			skein_update(&self.ctx, &data[0], data.shape[0]);
+
+	def copy(self):
+		cdef SkeinHash other = SkeinHash.__new__(SkeinHash);
+		other.ctx = self.ctx;
+		return other;
+
+	def digest(self):
+		cdef char output[32];
+		skein_digest(&self.ctx, output);
+		return output[:32];
+
+	def hexdigest(self):
+		return self.digest().hex();
+
+def new(data=None):
+	h = SkeinHash();
+	if data is not None:
+		h.update(data);
+	return h;
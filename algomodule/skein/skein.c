@@ -6,6 +6,7 @@
 
 #include "../sha3/sph_skein.h"
 #include "../core/sha256.h"
+#include "../core/sha256_mb.h"
 
 #include <stdlib.h>
 
@@ -24,3 +25,45 @@ void skein_hash(const char* input, char* output, uint32_t len)
     SHA256_Final((unsigned char*) output, &ctx_sha256);
 }
 
+/* Skein-512 per message, then the final SHA-256 over SHA256_MB_LANES
+   digests at a time through the multi-buffer transform. */
+void skein_hash_many(const char* input, char* output, uint32_t len, uint32_t count)
+{
+    unsigned char temp[SHA256_MB_LANES * 64];
+    uint32_t i, m;
+
+    for (; count; count -= m, input += (size_t)len * m, output += 32 * m) {
+        m = (count < SHA256_MB_LANES) ? count : SHA256_MB_LANES;
+        for (i = 0; i < m; i++) {
+            sph_skein512_context ctx_skien;
+            sph_skein512_init(&ctx_skien);
+            sph_skein512(&ctx_skien, input + (size_t)len * i, len);
+            sph_skein512_close(&ctx_skien, temp + 64 * i);
+        }
+        sha256_many(temp, 64, m, (unsigned char*) output);
+    }
+}
+
+void skein_init(skein_context* ctx)
+{
+    sph_skein512_init(ctx);
+}
+
+void skein_update(skein_context* ctx, const void* input, size_t len)
+{
+    sph_skein512(ctx, input, len);
+}
+
+/* Finalises a copy of the context, so ctx may keep absorbing data. */
+void skein_digest(const skein_context* ctx, char* output)
+{
+    char temp[64];
+
+    skein_context ctx_skien = *ctx;
+    sph_skein512_close(&ctx_skien, &temp);
+
+    SHA256_CTX ctx_sha256;
+    SHA256_Init(&ctx_sha256);
+    SHA256_Update(&ctx_sha256, &temp, 64);
+    SHA256_Final((unsigned char*) output, &ctx_sha256);
+}
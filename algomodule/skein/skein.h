@@ -5,9 +5,21 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include "../sha3/sph_skein.h"
+
 void skein_hash(const char* input, char* output, uint32_t len);
+void skein_hash_many(const char* input, char* output, uint32_t len, uint32_t count);
+
+/* Incremental interface.  The context is a plain sph struct, so it can be
+   copied by assignment to fork a partially absorbed message. */
+typedef sph_skein512_context skein_context;
+
+void skein_init(skein_context* ctx);
+void skein_update(skein_context* ctx, const void* input, size_t len);
+void skein_digest(const skein_context* ctx, char* output);
 
 #ifdef __cplusplus
 }
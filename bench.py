@@ -0,0 +1,428 @@
+#!/usr/bin/python3
+import ctypes
+import hashlib
+import os
+import resource
+import struct
+import sys
+import tempfile
+import threading
+import time
+import algomodule
+
+
+def rate(fn, count, min_time=1.0):
+    runs = 0
+    start = time.perf_counter()
+    while True:
+        fn()
+        runs += 1
+        elapsed = time.perf_counter() - start
+        if elapsed >= min_time:
+            return runs * count / elapsed
+
+
+def cache_miss_counter(cache):
+    """perf_event_open() counter of this thread's read misses of a
+    PERF_COUNT_HW_CACHE_* cache, or None."""
+    if not sys.platform.startswith('linux') or os.uname().machine != 'x86_64':
+        return None
+    # perf_event_attr (PERF_ATTR_SIZE_VER0): type, size, config, ..., flags
+    # with disabled = 0 and exclude_kernel | exclude_hv set.
+    config = cache | (0 << 8) | (1 << 16)  # cache, read, miss
+    attr = struct.pack('IIQQQQQ', 3, 64, config, 0, 0, 0, (1 << 5) | (1 << 6))
+    attr += bytes(64 - len(attr))
+    libc = ctypes.CDLL(None, use_errno=True)
+    fd = libc.syscall(298, attr, 0, -1, -1, 0)
+    if fd < 0:
+        return None
+    return lambda: struct.unpack('Q', os.read(fd, 8))[0]
+
+
+def llc_miss_counter():
+    return cache_miss_counter(2)  # PERF_COUNT_HW_CACHE_LL
+
+
+def dtlb_miss_counter():
+    return cache_miss_counter(3)  # PERF_COUNT_HW_CACHE_DTLB
+
+
+def bench_meraki():
+    meraki = algomodule.meraki
+    block = 3 * 27500 + 17
+    header = os.urandom(32)
+
+    # The first call builds the epoch's light cache; later ones reuse it.
+    start = time.perf_counter()
+    final, mix = meraki.hash(block, header, 0)
+    print('meraki epoch context built in %.2f s' % (time.perf_counter() - start))
+    assert meraki._meraki_hash(header, mix, 0) == final
+
+    # A pool checks each share: the claimed final hash alone (light_verify),
+    # the full mix recomputation of an accepted share, and a share whose
+    # final hash misses the boundary and is rejected before the mix.
+    shares = [(n,) + meraki.hash(block, header, n) for n in range(64)]
+    final_only = lambda: [meraki._meraki_hash(header, m, n) for n, f, m in shares]
+    # The same final hashes in one light_verify_many() call, 16 at a time.
+    nonces, finals, mixes = zip(*shares)
+    final_batch = lambda: meraki.light_verify_many([header] * len(shares), mixes, nonces)
+    assert final_batch() == list(finals)
+    accept = lambda: [meraki.verify(block, header, m, n, b'\xff' * 32)
+                      for n, f, m in shares]
+    reject = lambda: [meraki.verify(block, header, m, n, bytes(32))
+                      for n, f, m in shares]
+    assert all(accept()) and not any(reject())
+    for name, fn in (('final hash only', final_only), ('final hash batch', final_batch),
+                     ('verify accept', accept), ('verify reject', reject)):
+        print('meraki %-16s %10.0f verifications/s' % (name, rate(fn, len(shares))))
+
+    # Hashing against the lazily filled full dataset: once the touched items
+    # are stored, every lookup takes the ready-bitmap fast path.
+    light = lambda: [meraki.hash(block, header, n) for n in range(len(shares))]
+    full = lambda: [meraki.hash(block, header, n, full=True) for n in range(len(shares))]
+    assert light() == full()
+    print('meraki hash light %10.0f H/s   full dataset %10.0f H/s'
+          % (rate(light, len(shares)), rate(full, len(shares))))
+
+    # The mix on each vectorised round this CPU supports against one lane at
+    # a time; the full dataset leaves the mix as the bulk of the work.
+    for backend in ('avx512', 'avx2', 'generic'):
+        try:
+            meraki.set_mix_backend(backend)
+        except ValueError:
+            continue
+        assert full() == light()
+        print('meraki mix %-8s full dataset %10.0f H/s   verify %10.0f/s'
+              % (backend, rate(full, len(shares)), rate(accept, len(shares))))
+    meraki.set_mix_backend('auto')
+
+    # search() over the same nonces: 4 hashes interleaved per thread against
+    # one hash() call at a time, then the light cache split across threads.
+    miss = bytes(32)
+    assert meraki.search(block, header, b'\xff' * 32, 5, 64, 1, True)[0] == 5
+    search_full = lambda: meraki.search(block, header, miss, 0, len(shares), 1, True)
+    print('meraki search full dataset threads=1  %10.0f H/s' % rate(search_full, len(shares)))
+    for count in sorted({1, os.cpu_count() or 1}):
+        search_light = lambda: meraki.search(block, header, miss, 0, 256, count)
+        print('meraki search light threads=%-3d %10.0f H/s' % (count, rate(search_light, 256)))
+
+    # verify() drops the GIL, so threads on the same epoch scale per core.
+    for count in sorted({1, 2, os.cpu_count() or 1}):
+        done = [0] * count
+        stop = time.perf_counter() + 1.0
+
+        def worker(i):
+            while time.perf_counter() < stop:
+                accept()
+                done[i] += len(shares)
+
+        threads = [threading.Thread(target=worker, args=(i,)) for i in range(count)]
+        start = time.perf_counter()
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        total = sum(done) / (time.perf_counter() - start)
+        print('meraki verify threads=%-3d %10.0f verifications/s   %8.0f per core'
+              % (count, total, total / count))
+
+    # Crossing an epoch boundary with and without building the next epoch's
+    # context in the background from 50 blocks ahead.
+    boundary = (block // 27500 + 8) * 27500
+    meraki.set_prebuild_lead(50)
+    try:
+        meraki.hash(boundary - 10, header, 0)
+        while meraki.prebuilt_epoch() != boundary // 27500:
+            time.sleep(0.01)
+        for what, b in (('prebuilt', boundary), ('on demand', boundary + 27500)):
+            if what == 'on demand':
+                meraki.set_prebuild_lead(0)
+            start = time.perf_counter()
+            meraki.hash(b, header, 0)
+            print('meraki first hash of epoch %d, context %-9s %8.1f ms'
+                  % (b // 27500, what, (time.perf_counter() - start) * 1e3))
+    finally:
+        meraki.set_prebuild_lead(0)
+
+    # Round-robin over three epochs, more than a thread keeps to itself: a
+    # one-epoch shared cache rebuilds on every switch, a four-epoch one
+    # builds each epoch once.
+    epochs = [block + k * 27500 for k in (20, 21, 22)]
+    for limit in (1, 4):
+        meraki.set_cache_limits(limit)
+        before = meraki.cache_stats()
+        start = time.perf_counter()
+        for b in epochs * 2:
+            meraki.hash(b, header, 0)
+        after = meraki.cache_stats()
+        print('meraki 3 epochs x2, cache of %d   %6.2f s   hits %d misses %d builds %.2f s'
+              % (limit, time.perf_counter() - start, after['hits'] - before['hits'],
+                 after['misses'] - before['misses'],
+                 after['build_time'] - before['build_time']))
+    meraki.set_cache_limits(4)
+
+    # Light cache files: build and write two epochs, then switch back to the
+    # first, which is now mapped from its file.
+    with tempfile.TemporaryDirectory() as cache_dir:
+        meraki.set_cache_dir(cache_dir)
+        try:
+            for what, b in (('build+write', block + 27500), ('build+write', block),
+                            ('map file', block + 27500)):
+                start = time.perf_counter()
+                meraki.hash(b, header, 0)
+                print('meraki epoch %d context %-11s %8.1f ms'
+                      % (b // 27500, what, (time.perf_counter() - start) * 1e3))
+        finally:
+            meraki.set_cache_dir(None)
+
+
+def bench_meraki_dataset():
+    # Full-dataset generation rate on 1, 2, 4, ... threads up to one per CPU,
+    # each run stopped after two seconds.
+    meraki = algomodule.meraki
+    block = 3 * 27500
+    counts = [1]
+    while counts[-1] * 2 < (os.cpu_count() or 1):
+        counts.append(counts[-1] * 2)
+    if counts[-1] != (os.cpu_count() or 1):
+        counts.append(os.cpu_count() or 1)
+
+    base = None
+    for count in counts:
+        start = time.perf_counter()
+        done = [0, 0]
+
+        def progress(items_done, items_total):
+            done[:] = [items_done, items_total]
+            return time.perf_counter() - start < 2.0
+
+        meraki.prepare_dataset(block, count, progress)
+        items = done[0] / (time.perf_counter() - start)
+        base = base or items
+        print('meraki dataset threads=%-3d %10.0f items/s   x%.2f   (full dataset %.0f s)'
+              % (count, items, items / base, done[1] / items))
+
+
+def bench_meraki_memory():
+    # Light and full-dataset hashing with epoch contexts on the heap and on
+    # huge pages, and the dTLB read misses per hash where perf events are
+    # available. The policy applies to contexts built after it is set, so
+    # each gets an epoch of its own. On huge pages the dataset items touched
+    # are made resident 2 MiB at a time: about 1 GiB here.
+    meraki = algomodule.meraki
+    header = os.urandom(32)
+    counter = dtlb_miss_counter()
+    nonces = range(64)
+    for epoch, huge_pages in ((1, False), (2, True)):
+        block = epoch * 27500
+        meraki.set_memory_policy(huge_pages=huge_pages)
+        try:
+            light = lambda: [meraki.hash(block, header, n) for n in nonces[:8]]
+            full = lambda: [meraki.hash(block, header, n, full=True) for n in nonces]
+            full()  # Builds both contexts and fills the items the nonces read.
+            backing = '%s/%s' % (meraki.memory_backing(block),
+                                 meraki.memory_backing(block, full=True))
+        finally:
+            meraki.set_memory_policy()
+
+        for name, fn, count in (('light', light, 8), ('full', full, len(nonces))):
+            before = counter() if counter else 0
+            start = time.perf_counter()
+            runs = 0
+            while time.perf_counter() - start < 1.0:
+                fn()
+                runs += 1
+            elapsed = time.perf_counter() - start
+            misses = ('%10.0f' % ((counter() - before) / (runs * count))
+                      if counter else '       n/a')
+            print('meraki memory %-9s %-5s %10.0f H/s   %s dTLB misses/hash'
+                  % (backing, name, runs * count / elapsed, misses))
+
+
+def bench_neoscrypt():
+    neoscrypt = algomodule.neoscrypt
+    print('neoscrypt multi-hash backend %s, SMix core %s'
+          % (neoscrypt.backend(), neoscrypt.core_backend()))
+
+    # _neoscrypt_hash_many() takes the multi-hash kernels for the default
+    # profile only; every profile must hash as _neoscrypt_hash() does.
+    headers = [os.urandom(80) for _ in range(17)]
+    for profile in (0x0, 0x1, 0x2, 0x3, neoscrypt.custom_profile(256, 4)):
+        assert (neoscrypt._neoscrypt_hash_many(headers, profile)
+                == [neoscrypt._neoscrypt_hash(h, profile) for h in headers]), hex(profile)
+
+    # Built-in profiles on their specialised cores against the same N and r
+    # as an extended profile, which runs the generic SMix.
+    header = os.urandom(80)
+    for name, builtin, extended in (
+            ('neoscrypt', neoscrypt.PROFILE_NEOSCRYPT,
+             neoscrypt.custom_profile(128, 2)),
+            ('scrypt', neoscrypt.PROFILE_SCRYPT,
+             neoscrypt.custom_profile(1024, 1, salsa_only=True, sha256=True))):
+        assert (neoscrypt._neoscrypt_hash(header, builtin)
+                == neoscrypt._neoscrypt_hash(header, extended))
+        specialised = rate(lambda: neoscrypt._neoscrypt_hash(header, builtin), 1)
+        generic = rate(lambda: neoscrypt._neoscrypt_hash(header, extended), 1)
+        print('neoscrypt profile %-9s generic %8.0f H/s   specialised %8.0f H/s'
+              % (name, generic, specialised))
+    bench_batched('neoscrypt', algomodule.neoscrypt._neoscrypt_hash,
+                  algomodule.neoscrypt._neoscrypt_hash_many, 80, (4, 16, 256))
+
+    # Reused scratchpads: steady-state hashing should not fault in new pages.
+    header = os.urandom(80)
+    ctx = algomodule.neoscrypt.NeoScryptContext()
+    for name, fn in (('thread', algomodule.neoscrypt._neoscrypt_hash),
+                     ('context', ctx.hash)):
+        fn(header)
+        faults = resource.getrusage(resource.RUSAGE_SELF).ru_minflt
+        runs = 0
+        start = time.perf_counter()
+        while time.perf_counter() - start < 1.0:
+            fn(header)
+            runs += 1
+        faults = resource.getrusage(resource.RUSAGE_SELF).ru_minflt - faults
+        print('neoscrypt %-8s %8.0f H/s   minor page faults/hash %.3f'
+              % (name, runs / (time.perf_counter() - start), faults / runs))
+
+
+def bench_quark():
+    for batch in (8, 64, 1024):
+        headers = [os.urandom(80) for _ in range(batch)]
+        scalar = lambda: [algomodule.quark._quark_hash(h) for h in headers]
+        batched = lambda: algomodule.quark._quark_hash_many(headers)
+        assert scalar() == batched()
+
+        r_scalar = rate(scalar, batch)
+        r_batched = rate(batched, batch)
+        print('quark batch=%-5d scalar %10.0f H/s   batched %10.0f H/s   x%.2f'
+              % (batch, r_scalar, r_batched, r_batched / r_scalar))
+
+
+def bench_batched(name, scalar_fn, batched_fn, length, batches):
+    for batch in batches:
+        inputs = [os.urandom(length) for _ in range(batch)]
+        scalar = lambda: [scalar_fn(h) for h in inputs]
+        batched = lambda: batched_fn(inputs)
+        assert scalar() == batched()
+
+        r_scalar = rate(scalar, batch)
+        r_batched = rate(batched, batch)
+        print('%s len=%-4d batch=%-5d scalar %10.0f H/s   batched %10.0f H/s   x%.2f'
+              % (name, length, batch, r_scalar, r_batched, r_batched / r_scalar))
+
+
+def bench_sha256d():
+    print('sha256 backend %s, multi-buffer %s' % algomodule.sha256.backend())
+    sha256d = lambda h: hashlib.sha256(hashlib.sha256(h).digest()).digest()
+    for length in (64, 80):
+        bench_batched('sha256d', sha256d, algomodule.sha256._sha256d_hash_many,
+                      length, (16, 1024))
+
+
+def bench_scrypt():
+    print('scrypt smix backend %s, multi-hash %s' % algomodule.scrypt.backend())
+    bench_batched('scrypt', algomodule.scrypt._ltc_scrypt,
+                  algomodule.scrypt._ltc_scrypt_many, 80, (16, 256))
+
+    # Nonce sweep over one prepared header.
+    header = os.urandom(80)
+    nonces = list(range(256))
+    headers = [header[:76] + n.to_bytes(4, 'little') for n in nonces]
+    swept = lambda: algomodule.scrypt._ltc_scrypt_nonces(header, nonces)
+    assert swept() == [algomodule.scrypt._ltc_scrypt(h) for h in headers]
+
+    r_scalar = rate(lambda: [algomodule.scrypt._ltc_scrypt(h) for h in headers], len(nonces))
+    r_swept = rate(swept, len(nonces))
+    print('scrypt nonces=%-4d scalar %10.0f H/s   prepared %10.0f H/s   x%.2f'
+          % (len(nonces), r_scalar, r_swept, r_swept / r_scalar))
+
+    # Caller-owned, huge-page-backed scratchpad vs the per-thread default.
+    ctx = algomodule.scrypt.ScryptContext(huge_pages=True)
+    r_thread = rate(lambda: algomodule.scrypt._ltc_scrypt_many(headers), len(headers))
+    r_ctx = rate(lambda: ctx.hash_many(headers), len(headers))
+    print('scrypt context (%s)  thread %10.0f H/s   context %10.0f H/s   x%.2f'
+          % (ctx.backing, r_thread, r_ctx, r_ctx / r_thread))
+
+
+def bench_scryptn():
+    # Each hash writes and then randomly re-reads a 128 * r * N byte V.
+    batch = 32
+    inputs = [os.urandom(80) for _ in range(batch)]
+    for n in (1024, 2048, 4096, 8192, 16384):
+        scalar = lambda: [algomodule.scrypt._scryptn_hash(h, n) for h in inputs]
+        batched = lambda: algomodule.scrypt._scryptn_hash_many(inputs, n)
+        assert scalar() == batched()
+
+        r_scalar = rate(scalar, batch)
+        r_batched = rate(batched, batch)
+        print('scryptn N=%-6d V=%5d KiB  scalar %8.0f H/s   batched %8.0f H/s'
+              '   x%.2f   V traffic %5.2f GB/s'
+              % (n, 128 * n // 1024, r_scalar, r_batched, r_batched / r_scalar,
+                 r_batched * 256 * n / 1e9))
+
+
+def bench_neoscrypt_kdf():
+    # FastKDF alone against the whole hash, for each FastKDF variant.
+    print('neoscrypt BLAKE2s backend %s' % algomodule.neoscrypt.kdf_backend())
+    header = os.urandom(80)
+    expect = algomodule.neoscrypt._neoscrypt_hash(header)
+    for kdf in ('generic', 'opt', 'auto'):
+        algomodule.neoscrypt.set_kdf(kdf)
+        assert algomodule.neoscrypt._neoscrypt_hash(header) == expect
+        kdf_rate = rate(lambda: algomodule.neoscrypt._fastkdf_only(header), 1)
+        hash_rate = rate(lambda: algomodule.neoscrypt._neoscrypt_hash(header), 1)
+        print('neoscrypt kdf %-8s %6.2f us/kdf %8.2f us/hash   kdf share %4.1f%%'
+              % (kdf, 1e6 / kdf_rate, 1e6 / hash_rate,
+                 100.0 * hash_rate / kdf_rate))
+    algomodule.neoscrypt.set_kdf('auto')
+
+
+def bench_smix():
+    # V-read strategies of the multi-hash SMix at one full pass of lanes.
+    counter = llc_miss_counter()
+    batch = 8
+    inputs = [os.urandom(80) for _ in range(batch)]
+    for n in (1024, 16384, 65536):
+        expect = algomodule.scrypt._scryptn_hash_many(inputs, n)
+        for strategy in ('lockstep', 'prefetch', 'pipeline'):
+            algomodule.scrypt.set_smix_strategy(strategy)
+            batched = lambda: algomodule.scrypt._scryptn_hash_many(inputs, n)
+            assert batched() == expect
+
+            before = counter() if counter else 0
+            start = time.perf_counter()
+            runs = 0
+            while time.perf_counter() - start < 1.0:
+                batched()
+                runs += 1
+            elapsed = time.perf_counter() - start
+            misses = ('%10.0f' % ((counter() - before) / (runs * batch))
+                      if counter else '       n/a')
+            print('smix N=%-6d %-8s %8.0f H/s   LLC misses/hash %s'
+                  % (n, strategy, runs * batch / elapsed, misses))
+    algomodule.scrypt.set_smix_strategy('auto')
+
+
+def bench_skein():
+    bench_batched('skein', algomodule.skein._skein_hash,
+                  algomodule.skein._skein_hash_many, 80, (16, 1024))
+
+
+BENCHMARKS = {
+    'meraki': bench_meraki,
+    'meraki_dataset': bench_meraki_dataset,
+    'meraki_memory': bench_meraki_memory,
+    'neoscrypt': bench_neoscrypt,
+    'neoscrypt_kdf': bench_neoscrypt_kdf,
+    'quark': bench_quark,
+    'scrypt': bench_scrypt,
+    'scryptn': bench_scryptn,
+    'sha256d': bench_sha256d,
+    'skein': bench_skein,
+    'smix': bench_smix,
+}
+
+if __name__ == '__main__':
+    names = sys.argv[1:] or sorted(BENCHMARKS)
+    for name in names:
+        BENCHMARKS[name]()